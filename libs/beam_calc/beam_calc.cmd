@@ -1,2 +1,2 @@
-::gcc -O3 -ffast-math -funsafe-math-optimizations -msse4.2 -DUSE_BLAS -o beam_calc beam_calc.c main.c -I ../openblas/include ../openblas/lib/libopenblas.a && beam_calc
-gcc -O3 -ffast-math -funsafe-math-optimizations -msse4.2 -o beam_calc beam_calc.c main.c && beam_calc
\ No newline at end of file
+::gcc -O3 -ffast-math -funsafe-math-optimizations -msse4.2 -DUSE_BLAS -o beam_calc beam_calc.c beam_calc_simd.c beam_calc_pool.c main.c -I ../openblas/include ../openblas/lib/libopenblas.a && beam_calc
+gcc -O3 -ffast-math -funsafe-math-optimizations -msse4.2 -o beam_calc beam_calc.c beam_calc_simd.c beam_calc_pool.c main.c -lpthread && beam_calc
\ No newline at end of file
@@ -49,6 +49,21 @@ typedef struct {
     uint8_t *buf;
 } CgnBeamCalc;
 
+typedef struct {
+    int x1, x2;
+    int y1, y2;
+    int nan;
+    double p;
+    double xc; // Beam center X
+    double yc; // Beam center Y
+    double xx;
+    double yy;
+    double xy;
+    double dx; // Beam width along principal axis X
+    double dy; // Beam width along principal axis Y
+    double phi; // CCW angle between principal axis X and the horizont, in degrees
+} CgnBeamResult;
+
 typedef struct {
     // Aperture bounds inside that calculations should be carried out.
     int ax1, ay1, ax2, ay2;
@@ -77,6 +92,11 @@ typedef struct {
     // When subtract_bkgnd_v=1, only pixes inside aperture bonds have valid values.
     double *subtracted;
 
+    // Single precision alternative to `subtracted`, it's used instead when set.
+    // Takes half of the memory, moments are still accumulated in double.
+    // Centers and widths match the double precision within 0.01 px.
+    float *subtracted_f32;
+
     // The latest calculation aperture inside that the beam diameter has been calculated with required precision.
     // Can not be larger and clamped to initial aperture bounds.
     int x1, x2, y1, y2;
@@ -94,23 +114,199 @@ typedef struct {
     int count;
 
     // Version on the subtract_bkgnd function
+    // 0 - the whole frame is written into `subtracted`
+    // 1 - only the aperture is written into `subtracted`
+    // 2 - the background is subtracted on the fly when calculating moments
+    //     directly from the raw buffer, `subtracted` is not used (can be NULL),
+    //     call cgn_subtract_bkgnd_to_f64 when the subtracted image is needed.
     int subtract_bkgnd_v;
+
+    // Version of the calc_beam function
+    // 0 - two passes: centroid first, then second moments
+    // 1 - single pass, see cgn_calc_beam_naive_1
+    // 2 - summed-area tables are built once per frame from the subtracted data
+    //     (or from the raw frame when subtract_bkgnd_v=2),
+    //     then each iteration costs a constant number of lookups.
+    //     Requires `sat` buffer, otherwise the version 1 is used.
+    int calc_beam_v;
+
+    // Summed-area tables used when calc_beam_v=2,
+    // it should have at least cgn_sat_size(w, h) elements.
+    double *sat;
+
+    // Decimation factor (2-16) of the coarse copy of the aperture
+    // where the background and the initial beam position are estimated,
+    // then only mask iterations are done at full resolution.
+    // 0 - the initial position is calculated over the full aperture.
+    // Only used when subtract_bkgnd_v=2 and summed-area tables are not used,
+    // falls back to the full aperture when the beam is not found in the coarse copy.
+    // Iterations start from another position then, so results agree with the full aperture
+    // start within `precision` of the beam width, not exactly.
+    int decimate;
+
+    // Coarse copy of the aperture used when decimate > 1,
+    // it should have at least cgn_decimated_size(w, h, decimate) elements.
+    uint16_t *decimated;
+
+    // Previous result that the iterations start from (tracking mode), can point to the result
+    // being calculated. The full aperture is used when it's NULL or NaN, when the beam
+    // has moved or changed its size by more than a quarter of its width,
+    // or when there are less than 10 pixels above the noise threshold in the mask.
+    // Not used with summed-area tables or when max_iter=0.
+    const CgnBeamResult *track;
+
+    // Mean and sdev of the aperture corners are already calculated for the current frame
+    // (see cgn_convert_packed_to_u16), the next cgn_calc_beam_bkgnd call takes them
+    // instead of calculating and resets the flag.
+    int corners_ready;
 } CgnBeamBkgnd;
 
+// Max flat field gain, see cgn_calib_make_gain
+#define CGN_MAX_GAIN 4
+
+// Dark frame and flat field calibration, see cgn_calibrate
 typedef struct {
-    int x1, x2;
-    int y1, y2;
-    int nan;
-    double p;
-    double xc; // Beam center X
-    double yc; // Beam center Y
-    double xx;
-    double yy;
-    double xy;
-    double dx; // Beam width along principal axis X
-    double dy; // Beam width along principal axis Y
-    double phi; // CCW angle between principal axis X and the horizont, in degrees
-} CgnBeamResult;
+    // Master dark frame, the rounded mean of dark frames, NULL to skip dark subtraction.
+    const uint16_t *dark;
+
+    // Flat field gains of pixels, NULL to skip flat field correction.
+    const float *gain;
+
+    // Value added back after the dark frame is subtracted, usually the mean level of the dark frame.
+    // So only the fixed pattern is removed, the uniform level is still estimated from corners
+    // and the noise around it is not clipped at zero.
+    int offset;
+} CgnCalib;
+
+// Size of the working buffer of cgn_find_defects, mean values are limited to 16 bits
+#define CGN_DEFECT_BINS 65536
+
+// Fewer frames of a low noise sensor can repeat the same value by chance,
+// so stuck pixels are only searched in longer series, see cgn_find_defects
+#define CGN_DEFECT_STUCK_FRAMES 8
+
+// Defect pixels of the sensor, see cgn_find_defects
+typedef struct {
+    // Indices of defect pixels in the frame in ascending order
+    const int32_t *idx;
+    int count;
+} CgnDefects;
+
+// Statistics collected by cgn_convert_packed_to_u16 while unpacking a frame
+typedef struct {
+    // Relative level of overexposure, see cgn_calc_overexposure
+    double overexposure_th;
+
+    // Background state whose aperture corners should be calculated, NULL to skip.
+    // It gets mean, sdev, and corners_ready set.
+    CgnBeamBkgnd *bkgnd;
+
+    // Area [x1, x2) x [y1, y2) to unpack, the full frame when it's empty.
+    // It should include the aperture of `bkgnd`, pixels outside of the area are left as is.
+    int x1, y1, x2, y2;
+
+    // Calibration applied to unpacked rows before statistics are calculated, NULL to skip.
+    const CgnCalib *calib;
+
+    // Defect pixels patched when the area is unpacked and calibrated, NULL to skip.
+    // Only neighbours inside of the area are taken. Corners and overexposure
+    // are calculated over patched pixels, brightness is taken before patching.
+    const CgnDefects *defects;
+
+    // The full frame has been unpacked, brightness and overexposure
+    // are only calculated in this case and are 0 otherwise
+    int full;
+    double brightness; // The same as cgn_calc_brightness_1 returns
+    double overexposed; // The same as cgn_calc_overexposure returns
+} CgnFrameStats;
+
+// Histogram of pixel values, see cgn_calc_histogram
+typedef struct {
+    // Every step-th pixel of every step-th row is counted, 0 and 1 mean all pixels
+    int step;
+
+    // Area [x1, x2) x [y1, y2) to count pixels in, the full frame when it's empty
+    int x1, y1, x2, y2;
+
+    // Background state whose aperture corners are calculated in the same pass
+    // like cgn_convert_packed_to_u16 does, NULL to skip. Only used when step is 1.
+    CgnBeamBkgnd *bkgnd;
+
+    // The number of parts counted in parallel, each part has its own sub-histogram
+    int parts;
+
+    // Counts of values, the first `bins` elements, followed by sub-histograms of parts,
+    // it should have at least cgn_histogram_size(bpp, parts) elements.
+    uint32_t *data;
+
+    int bins; // 256 for 8-bit frames, 1 << bpp for others
+    int64_t count; // The number of counted pixels
+} CgnHistogram;
+
+// Max software binning factor, see cgn_bin_frame
+#define CGN_MAX_BINNING 4
+
+// Max number of frames in CgnStack, sums of 16-bit pixels over them are exact in floats
+#define CGN_MAX_STACK 256
+
+// Running sum of the last frames for averaging of images, see cgn_stack_add
+typedef struct {
+    // Capacity of the ring, up to CGN_MAX_STACK frames
+    int frames;
+
+    // Ring of `frames` frames of w*h pixels of the frame type (8 or 16-bit)
+    uint8_t *ring;
+
+    // Sums of pixels over frames in the ring, w*h elements
+    uint32_t *sum;
+
+    int count; // The number of frames in the ring
+    int next; // Ring slot for the next frame
+} CgnStack;
+
+// Sums over pixels of a connected component, see cgn_find_spots
+typedef struct {
+    double n, x, y, xx, yy, xy; // Σ1, Σx, Σy, Σx², Σy², Σxy
+    double p, px, py, pxx, pyy, pxy; // The same weighted by pixel values
+    int x1, y1, x2, y2; // Bounding box [x1, x2) x [y1, y2)
+} CgnSpotMoments;
+
+// Spot array mode, many beams are found in one pass over the frame, see cgn_find_spots
+typedef struct {
+    // Area [x1, x2) x [y1, y2) to search spots in, the full frame when it's empty
+    int x1, y1, x2, y2;
+
+    // Threshold relative to the frame max above the background (0-1)
+    double level;
+
+    // Components of fewer pixels are dropped as noise
+    int min_area;
+
+    // The background is subtracted from pixels of spots when it's set
+    int subtract;
+
+    // Working buffers: `parent` and `moments` should have max_labels+1 elements,
+    // `runs` should have at least cgn_spots_runs_size(w) elements
+    int max_labels;
+    int32_t *parent;
+    CgnSpotMoments *moments;
+    int32_t *runs;
+
+    // Found spots in raster order of their top-left pixels, up to max_spots
+    int max_spots;
+    CgnBeamResult *spots;
+    int count;
+
+    // Labels or spots didn't fit into buffers and some spots are missed
+    int overflow;
+
+    // The threshold used for the frame, the mean of pixels not above it, the max of pixels above it.
+    // The background and the max are kept for the threshold of the next frame, the frame max is searched
+    // in an additional pass when they are not known yet or there were no spots in the previous frame.
+    int th;
+    double bkgnd;
+    int max;
+} CgnSpots;
 
 typedef struct {
     int w;
@@ -127,18 +323,150 @@ typedef struct {
     double *y_p; // Profile value along principal axis Y
 } CgnBeamProfiles;
 
+// Instruction sets that can be used by calculation kernels
+#define CGN_SIMD_NONE 0
+#define CGN_SIMD_SSE42 1
+#define CGN_SIMD_AVX2 2
+#define CGN_SIMD_AVX512 3
+
+// Selects the widest instruction set supported by the CPU.
+// Should be called once at startup before any calculation,
+// otherwise scalar kernels are used.
+int cgn_init_simd();
+// Returns the widest instruction set supported by the CPU.
+int cgn_detect_simd();
+// Selects a specific instruction set, it's clamped to what the CPU supports.
+// Returns the selected one.
+int cgn_set_simd(int level);
+int cgn_get_simd();
+const char* cgn_simd_name(int level);
+
+// Sets the number of threads used by calculation functions
+// (including the calling thread), 0 means the number of physical cores.
+// Worker threads are created on the first calculation with the default count.
+// Results of the single pass calculation for 8 and 16-bit frames
+// are the same for any thread count (moments are accumulated in integers),
+// other results can differ in the last digits for different thread counts
+// (sums are reduced in a different order) but they are
+// always the same for the same thread count.
+// Returns the actual number of threads.
+int cgn_set_threads(int count);
+int cgn_get_threads();
+int cgn_physical_cores();
+
 void cgn_calc_beam_naive(const CgnBeamCalc *c, CgnBeamResult *r);
+// Single pass version of cgn_calc_beam_naive, reads each pixel only once.
+// Results match the two-pass version within 1e-6 px for centers and widths.
+void cgn_calc_beam_naive_1(const CgnBeamCalc *c, CgnBeamResult *r);
 void cgn_calc_beam_bkgnd(const CgnBeamCalc *c, CgnBeamBkgnd *b, CgnBeamResult *r);
+// Calculates `count` apertures of the same frame in parallel, one aperture per thread.
+// Each aperture has its own state b[i] and result r[i], result bounds are initialized
+// from aperture bounds b[i].ax1..ay2. States can share the `subtracted` buffer
+// (subtract_bkgnd_v=1 only writes inside of the aperture), then overlapping apertures
+// are calculated sequentially. The `sat` buffer can't be shared, each aperture
+// needs its own part of cgn_sat_size(ax2-ax1, ay2-ay1) elements.
+// When there are less apertures than threads, they are calculated
+// one by one, each on all threads. Results are the same in both cases.
+void cgn_calc_beam_bkgnd_multi(const CgnBeamCalc *c, CgnBeamBkgnd *b, CgnBeamResult *r, int count);
+// Size of the CgnBeamBkgnd::sat buffer for frames of size w*h (about 6*w*h doubles)
+int cgn_sat_size(int w, int h);
+// Size of the CgnBeamBkgnd::decimated buffer for frames of size w*h
+int cgn_decimated_size(int w, int h, int decimate);
+// Writes the frame with background subtracted like subtract_bkgnd_v=0 does,
+// using the background calculated by the last cgn_calc_beam_bkgnd call.
+// For subtract_bkgnd_v=2 that doesn't produce the subtracted image itself.
+void cgn_subtract_bkgnd_to_f64(const CgnBeamCalc *c, CgnBeamBkgnd *b, double *dst);
 void cgn_copy_to_f64(const CgnBeamCalc *c, double *dst, double *max);
+void cgn_copy_to_f32(const CgnBeamCalc *c, float *dst, double *max);
 void cgn_normalize_f64(double *buf, int sz, double min, double max);
 void cgn_copy_normalized_f64(double *src, double *dst, int sz, double min, double max);
+void cgn_copy_normalized_f32(const float *src, double *dst, int sz, double min, double max);
 double cgn_calc_brightness(const CgnBeamCalc *c);
 double cgn_calc_brightness_1(const CgnBeamCalc *c);
 double cgn_calc_brightness_2(const CgnBeamCalc *c, int xc, int yc);
 void cgn_convert_10g40_to_u16(uint8_t *dst, uint8_t *src, int sz);
 void cgn_convert_12g24_to_u16(uint8_t *dst, uint8_t *src, int sz);
+// Unpacks Mono10g40 (c->bpp=10) or Mono12g24 (c->bpp=12) frame `src` into c->buf
+// and calculates statistics `s` of unpacked rows while they are still in cache.
+void cgn_convert_packed_to_u16(const uint8_t *src, const CgnBeamCalc *c, CgnFrameStats *s);
+// Adds pixel values of the frame to `sum` of w*h elements, used for averaging of frames,
+// and their squares to `sum_sq` when it's not NULL
+void cgn_accumulate(const CgnBeamCalc *c, uint32_t *sum, uint64_t *sum_sq);
+// Writes the master dark frame of `sz` pixels averaged from the sum of `frames` dark frames.
+// Returns the mean level of the master, it's used as CgnCalib::offset.
+int cgn_calib_make_dark(const uint32_t *sum, int frames, int sz, uint16_t *dark);
+// Writes flat field gains of `sz` pixels from the sum of `frames` uniformly lit frames,
+// the master dark frame is subtracted from them when it's not NULL. A gain is the ratio
+// of the mean value to the pixel value, clamped to [1/CGN_MAX_GAIN, CGN_MAX_GAIN],
+// dead pixels get 1.
+void cgn_calib_make_gain(const uint32_t *sum, int frames, int sz, const uint16_t *dark, float *gain);
+// Writes calibrated 8 or 16-bit frame `src` into c->buf: `(v - dark) * gain + offset`
+// rounded and clamped to the range of c->bpp, `src` can be c->buf.
+// Packed frames are calibrated by cgn_convert_packed_to_u16 while unpacking.
+void cgn_calibrate(const uint8_t *src, const CgnBeamCalc *c, const CgnCalib *cal);
+// Finds defect pixels from sums of `frames` dark frames of `sz` pixels of `bpp` bits (see cgn_accumulate).
+// Hot pixels have the mean value farther than `nT` noise levels from the median of all pixels,
+// where the noise level is estimated from the median absolute deviation and is at least 1.
+// Stuck pixels don't change over frames when the typical pixel does (`sum_sq` can be NULL to skip),
+// they are searched in series of at least CGN_DEFECT_STUCK_FRAMES frames, and pixels clipped
+// at 0 or at the max value are not taken as stuck.
+// `hist` is a working buffer of CGN_DEFECT_BINS elements.
+// Writes up to `max_count` indices in ascending order to `idx`, returns the number of found defects.
+int cgn_find_defects(const uint32_t *sum, const uint64_t *sum_sq, int frames, int sz, int bpp, double nT,
+    uint32_t *hist, int32_t *idx, int max_count);
+// Replaces defect pixels of the frame with the median of their neighbours that are not defects,
+// the cost is proportional to the number of defects
+void cgn_fix_defects(const CgnBeamCalc *c, const CgnDefects *d);
 void cgn_ext_copy_to_f64(const CgnBeamCalc *c, CgnBeamBkgnd *b, double *dst, int normalize, int full_z, double *min_z, double *max_z);
+// Version of cgn_ext_copy_to_f64 for apertures `a` calculated with subtract_bkgnd_v=1
+// into the shared buffer of `b`, only pixels inside of apertures are valid there.
+// They are combined with the raw frame outside of apertures.
+// `b` provides min and max values of all apertures.
+void cgn_ext_copy_apertures_to_f64(const CgnBeamCalc *c, CgnBeamBkgnd *b, const CgnBeamBkgnd *a, int count,
+    double *dst, int normalize, int full_z, double *min_z, double *max_z);
 double cgn_calc_overexposure(const CgnBeamCalc *c, double th);
+int cgn_histogram_size(int bpp, int parts);
+// Counts pixel values of the frame in a single pass. Parts of the area are counted
+// in parallel into their own sub-histograms, that are summed then.
+void cgn_calc_histogram(const CgnBeamCalc *c, CgnHistogram *hist);
+// The least value that is not less than the fraction `p` of counted pixels
+int cgn_histogram_percentile(const CgnHistogram *hist, double p);
+// Fraction of counted pixels not less than `th` of the max value,
+// with step=2 it's the same as cgn_calc_overexposure returns for frames of even size.
+double cgn_histogram_overexposure(const CgnHistogram *hist, double th);
+// Mean and sdev of counted pixels, they are calculated from exact integer sums
+void cgn_histogram_stats(const CgnHistogram *hist, double *mean, double *sdev);
+// Bits per pixel of frames binned by cgn_bin_frame, sums of factor*factor pixels need
+// up to 2*log2(factor) more bits than pixels, but 16 bits at most
+int cgn_binned_bpp(int bpp, int factor);
+// Writes sums of factor*factor blocks of the frame `src` into the 16-bit frame `dst`
+// of size (src->w / factor) x (src->h / factor), dst->bpp should be cgn_binned_bpp(src->bpp, factor).
+// Sums not fitting into 16 bits are shifted right, so no precision is lost otherwise.
+void cgn_bin_frame(const CgnBeamCalc *src, const CgnBeamCalc *dst, int factor);
+// Empties the ring, zeroes `ring` and `sum` for frames of the size of `c`
+void cgn_stack_reset(CgnStack *s, const CgnBeamCalc *c);
+// Adds the frame c->buf to the running sum and puts it into the ring in place of the oldest frame,
+// that is subtracted from the sum in the same pass, so the cost doesn't depend on the number of frames
+void cgn_stack_add(CgnStack *s, const CgnBeamCalc *c);
+// Writes the mean of frames in the ring rounded to nearest into c->buf
+void cgn_stack_average(const CgnStack *s, const CgnBeamCalc *c);
+// Size of the `runs` buffer of cgn_find_spots, in elements
+int cgn_spots_runs_size(int w);
+// Thresholds the frame and labels its connected components (8-neighbourhood) in one pass,
+// runs of pixels above the threshold are joined with runs of the previous row by union-find.
+// Moments of components are accumulated in the same pass and merged when their trees are joined.
+// Returns the number of found spots.
+int cgn_find_spots(const CgnBeamCalc *c, CgnSpots *s);
+// Sets mean and sdev of `b` so that only pixels above the spot threshold of the last cgn_find_spots
+// are shown by cgn_ext_copy_to_f64, the display threshold there is `mean+nT * sdev`,
+// so it can't be raised above the background when `b->nT` is zero
+void cgn_spots_display_bkgnd(const CgnSpots *s, CgnBeamBkgnd *b);
+// Matches spots to `slots` holding the last known results of spots by the nearest centers,
+// a spot should be within the half width of the beam of its slot (but at least 2 px).
+// `slot_of_spot` gets the slot index or -1 for new spots, `spot_of_slot` gets the inverse.
+// Slots with NaN results are not matched.
+void cgn_match_spots(const CgnBeamResult *slots, int slot_count, const CgnBeamResult *spots, int count,
+    int *slot_of_spot, int *spot_of_slot);
 void cgn_calc_profiles(const CgnBeamImage *img, const CgnBeamResult *res, CgnBeamProfiles *prf);
 
 #ifdef __cplusplus
@@ -0,0 +1,245 @@
+#include "beam_calc.h"
+#include "beam_calc_pool.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define min(a,b) ((a) < (b) ? (a) : (b))
+#define max(a,b) ((a) > (b) ? (a) : (b))
+
+//------------------------------------------------------------------------------
+//                              Physical cores
+//------------------------------------------------------------------------------
+
+static int logical_cores() {
+#ifdef _WIN32
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return max((int)si.dwNumberOfProcessors, 1);
+#else
+    return max((int)sysconf(_SC_NPROCESSORS_ONLN), 1);
+#endif
+}
+
+int cgn_physical_cores() {
+#ifdef _WIN32
+    DWORD len = 0;
+    GetLogicalProcessorInformation(NULL, &len);
+    if (len == 0)
+        return logical_cores();
+    SYSTEM_LOGICAL_PROCESSOR_INFORMATION *info = malloc(len);
+    if (!info)
+        return logical_cores();
+    int cores = 0;
+    if (GetLogicalProcessorInformation(info, &len)) {
+        const int n = len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION);
+        for (int i = 0; i < n; i++)
+            if (info[i].Relationship == RelationProcessorCore)
+                cores++;
+    }
+    free(info);
+    return cores > 0 ? cores : logical_cores();
+#else
+    // Count unique (package, core) pairs, hyper-threads share the same pair
+    int ids[1024][2];
+    int cores = 0;
+    const int cpus = min((int)sysconf(_SC_NPROCESSORS_CONF), 1024);
+    for (int cpu = 0; cpu < cpus; cpu++) {
+        int id[2];
+        const char *names[2] = { "physical_package_id", "core_id" };
+        int ok = 1;
+        for (int k = 0; k < 2 && ok; k++) {
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, names[k]);
+            FILE *f = fopen(path, "r");
+            ok = f && fscanf(f, "%d", &id[k]) == 1;
+            if (f) fclose(f);
+        }
+        if (!ok)
+            continue;
+        int found = 0;
+        for (int i = 0; i < cores && !found; i++)
+            found = ids[i][0] == id[0] && ids[i][1] == id[1];
+        if (!found) {
+            ids[cores][0] = id[0];
+            ids[cores][1] = id[1];
+            cores++;
+        }
+    }
+    return cores > 0 ? cores : logical_cores();
+#endif
+}
+
+//------------------------------------------------------------------------------
+//                                Worker pool
+//------------------------------------------------------------------------------
+
+static struct {
+    pthread_mutex_t run_lock; // held while a job is running or the pool is being rebuilt
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    pthread_t workers[CGN_MAX_THREADS];
+    int threads; // including the calling thread
+    unsigned start_gen;
+    unsigned gen;
+    int pending;
+    int quit;
+    CgnBandFunc func;
+    void *arg;
+    int y1, y2, bands;
+} pool = {
+    .run_lock = PTHREAD_MUTEX_INITIALIZER,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .threads = 1,
+};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+static int band_row(int y1, int y2, int bands, int band) {
+    return y1 + (int)((long long)(y2 - y1) * band / bands);
+}
+
+static void* pool_worker(void *p) {
+    const int band = (int)(intptr_t)p;
+    pthread_mutex_lock(&pool.lock);
+    unsigned gen = pool.start_gen;
+    for (;;) {
+        while (pool.gen == gen && !pool.quit)
+            pthread_cond_wait(&pool.start, &pool.lock);
+        if (pool.quit)
+            break;
+        gen = pool.gen;
+        if (band >= pool.bands)
+            continue;
+        const CgnBandFunc func = pool.func;
+        void *arg = pool.arg;
+        const int y1 = pool.y1, y2 = pool.y2, bands = pool.bands;
+        pthread_mutex_unlock(&pool.lock);
+
+        func(arg, band, band_row(y1, y2, bands, band), band_row(y1, y2, bands, band+1));
+
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.pending == 0)
+            pthread_cond_signal(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+// Should be called under run_lock
+static void pool_stop() {
+    pthread_mutex_lock(&pool.lock);
+    pool.quit = 1;
+    pthread_cond_broadcast(&pool.start);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 1; i < pool.threads; i++)
+        pthread_join(pool.workers[i], NULL);
+    pool.quit = 0;
+    pool.threads = 1;
+}
+
+// Should be called under run_lock
+static void pool_start(int count) {
+    pool.start_gen = pool.gen;
+    pool.threads = 1;
+    // The calling thread processes band 0, workers start from band 1
+    for (int i = 1; i < count; i++) {
+        if (pthread_create(&pool.workers[i], NULL, pool_worker, (void*)(intptr_t)i))
+            break;
+        pool.threads++;
+    }
+}
+
+static int thread_count(int count) {
+    if (count <= 0)
+        count = cgn_physical_cores();
+    return min(max(count, 1), CGN_MAX_THREADS);
+}
+
+static void pool_init() {
+    pthread_mutex_lock(&pool.run_lock);
+    pool_start(thread_count(0));
+    pthread_mutex_unlock(&pool.run_lock);
+}
+
+int cgn_set_threads(int count) {
+    pthread_once(&pool_once, pool_init);
+    count = thread_count(count);
+    pthread_mutex_lock(&pool.run_lock);
+    if (count != pool.threads) {
+        pool_stop();
+        pool_start(count);
+    }
+    count = pool.threads;
+    pthread_mutex_unlock(&pool.run_lock);
+    return count;
+}
+
+int cgn_get_threads() {
+    pthread_once(&pool_once, pool_init);
+    return pool.threads;
+}
+
+static int pool_bands(int y1, int y2, int min_rows) {
+    pthread_once(&pool_once, pool_init);
+    return min(max((y2 - y1) / min_rows, 1), pool.threads);
+}
+
+int cgn_pool_bands(int y1, int y2) {
+    return pool_bands(y1, y2, CGN_MIN_BAND_ROWS);
+}
+
+static int pool_run(CgnBandFunc func, void *arg, int y1, int y2, int min_rows) {
+    pthread_once(&pool_once, pool_init);
+    int bands;
+    if (pthread_mutex_trylock(&pool.run_lock) == 0) {
+        bands = pool_bands(y1, y2, min_rows);
+        if (bands > 1) {
+            pthread_mutex_lock(&pool.lock);
+            pool.func = func;
+            pool.arg = arg;
+            pool.y1 = y1;
+            pool.y2 = y2;
+            pool.bands = bands;
+            pool.pending = bands - 1;
+            pool.gen++;
+            pthread_cond_broadcast(&pool.start);
+            pthread_mutex_unlock(&pool.lock);
+
+            func(arg, 0, band_row(y1, y2, bands, 0), band_row(y1, y2, bands, 1));
+
+            pthread_mutex_lock(&pool.lock);
+            while (pool.pending > 0)
+                pthread_cond_wait(&pool.done, &pool.lock);
+            pthread_mutex_unlock(&pool.lock);
+
+            pthread_mutex_unlock(&pool.run_lock);
+            return bands;
+        }
+        pthread_mutex_unlock(&pool.run_lock);
+    } else {
+        bands = pool_bands(y1, y2, min_rows);
+    }
+    for (int k = 0; k < bands; k++)
+        func(arg, k, band_row(y1, y2, bands, k), band_row(y1, y2, bands, k+1));
+    return bands;
+}
+
+int cgn_pool_run(CgnBandFunc func, void *arg, int y1, int y2) {
+    return pool_run(func, arg, y1, y2, CGN_MIN_BAND_ROWS);
+}
+
+int cgn_pool_run_items(CgnBandFunc func, void *arg, int count) {
+    return pool_run(func, arg, 0, count, 1);
+}
@@ -0,0 +1,34 @@
+#ifndef _CIGNUS_BEAM_CALC_POOL_H_
+#define _CIGNUS_BEAM_CALC_POOL_H_
+
+#define CGN_MAX_THREADS 64
+
+// Rows of a band are never less than this,
+// smaller ranges are split into fewer bands
+#define CGN_MIN_BAND_ROWS 16
+
+// Processes rows [i1, i2) of the band with index `band`.
+// Each band should store its partial results separately
+// (e.g. in an array indexed by `band`), they are then
+// reduced by the caller in band order that gives the same result
+// regardless of which threads have processed which bands.
+typedef void (*CgnBandFunc)(void *arg, int band, int i1, int i2);
+
+// Returns the number of bands the row range [y1, y2) is split into.
+// It only depends on the range and on the number of threads.
+int cgn_pool_bands(int y1, int y2);
+
+// Splits the row range [y1, y2) into bands and runs `func` for each band
+// on the worker threads and the calling thread, returns when all bands are done.
+// If the pool is busy with another call (e.g. from another camera thread),
+// all bands are processed sequentially on the calling thread.
+// Returns the number of bands.
+int cgn_pool_run(CgnBandFunc func, void *arg, int y1, int y2);
+
+// Same as cgn_pool_run but splits `count` independent items (e.g. apertures)
+// with no minimal band size, each band gets the item range [i1, i2).
+// Calls of cgn_pool_run made from `func` process their bands sequentially
+// on the current thread since the pool is busy with the items.
+int cgn_pool_run_items(CgnBandFunc func, void *arg, int count);
+
+#endif // _CIGNUS_BEAM_CALC_POOL_H_
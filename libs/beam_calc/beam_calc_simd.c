@@ -0,0 +1,1578 @@
+#include "beam_calc.h"
+#include "beam_calc_simd.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CGN_SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define min(a,b) ((a) < (b) ? (a) : (b))
+#define max(a,b) ((a) > (b) ? (a) : (b))
+
+//------------------------------------------------------------------------------
+//                                  Scalar
+//------------------------------------------------------------------------------
+
+#define _cgn_moments_row                        \
+    double p0 = 0, s1 = 0, s2 = 0;              \
+    for (int j = x1; j < x2; j++) {             \
+        const double v = row[j];                \
+        const double dj = j - x0;               \
+        p0 += v;                                \
+        s1 += v * dj;                           \
+        s2 += v * dj * dj;                      \
+    }                                           \
+    s[0] = p0;                                  \
+    s[1] = s1;                                  \
+    s[2] = s2;
+
+// Integer version of _cgn_moments_row for integer pixels, the sums are exact
+#define _cgn_moments_row_i                      \
+    int64_t p0 = 0, s1 = 0, s2 = 0;             \
+    for (int j = x1; j < x2; j++) {             \
+        const int64_t v = row[j];               \
+        const int64_t dj = j - x0;              \
+        p0 += v;                                \
+        s1 += v * dj;                           \
+        s2 += v * dj * dj;                      \
+    }                                           \
+    s[0] = p0;                                  \
+    s[1] = s1;                                  \
+    s[2] = s2;
+
+static void moments_u8(const uint8_t *row, int x1, int x2, int x0, int64_t *s) {
+    _cgn_moments_row_i
+}
+
+static void moments_u16(const uint16_t *row, int x1, int x2, int x0, int64_t *s) {
+    _cgn_moments_row_i
+}
+
+static void moments_f64(const double *row, int x1, int x2, int x0, double *s) {
+    _cgn_moments_row
+}
+
+static void moments_f32(const float *row, int x1, int x2, int x0, double *s) {
+    _cgn_moments_row
+}
+
+#define _cgn_subtract_row                       \
+    int cnt = 0;                                \
+    double lo = *min, hi = *max;                \
+    for (int j = 0; j < n; j++) {               \
+        double t = 0;                           \
+        if (row[j] > th) {                      \
+            cnt++;                              \
+            t = row[j] - m;                     \
+        }                                       \
+        dst[j] = t;                             \
+        if (t > hi) hi = t;                     \
+        if (t < lo) lo = t;                     \
+    }                                           \
+    *count += cnt;                              \
+    *min = lo;                                  \
+    *max = hi;
+
+static void subtract_u8(const uint8_t *row, double *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row
+}
+
+static void subtract_u16(const uint16_t *row, double *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row
+}
+
+static void subtract_u8_f32(const uint8_t *row, float *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row
+}
+
+static void subtract_u16_f32(const uint16_t *row, float *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row
+}
+
+// Tail of the thresholded moments loop starting from `j`,
+// the accumulators are initialized by the caller
+#define _cgn_moments_th_tail                    \
+    for (; j < x2; j++) {                       \
+        double t = 0;                           \
+        if (row[j] > th) {                      \
+            cnt++;                              \
+            t = row[j] - m;                     \
+        }                                       \
+        const double dj = j - x0;               \
+        p0 += t;                                \
+        s1 += t * dj;                           \
+        s2 += t * dj * dj;                      \
+        if (t > hi) hi = t;                     \
+        if (t < lo) lo = t;                     \
+    }                                           \
+    s[0] = p0;                                  \
+    s[1] = s1;                                  \
+    s[2] = s2;                                  \
+    *count += cnt;                              \
+    *min = lo;                                  \
+    *max = hi;
+
+#define _cgn_moments_th_row                     \
+    double p0 = 0, s1 = 0, s2 = 0;              \
+    double lo = *min, hi = *max;                \
+    int cnt = 0;                                \
+    int j = x1;                                 \
+    _cgn_moments_th_tail
+
+static void moments_th_u8(const uint8_t *row, int x1, int x2, int x0, double th, double m, double *s, int *count, double *min, double *max) {
+    _cgn_moments_th_row
+}
+
+static void moments_th_u16(const uint16_t *row, int x1, int x2, int x0, double th, double m, double *s, int *count, double *min, double *max) {
+    _cgn_moments_th_row
+}
+
+#define _cgn_copy_row                           \
+    if (max) {                                  \
+        double hi = *max;                       \
+        for (int j = 0; j < n; j++) {           \
+            dst[j] = src[j];                    \
+            if (dst[j] > hi) hi = dst[j];       \
+        }                                       \
+        *max = hi;                              \
+    } else {                                    \
+        for (int j = 0; j < n; j++) {           \
+            dst[j] = src[j];                    \
+        }                                       \
+    }
+
+static void copy_u8(const uint8_t *src, double *dst, int n, double *max) {
+    _cgn_copy_row
+}
+
+static void copy_u16(const uint16_t *src, double *dst, int n, double *max) {
+    _cgn_copy_row
+}
+
+static void copy_u8_f32(const uint8_t *src, float *dst, int n, double *max) {
+    _cgn_copy_row
+}
+
+static void copy_u16_f32(const uint16_t *src, float *dst, int n, double *max) {
+    _cgn_copy_row
+}
+
+#define _cgn_sum_rows                           \
+    for (int j = 0; j < n; j++) {               \
+        uint32_t sum = 0;                       \
+        for (int y = 0; y < rows; y++)          \
+            sum += src[y*stride + j];           \
+        dst[j] = sum;                           \
+    }
+
+static void sum_rows_u8(const uint8_t *src, int stride, int rows, uint32_t *dst, int n) {
+    _cgn_sum_rows
+}
+
+static void sum_rows_u16(const uint16_t *src, int stride, int rows, uint32_t *dst, int n) {
+    _cgn_sum_rows
+}
+
+#define _cgn_sum_cols                            \
+    for (int j = 0; j < n; j++) {               \
+        uint32_t sum = 0;                       \
+        for (int x = 0; x < k; x++)             \
+            sum += src[j*k + x];                \
+        dst[j] = sum >> shift;                  \
+    }
+
+#define _cgn_sum_cols_tail                      \
+    if (j < n) {                                \
+        src += j*k, dst += j, n -= j;           \
+        _cgn_sum_cols                           \
+    }
+
+static void sum_cols(const uint32_t *src, uint16_t *dst, int n, int k, int shift) {
+    _cgn_sum_cols
+}
+
+// Each group of 4 pixels is 4 high bytes followed by a byte of their 2 low bits
+#define _cgn_unpack_10g40                               \
+    for (int j = 0; j < n; j += 4, src += 5) {          \
+        const uint8_t lo = src[4];                      \
+        dst[j+0] = (src[0] << 2) | (lo & 3);            \
+        dst[j+1] = (src[1] << 2) | ((lo >> 2) & 3);     \
+        dst[j+2] = (src[2] << 2) | ((lo >> 4) & 3);     \
+        dst[j+3] = (src[3] << 2) | (lo >> 6);           \
+    }
+
+// Each group of 2 pixels is 2 high bytes followed by a byte of their 4 low bits
+#define _cgn_unpack_12g24                               \
+    for (int j = 0; j < n; j += 2, src += 3) {          \
+        const uint8_t lo = src[2];                      \
+        dst[j+0] = (src[0] << 4) | (lo & 0x0F);         \
+        dst[j+1] = (src[1] << 4) | (lo >> 4);           \
+    }
+
+static void unpack_10g40(const uint8_t *src, uint16_t *dst, int n) {
+    _cgn_unpack_10g40
+}
+
+static void unpack_12g24(const uint8_t *src, uint16_t *dst, int n) {
+    _cgn_unpack_12g24
+}
+
+// Fixed pattern offsets are removed in integers, the gain is applied in floats
+#define _cgn_calib_row                                                          \
+    if (!gain) for (int j = 0; j < n; j++) {                                    \
+        const int v = src[j] + offset - dark[j];                                \
+        dst[j] = v < 0 ? 0 : (v > top ? top : v);                              \
+    } else for (int j = 0; j < n; j++) {                                        \
+        const float v = ((float)src[j] - (dark ? (float)dark[j] : 0.0f)) * gain[j] + ((float)offset + 0.5f); \
+        dst[j] = v < 0 ? 0 : (v > top ? top : (int)v);                          \
+    }
+
+#define _cgn_calib_tail                                                         \
+    if (j < n) {                                                                \
+        src += j, dst += j, n -= j;                                             \
+        if (dark) dark += j;                                                    \
+        if (gain) gain += j;                                                    \
+        _cgn_calib_row                                                          \
+    }
+
+static void calib_u8(const uint8_t *src, uint8_t *dst, const uint16_t *dark, const float *gain, int n, int offset, int top) {
+    _cgn_calib_row
+}
+
+static void calib_u16(const uint16_t *src, uint16_t *dst, const uint16_t *dark, const float *gain, int n, int offset, int top) {
+    _cgn_calib_row
+}
+
+// Sums wrap around on subtraction but never go below zero in total
+#define _cgn_stack_row                                  \
+    for (int j = 0; j < n; j++) {                       \
+        sum[j] += (uint32_t)src[j] - (uint32_t)old[j];  \
+        old[j] = src[j];                                \
+    }
+
+#define _cgn_stack_tail                                 \
+    if (j < n) {                                        \
+        src += j, old += j, sum += j, n -= j;           \
+        _cgn_stack_row                                  \
+    }
+
+static void stack_u8(const uint8_t *src, uint8_t *old, uint32_t *sum, int n) {
+    _cgn_stack_row
+}
+
+static void stack_u16(const uint16_t *src, uint16_t *old, uint32_t *sum, int n) {
+    _cgn_stack_row
+}
+
+// lrintf rounds in the current mode like conversions of SIMD versions do
+#define _cgn_average_row                                \
+    for (int j = 0; j < n; j++)                         \
+        dst[j] = lrintf((float)sum[j] * k);
+
+#define _cgn_average_tail                               \
+    if (j < n) {                                        \
+        sum += j, dst += j, n -= j;                     \
+        _cgn_average_row                                \
+    }
+
+static void average_u8(const uint32_t *sum, uint8_t *dst, int n, float k) {
+    _cgn_average_row
+}
+
+static void average_u16(const uint32_t *sum, uint16_t *dst, int n, float k) {
+    _cgn_average_row
+}
+
+// SIMD versions skip whole blocks of values below the threshold,
+// then this finds the exact position inside of the block
+#define _cgn_skip_below_row                             \
+    for (; j < n && row[j] <= th; j++)                  \
+        s += row[j];                                    \
+    *sum += s;                                          \
+    return j;
+
+static int skip_below_u8(const uint8_t *row, int j, int n, int th, int64_t *sum) {
+    int64_t s = 0;
+    _cgn_skip_below_row
+}
+
+static int skip_below_u16(const uint16_t *row, int j, int n, int th, int64_t *sum) {
+    int64_t s = 0;
+    _cgn_skip_below_row
+}
+
+#ifdef CGN_SIMD_X86
+
+//------------------------------------------------------------------------------
+//                                  SSE 4.2
+//------------------------------------------------------------------------------
+
+#define SSE42 __attribute__((target("sse4.2")))
+
+SSE42 static inline double hsum_sse42(__m128d v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+// Loads 4 unsigned bytes as two pairs of doubles
+#define SSE42_LOAD_U8(p, v0, v1) {                                                \
+    int32_t u8x4;                                                                 \
+    memcpy(&u8x4, p, 4);                                                          \
+    __m128i i32 = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(u8x4));                     \
+    v0 = _mm_cvtepi32_pd(i32);                                                    \
+    v1 = _mm_cvtepi32_pd(_mm_unpackhi_epi64(i32, i32));                           \
+}
+
+// Loads 4 unsigned shorts as two pairs of doubles
+#define SSE42_LOAD_U16(p, v0, v1) {                                               \
+    __m128i i32 = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(p)));      \
+    v0 = _mm_cvtepi32_pd(i32);                                                    \
+    v1 = _mm_cvtepi32_pd(_mm_unpackhi_epi64(i32, i32));                           \
+}
+
+#define SSE42_LOAD_F64(p, v0, v1) {                                               \
+    v0 = _mm_loadu_pd(p);                                                         \
+    v1 = _mm_loadu_pd(p + 2);                                                     \
+}
+
+// Loads floats as doubles
+#define SSE42_LOAD_F32(p, v0, v1) {                                               \
+    const __m128 f32 = _mm_loadu_ps(p);                                           \
+    v0 = _mm_cvtps_pd(f32);                                                       \
+    v1 = _mm_cvtps_pd(_mm_movehl_ps(f32, f32));                                   \
+}
+
+#define _cgn_moments_row_sse42(load)                                              \
+    __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd(), a2 = _mm_setzero_pd();  \
+    __m128d d0 = _mm_setr_pd(x1 - x0, x1 - x0 + 1);                               \
+    __m128d d1 = _mm_add_pd(d0, _mm_set1_pd(2));                                  \
+    const __m128d step = _mm_set1_pd(4);                                          \
+    int j = x1;                                                                   \
+    for (; j <= x2 - 4; j += 4) {                                                 \
+        __m128d v0, v1;                                                           \
+        load(row + j, v0, v1);                                                    \
+        const __m128d w0 = _mm_mul_pd(v0, d0);                                    \
+        const __m128d w1 = _mm_mul_pd(v1, d1);                                    \
+        a0 = _mm_add_pd(a0, _mm_add_pd(v0, v1));                                  \
+        a1 = _mm_add_pd(a1, _mm_add_pd(w0, w1));                                  \
+        a2 = _mm_add_pd(a2, _mm_add_pd(_mm_mul_pd(w0, d0), _mm_mul_pd(w1, d1)));  \
+        d0 = _mm_add_pd(d0, step);                                                \
+        d1 = _mm_add_pd(d1, step);                                                \
+    }                                                                             \
+    double p0 = hsum_sse42(a0), s1 = hsum_sse42(a1), s2 = hsum_sse42(a2);         \
+    for (; j < x2; j++) {                                                         \
+        const double v = row[j];                                                  \
+        const double dj = j - x0;                                                 \
+        p0 += v;                                                                  \
+        s1 += v * dj;                                                             \
+        s2 += v * dj * dj;                                                        \
+    }                                                                             \
+    s[0] = p0;                                                                    \
+    s[1] = s1;                                                                    \
+    s[2] = s2;
+
+// Pixels are converted to doubles for vector multiplication but all products
+// and sums are integers below 2^53, so they are exact and converted back without loss
+SSE42 static void moments_u8_sse42(const uint8_t *row, int x1, int x2, int x0, int64_t *s) {
+    _cgn_moments_row_sse42(SSE42_LOAD_U8)
+}
+
+SSE42 static void moments_u16_sse42(const uint16_t *row, int x1, int x2, int x0, int64_t *s) {
+    _cgn_moments_row_sse42(SSE42_LOAD_U16)
+}
+
+SSE42 static void moments_f64_sse42(const double *row, int x1, int x2, int x0, double *s) {
+    _cgn_moments_row_sse42(SSE42_LOAD_F64)
+}
+
+SSE42 static void moments_f32_sse42(const float *row, int x1, int x2, int x0, double *s) {
+    _cgn_moments_row_sse42(SSE42_LOAD_F32)
+}
+
+#define SSE42_STORE_F64(p, v) _mm_storeu_pd(p, v)
+#define SSE42_STORE_F32(p, v) _mm_storel_pi((__m64*)(p), _mm_cvtpd_ps(v))
+
+#define SSE42_SUBTRACT(v, k, store) {                           \
+    const __m128d mask = _mm_cmpgt_pd(v, vth);                  \
+    const __m128d t = _mm_and_pd(mask, _mm_sub_pd(v, vm));      \
+    store(dst + k, t);                                          \
+    cnt += __builtin_popcount(_mm_movemask_pd(mask));           \
+    lo = _mm_min_pd(lo, t);                                     \
+    hi = _mm_max_pd(hi, t);                                     \
+}
+
+#define _cgn_subtract_row_sse42(load, store)                    \
+    const __m128d vth = _mm_set1_pd(th);                        \
+    const __m128d vm = _mm_set1_pd(m);                          \
+    __m128d lo = _mm_set1_pd(*min);                             \
+    __m128d hi = _mm_set1_pd(*max);                             \
+    int cnt = 0;                                                \
+    int j = 0;                                                  \
+    for (; j <= n - 4; j += 4) {                                \
+        __m128d v0, v1;                                         \
+        load(row + j, v0, v1);                                  \
+        SSE42_SUBTRACT(v0, j, store);                           \
+        SSE42_SUBTRACT(v1, j + 2, store);                       \
+    }                                                           \
+    lo = _mm_min_pd(lo, _mm_unpackhi_pd(lo, lo));               \
+    hi = _mm_max_pd(hi, _mm_unpackhi_pd(hi, hi));               \
+    *count += cnt;                                              \
+    *min = _mm_cvtsd_f64(lo);                                   \
+    *max = _mm_cvtsd_f64(hi);                                   \
+    if (j < n) {                                                \
+        row += j, dst += j, n -= j;                             \
+        _cgn_subtract_row                                       \
+    }
+
+SSE42 static void subtract_u8_sse42(const uint8_t *row, double *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row_sse42(SSE42_LOAD_U8, SSE42_STORE_F64)
+}
+
+SSE42 static void subtract_u16_sse42(const uint16_t *row, double *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row_sse42(SSE42_LOAD_U16, SSE42_STORE_F64)
+}
+
+SSE42 static void subtract_u8_f32_sse42(const uint8_t *row, float *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row_sse42(SSE42_LOAD_U8, SSE42_STORE_F32)
+}
+
+SSE42 static void subtract_u16_f32_sse42(const uint16_t *row, float *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row_sse42(SSE42_LOAD_U16, SSE42_STORE_F32)
+}
+
+#define SSE42_MOMENTS_TH(v, d) {                                \
+    const __m128d mask = _mm_cmpgt_pd(v, vth);                  \
+    const __m128d t = _mm_and_pd(mask, _mm_sub_pd(v, vm));      \
+    const __m128d w = _mm_mul_pd(t, d);                         \
+    a0 = _mm_add_pd(a0, t);                                     \
+    a1 = _mm_add_pd(a1, w);                                     \
+    a2 = _mm_add_pd(a2, _mm_mul_pd(w, d));                      \
+    cnt += __builtin_popcount(_mm_movemask_pd(mask));           \
+    vlo = _mm_min_pd(vlo, t);                                   \
+    vhi = _mm_max_pd(vhi, t);                                   \
+}
+
+#define _cgn_moments_th_row_sse42(load)                         \
+    const __m128d vth = _mm_set1_pd(th);                        \
+    const __m128d vm = _mm_set1_pd(m);                          \
+    __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd();       \
+    __m128d a2 = _mm_setzero_pd();                              \
+    __m128d vlo = _mm_set1_pd(*min), vhi = _mm_set1_pd(*max);   \
+    __m128d d0 = _mm_setr_pd(x1 - x0, x1 - x0 + 1);             \
+    __m128d d1 = _mm_add_pd(d0, _mm_set1_pd(2));                \
+    const __m128d step = _mm_set1_pd(4);                        \
+    int cnt = 0;                                                \
+    int j = x1;                                                 \
+    for (; j <= x2 - 4; j += 4) {                               \
+        __m128d v0, v1;                                         \
+        load(row + j, v0, v1);                                  \
+        SSE42_MOMENTS_TH(v0, d0);                               \
+        SSE42_MOMENTS_TH(v1, d1);                               \
+        d0 = _mm_add_pd(d0, step);                              \
+        d1 = _mm_add_pd(d1, step);                              \
+    }                                                           \
+    double p0 = hsum_sse42(a0), s1 = hsum_sse42(a1);            \
+    double s2 = hsum_sse42(a2);                                 \
+    vlo = _mm_min_pd(vlo, _mm_unpackhi_pd(vlo, vlo));           \
+    vhi = _mm_max_pd(vhi, _mm_unpackhi_pd(vhi, vhi));           \
+    double lo = _mm_cvtsd_f64(vlo), hi = _mm_cvtsd_f64(vhi);    \
+    _cgn_moments_th_tail
+
+SSE42 static void moments_th_u8_sse42(const uint8_t *row, int x1, int x2, int x0, double th, double m, double *s, int *count, double *min, double *max) {
+    _cgn_moments_th_row_sse42(SSE42_LOAD_U8)
+}
+
+SSE42 static void moments_th_u16_sse42(const uint16_t *row, int x1, int x2, int x0, double th, double m, double *s, int *count, double *min, double *max) {
+    _cgn_moments_th_row_sse42(SSE42_LOAD_U16)
+}
+
+#define _cgn_copy_row_sse42(load, store)                        \
+    __m128d hi = _mm_set1_pd(max ? *max : 0);                   \
+    int j = 0;                                                  \
+    for (; j <= n - 4; j += 4) {                                \
+        __m128d v0, v1;                                         \
+        load(src + j, v0, v1);                                  \
+        store(dst + j, v0);                                     \
+        store(dst + j + 2, v1);                                 \
+        hi = _mm_max_pd(hi, _mm_max_pd(v0, v1));                \
+    }                                                           \
+    if (max) {                                                  \
+        hi = _mm_max_pd(hi, _mm_unpackhi_pd(hi, hi));           \
+        *max = _mm_cvtsd_f64(hi);                               \
+    }                                                           \
+    if (j < n) {                                                \
+        src += j, dst += j, n -= j;                             \
+        _cgn_copy_row                                           \
+    }
+
+SSE42 static void copy_u8_sse42(const uint8_t *src, double *dst, int n, double *max) {
+    _cgn_copy_row_sse42(SSE42_LOAD_U8, SSE42_STORE_F64)
+}
+
+SSE42 static void copy_u16_sse42(const uint16_t *src, double *dst, int n, double *max) {
+    _cgn_copy_row_sse42(SSE42_LOAD_U16, SSE42_STORE_F64)
+}
+
+SSE42 static void copy_u8_f32_sse42(const uint8_t *src, float *dst, int n, double *max) {
+    _cgn_copy_row_sse42(SSE42_LOAD_U8, SSE42_STORE_F32)
+}
+
+SSE42 static void copy_u16_f32_sse42(const uint16_t *src, float *dst, int n, double *max) {
+    _cgn_copy_row_sse42(SSE42_LOAD_U16, SSE42_STORE_F32)
+}
+
+// 8-bit values are summed in 16-bit lanes, it doesn't overflow for up to 257 rows
+SSE42 static void sum_rows_u8_sse42(const uint8_t *src, int stride, int rows, uint32_t *dst, int n) {
+    int j = 0;
+    for (; j <= n - 8; j += 8) {
+        __m128i a = _mm_setzero_si128();
+        for (int y = 0; y < rows; y++)
+            a = _mm_add_epi16(a, _mm_cvtepu8_epi16(_mm_loadl_epi64((const __m128i*)(src + y*stride + j))));
+        _mm_storeu_si128((__m128i*)(dst + j), _mm_cvtepu16_epi32(a));
+        _mm_storeu_si128((__m128i*)(dst + j + 4), _mm_cvtepu16_epi32(_mm_unpackhi_epi64(a, a)));
+    }
+    if (j < n) {
+        src += j, dst += j, n -= j;
+        _cgn_sum_rows
+    }
+}
+
+SSE42 static void sum_rows_u16_sse42(const uint16_t *src, int stride, int rows, uint32_t *dst, int n) {
+    int j = 0;
+    for (; j <= n - 4; j += 4) {
+        __m128i a = _mm_setzero_si128();
+        for (int y = 0; y < rows; y++)
+            a = _mm_add_epi32(a, _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(src + y*stride + j))));
+        _mm_storeu_si128((__m128i*)(dst + j), a);
+    }
+    if (j < n) {
+        src += j, dst += j, n -= j;
+        _cgn_sum_rows
+    }
+}
+
+// Packed pixels are shuffled into 16-bit lanes as (high byte | low bits byte << 8),
+// then the high byte is shifted into place and the multiplication by a power of 2
+// moves the pixel's low bits to the top of the lane, from where they are shifted down
+#define SSE42_UNPACK(p, idx, mul, bits)                                           \
+    __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p)), idx);     \
+    v = _mm_or_si128(                                                             \
+        _mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0xFF)), bits),             \
+        _mm_srli_epi16(_mm_mullo_epi16(v, mul), 16 - bits));
+
+// 8 pixels from 10 bytes, the last 6 bytes of the 16-byte load are not used
+SSE42 static void unpack_10g40_sse42(const uint8_t *src, uint16_t *dst, int n) {
+    const __m128i idx = _mm_setr_epi8(0, 4, 1, 4, 2, 4, 3, 4, 5, 9, 6, 9, 7, 9, 8, 9);
+    const __m128i mul = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+    int j = 0;
+    for (; j <= n - 16; j += 8, src += 10) {
+        SSE42_UNPACK(src, idx, mul, 2)
+        _mm_storeu_si128((__m128i*)(dst + j), v);
+    }
+    if (j < n) {
+        dst += j, n -= j;
+        _cgn_unpack_10g40
+    }
+}
+
+// 8 pixels from 12 bytes
+SSE42 static void unpack_12g24_sse42(const uint8_t *src, uint16_t *dst, int n) {
+    const __m128i idx = _mm_setr_epi8(0, 2, 1, 2, 3, 5, 4, 5, 6, 8, 7, 8, 9, 11, 10, 11);
+    const __m128i mul = _mm_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1);
+    int j = 0;
+    for (; j <= n - 16; j += 8, src += 12) {
+        SSE42_UNPACK(src, idx, mul, 4)
+        _mm_storeu_si128((__m128i*)(dst + j), v);
+    }
+    if (j < n) {
+        dst += j, n -= j;
+        _cgn_unpack_12g24
+    }
+}
+
+// Calibrates 8 values widened to two quads of 32-bit integers `v0` and `v1` at `j`,
+// results are packed back into 16-bit lanes of `v0` with unsigned saturation
+#define SSE42_CALIB(v0, v1) {                                                       \
+    __m128i d0 = _mm_setzero_si128(), d1 = d0;                                      \
+    if (dark) {                                                                     \
+        d0 = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(dark + j)));       \
+        d1 = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i*)(dark + j + 4)));   \
+    }                                                                               \
+    if (gain) {                                                                     \
+        v0 = _mm_cvttps_epi32(_mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(          \
+            _mm_cvtepi32_ps(v0), _mm_cvtepi32_ps(d0)), _mm_loadu_ps(gain + j)), k), zero)); \
+        v1 = _mm_cvttps_epi32(_mm_max_ps(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(          \
+            _mm_cvtepi32_ps(v1), _mm_cvtepi32_ps(d1)), _mm_loadu_ps(gain + j + 4)), k), zero)); \
+    } else {                                                                        \
+        v0 = _mm_sub_epi32(_mm_add_epi32(v0, off), d0);                             \
+        v1 = _mm_sub_epi32(_mm_add_epi32(v1, off), d1);                             \
+    }                                                                               \
+    v0 = _mm_min_epu16(_mm_packus_epi32(v0, v1), top16);                            \
+}
+
+#define SSE42_CALIB_CONSTS                                                          \
+    const __m128i off = _mm_set1_epi32(offset);                                     \
+    const __m128i top16 = _mm_set1_epi16((short)top);                               \
+    const __m128 k = _mm_set1_ps((float)offset + 0.5f);                             \
+    const __m128 zero = _mm_setzero_ps();
+
+SSE42 static void calib_u8_sse42(const uint8_t *src, uint8_t *dst, const uint16_t *dark, const float *gain, int n, int offset, int top) {
+    SSE42_CALIB_CONSTS
+    int j = 0;
+    for (; j <= n - 8; j += 8) {
+        const __m128i v = _mm_loadl_epi64((const __m128i*)(src + j));
+        __m128i v0 = _mm_cvtepu8_epi32(v), v1 = _mm_cvtepu8_epi32(_mm_srli_si128(v, 4));
+        SSE42_CALIB(v0, v1)
+        _mm_storel_epi64((__m128i*)(dst + j), _mm_packus_epi16(v0, v0));
+    }
+    _cgn_calib_tail
+}
+
+SSE42 static void calib_u16_sse42(const uint16_t *src, uint16_t *dst, const uint16_t *dark, const float *gain, int n, int offset, int top) {
+    SSE42_CALIB_CONSTS
+    int j = 0;
+    for (; j <= n - 8; j += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + j));
+        __m128i v0 = _mm_cvtepu16_epi32(v), v1 = _mm_cvtepu16_epi32(_mm_srli_si128(v, 8));
+        SSE42_CALIB(v0, v1)
+        _mm_storeu_si128((__m128i*)(dst + j), v0);
+    }
+    _cgn_calib_tail
+}
+
+// Pairs and quads are summed by horizontal additions, other groups are summed by scalar code
+SSE42 static void sum_cols_sse42(const uint32_t *src, uint16_t *dst, int n, int k, int shift) {
+    const __m128i sh = _mm_cvtsi32_si128(shift);
+    #define LOAD(i) _mm_loadu_si128((const __m128i*)(src + j*k + (i)*4))
+    int j = 0;
+    if (k == 2) {
+        for (; j <= n - 8; j += 8) {
+            const __m128i v0 = _mm_srl_epi32(_mm_hadd_epi32(LOAD(0), LOAD(1)), sh);
+            const __m128i v1 = _mm_srl_epi32(_mm_hadd_epi32(LOAD(2), LOAD(3)), sh);
+            _mm_storeu_si128((__m128i*)(dst + j), _mm_packus_epi32(v0, v1));
+        }
+    } else if (k == 4) {
+        for (; j <= n - 8; j += 8) {
+            const __m128i v0 = _mm_srl_epi32(_mm_hadd_epi32(
+                _mm_hadd_epi32(LOAD(0), LOAD(1)), _mm_hadd_epi32(LOAD(2), LOAD(3))), sh);
+            const __m128i v1 = _mm_srl_epi32(_mm_hadd_epi32(
+                _mm_hadd_epi32(LOAD(4), LOAD(5)), _mm_hadd_epi32(LOAD(6), LOAD(7))), sh);
+            _mm_storeu_si128((__m128i*)(dst + j), _mm_packus_epi32(v0, v1));
+        }
+    }
+    #undef LOAD
+    _cgn_sum_cols_tail
+}
+
+// Adds 4 32-bit integers `v` to sums at `p`
+#define SSE42_ADD_SUM(p, v) \
+    _mm_storeu_si128((__m128i*)(p), _mm_add_epi32(_mm_loadu_si128((const __m128i*)(p)), v))
+
+// Differences of 8-bit pixels fit into 16 bits, they are widened to 32 bits then
+SSE42 static void stack_u8_sse42(const uint8_t *src, uint8_t *old, uint32_t *sum, int n) {
+    const __m128i zero = _mm_setzero_si128();
+    int j = 0;
+    for (; j <= n - 16; j += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + j));
+        const __m128i o = _mm_loadu_si128((const __m128i*)(old + j));
+        _mm_storeu_si128((__m128i*)(old + j), v);
+        const __m128i d0 = _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), _mm_unpacklo_epi8(o, zero));
+        const __m128i d1 = _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), _mm_unpackhi_epi8(o, zero));
+        SSE42_ADD_SUM(sum + j, _mm_cvtepi16_epi32(d0));
+        SSE42_ADD_SUM(sum + j + 4, _mm_cvtepi16_epi32(_mm_srli_si128(d0, 8)));
+        SSE42_ADD_SUM(sum + j + 8, _mm_cvtepi16_epi32(d1));
+        SSE42_ADD_SUM(sum + j + 12, _mm_cvtepi16_epi32(_mm_srli_si128(d1, 8)));
+    }
+    _cgn_stack_tail
+}
+
+SSE42 static void stack_u16_sse42(const uint16_t *src, uint16_t *old, uint32_t *sum, int n) {
+    int j = 0;
+    for (; j <= n - 8; j += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + j));
+        const __m128i o = _mm_loadu_si128((const __m128i*)(old + j));
+        _mm_storeu_si128((__m128i*)(old + j), v);
+        SSE42_ADD_SUM(sum + j, _mm_sub_epi32(_mm_cvtepu16_epi32(v), _mm_cvtepu16_epi32(o)));
+        SSE42_ADD_SUM(sum + j + 4, _mm_sub_epi32(
+            _mm_cvtepu16_epi32(_mm_srli_si128(v, 8)), _mm_cvtepu16_epi32(_mm_srli_si128(o, 8))));
+    }
+    _cgn_stack_tail
+}
+
+// Rounded `sum * k` of 4 sums at `p`, sums are less than 2^24 so signed conversion is fine
+#define SSE42_AVERAGE(p) \
+    _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(p))), kk))
+
+SSE42 static void average_u8_sse42(const uint32_t *sum, uint8_t *dst, int n, float k) {
+    const __m128 kk = _mm_set1_ps(k);
+    int j = 0;
+    for (; j <= n - 16; j += 16) {
+        const __m128i v0 = _mm_packus_epi32(SSE42_AVERAGE(sum + j), SSE42_AVERAGE(sum + j + 4));
+        const __m128i v1 = _mm_packus_epi32(SSE42_AVERAGE(sum + j + 8), SSE42_AVERAGE(sum + j + 12));
+        _mm_storeu_si128((__m128i*)(dst + j), _mm_packus_epi16(v0, v1));
+    }
+    _cgn_average_tail
+}
+
+SSE42 static void average_u16_sse42(const uint32_t *sum, uint16_t *dst, int n, float k) {
+    const __m128 kk = _mm_set1_ps(k);
+    int j = 0;
+    for (; j <= n - 8; j += 8)
+        _mm_storeu_si128((__m128i*)(dst + j), _mm_packus_epi32(SSE42_AVERAGE(sum + j), SSE42_AVERAGE(sum + j + 4)));
+    _cgn_average_tail
+}
+
+// Values not above the threshold are those equal to max(v, th)
+SSE42 static int skip_below_u8_sse42(const uint8_t *row, int j, int n, int th, int64_t *sum) {
+    const __m128i t = _mm_set1_epi8((char)th), zero = _mm_setzero_si128();
+    __m128i acc = zero;
+    for (; j <= n - 16; j += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(row + j));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, t), t)) != 0xFFFF)
+            break;
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+    }
+    int64_t s = _mm_cvtsi128_si64(acc) + _mm_extract_epi64(acc, 1);
+    _cgn_skip_below_row
+}
+
+// 32-bit sums don't overflow in rows shorter than 2^18 pixels
+SSE42 static int skip_below_u16_sse42(const uint16_t *row, int j, int n, int th, int64_t *sum) {
+    const __m128i t = _mm_set1_epi16((short)th);
+    __m128i acc = _mm_setzero_si128();
+    for (; j <= n - 8; j += 8) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(row + j));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_max_epu16(v, t), t)) != 0xFFFF)
+            break;
+        acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_cvtepu16_epi32(v), _mm_cvtepu16_epi32(_mm_srli_si128(v, 8))));
+    }
+    acc = _mm_hadd_epi32(acc, acc);
+    int64_t s = (int64_t)(uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_extract_epi32(acc, 1);
+    _cgn_skip_below_row
+}
+
+//------------------------------------------------------------------------------
+//                                   AVX2
+//------------------------------------------------------------------------------
+
+#define AVX2 __attribute__((target("avx2,fma")))
+
+AVX2 static inline double hsum_avx2(__m256d v) {
+    __m128d h = _mm_add_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(h, _mm_unpackhi_pd(h, h)));
+}
+
+AVX2 static inline double hmin_avx2(__m256d v) {
+    __m128d h = _mm_min_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_min_sd(h, _mm_unpackhi_pd(h, h)));
+}
+
+AVX2 static inline double hmax_avx2(__m256d v) {
+    __m128d h = _mm_max_pd(_mm256_castpd256_pd128(v), _mm256_extractf128_pd(v, 1));
+    return _mm_cvtsd_f64(_mm_max_sd(h, _mm_unpackhi_pd(h, h)));
+}
+
+// Loads 8 unsigned bytes as two quads of doubles
+#define AVX2_LOAD_U8(p, v0, v1) {                                                 \
+    __m256i i32 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(p)));    \
+    v0 = _mm256_cvtepi32_pd(_mm256_castsi256_si128(i32));                         \
+    v1 = _mm256_cvtepi32_pd(_mm256_extracti128_si256(i32, 1));                    \
+}
+
+// Loads 8 unsigned shorts as two quads of doubles
+#define AVX2_LOAD_U16(p, v0, v1) {                                                \
+    __m256i i32 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(p)));   \
+    v0 = _mm256_cvtepi32_pd(_mm256_castsi256_si128(i32));                         \
+    v1 = _mm256_cvtepi32_pd(_mm256_extracti128_si256(i32, 1));                    \
+}
+
+#define AVX2_LOAD_F64(p, v0, v1) {                                                \
+    v0 = _mm256_loadu_pd(p);                                                      \
+    v1 = _mm256_loadu_pd(p + 4);                                                  \
+}
+
+// Loads floats as doubles
+#define AVX2_LOAD_F32(p, v0, v1) {                                                \
+    v0 = _mm256_cvtps_pd(_mm_loadu_ps(p));                                        \
+    v1 = _mm256_cvtps_pd(_mm_loadu_ps(p + 4));                                    \
+}
+
+#define _cgn_moments_row_avx2(load)                                               \
+    __m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();                   \
+    __m256d a2 = _mm256_setzero_pd(), a3 = _mm256_setzero_pd();                   \
+    __m256d d0 = _mm256_add_pd(_mm256_set1_pd(x1 - x0), _mm256_setr_pd(0, 1, 2, 3)); \
+    __m256d d1 = _mm256_add_pd(d0, _mm256_set1_pd(4));                            \
+    const __m256d step = _mm256_set1_pd(8);                                       \
+    int j = x1;                                                                   \
+    for (; j <= x2 - 8; j += 8) {                                                 \
+        __m256d v0, v1;                                                           \
+        load(row + j, v0, v1);                                                    \
+        const __m256d w0 = _mm256_mul_pd(v0, d0);                                 \
+        const __m256d w1 = _mm256_mul_pd(v1, d1);                                 \
+        a0 = _mm256_add_pd(a0, _mm256_add_pd(v0, v1));                            \
+        a1 = _mm256_add_pd(a1, _mm256_add_pd(w0, w1));                            \
+        a2 = _mm256_fmadd_pd(w0, d0, a2);                                         \
+        a3 = _mm256_fmadd_pd(w1, d1, a3);                                         \
+        d0 = _mm256_add_pd(d0, step);                                             \
+        d1 = _mm256_add_pd(d1, step);                                             \
+    }                                                                             \
+    double p0 = hsum_avx2(a0), s1 = hsum_avx2(a1);                                \
+    double s2 = hsum_avx2(_mm256_add_pd(a2, a3));                                 \
+    for (; j < x2; j++) {                                                         \
+        const double v = row[j];                                                  \
+        const double dj = j - x0;                                                 \
+        p0 += v;                                                                  \
+        s1 += v * dj;                                                             \
+        s2 += v * dj * dj;                                                        \
+    }                                                                             \
+    s[0] = p0;                                                                    \
+    s[1] = s1;                                                                    \
+    s[2] = s2;
+
+// Pixels are converted to doubles for vector multiplication but all products
+// and sums are integers below 2^53, so they are exact and converted back without loss
+AVX2 static void moments_u8_avx2(const uint8_t *row, int x1, int x2, int x0, int64_t *s) {
+    _cgn_moments_row_avx2(AVX2_LOAD_U8)
+}
+
+AVX2 static void moments_u16_avx2(const uint16_t *row, int x1, int x2, int x0, int64_t *s) {
+    _cgn_moments_row_avx2(AVX2_LOAD_U16)
+}
+
+AVX2 static void moments_f64_avx2(const double *row, int x1, int x2, int x0, double *s) {
+    _cgn_moments_row_avx2(AVX2_LOAD_F64)
+}
+
+AVX2 static void moments_f32_avx2(const float *row, int x1, int x2, int x0, double *s) {
+    _cgn_moments_row_avx2(AVX2_LOAD_F32)
+}
+
+#define AVX2_STORE_F64(p, v) _mm256_storeu_pd(p, v)
+#define AVX2_STORE_F32(p, v) _mm_storeu_ps(p, _mm256_cvtpd_ps(v))
+
+#define AVX2_SUBTRACT(v, k, store) {                                    \
+    const __m256d mask = _mm256_cmp_pd(v, vth, _CMP_GT_OQ);             \
+    const __m256d t = _mm256_and_pd(mask, _mm256_sub_pd(v, vm));        \
+    store(dst + k, t);                                                  \
+    cnt += __builtin_popcount(_mm256_movemask_pd(mask));                \
+    lo = _mm256_min_pd(lo, t);                                          \
+    hi = _mm256_max_pd(hi, t);                                          \
+}
+
+#define _cgn_subtract_row_avx2(load, store)                     \
+    const __m256d vth = _mm256_set1_pd(th);                     \
+    const __m256d vm = _mm256_set1_pd(m);                       \
+    __m256d lo = _mm256_set1_pd(*min);                          \
+    __m256d hi = _mm256_set1_pd(*max);                          \
+    int cnt = 0;                                                \
+    int j = 0;                                                  \
+    for (; j <= n - 8; j += 8) {                                \
+        __m256d v0, v1;                                         \
+        load(row + j, v0, v1);                                  \
+        AVX2_SUBTRACT(v0, j, store);                            \
+        AVX2_SUBTRACT(v1, j + 4, store);                        \
+    }                                                           \
+    *count += cnt;                                              \
+    *min = hmin_avx2(lo);                                       \
+    *max = hmax_avx2(hi);                                       \
+    if (j < n) {                                                \
+        row += j, dst += j, n -= j;                             \
+        _cgn_subtract_row                                       \
+    }
+
+AVX2 static void subtract_u8_avx2(const uint8_t *row, double *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row_avx2(AVX2_LOAD_U8, AVX2_STORE_F64)
+}
+
+AVX2 static void subtract_u16_avx2(const uint16_t *row, double *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row_avx2(AVX2_LOAD_U16, AVX2_STORE_F64)
+}
+
+AVX2 static void subtract_u8_f32_avx2(const uint8_t *row, float *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row_avx2(AVX2_LOAD_U8, AVX2_STORE_F32)
+}
+
+AVX2 static void subtract_u16_f32_avx2(const uint16_t *row, float *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row_avx2(AVX2_LOAD_U16, AVX2_STORE_F32)
+}
+
+#define AVX2_MOMENTS_TH(v, d, a2) {                              \
+    const __m256d mask = _mm256_cmp_pd(v, vth, _CMP_GT_OQ);     \
+    const __m256d t = _mm256_and_pd(mask, _mm256_sub_pd(v, vm)); \
+    const __m256d w = _mm256_mul_pd(t, d);                      \
+    a0 = _mm256_add_pd(a0, t);                                  \
+    a1 = _mm256_add_pd(a1, w);                                  \
+    a2 = _mm256_fmadd_pd(w, d, a2);                             \
+    cnt += __builtin_popcount(_mm256_movemask_pd(mask));        \
+    vlo = _mm256_min_pd(vlo, t);                                \
+    vhi = _mm256_max_pd(vhi, t);                                \
+}
+
+#define _cgn_moments_th_row_avx2(load)                          \
+    const __m256d vth = _mm256_set1_pd(th);                     \
+    const __m256d vm = _mm256_set1_pd(m);                       \
+    __m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd(); \
+    __m256d a2 = _mm256_setzero_pd(), a3 = _mm256_setzero_pd(); \
+    __m256d vlo = _mm256_set1_pd(*min);                         \
+    __m256d vhi = _mm256_set1_pd(*max);                         \
+    __m256d d0 = _mm256_add_pd(_mm256_set1_pd(x1 - x0),         \
+        _mm256_setr_pd(0, 1, 2, 3));                            \
+    __m256d d1 = _mm256_add_pd(d0, _mm256_set1_pd(4));          \
+    const __m256d step = _mm256_set1_pd(8);                     \
+    int cnt = 0;                                                \
+    int j = x1;                                                 \
+    for (; j <= x2 - 8; j += 8) {                               \
+        __m256d v0, v1;                                         \
+        load(row + j, v0, v1);                                  \
+        AVX2_MOMENTS_TH(v0, d0, a2);                            \
+        AVX2_MOMENTS_TH(v1, d1, a3);                            \
+        d0 = _mm256_add_pd(d0, step);                           \
+        d1 = _mm256_add_pd(d1, step);                           \
+    }                                                           \
+    double p0 = hsum_avx2(a0), s1 = hsum_avx2(a1);              \
+    double s2 = hsum_avx2(_mm256_add_pd(a2, a3));               \
+    double lo = hmin_avx2(vlo), hi = hmax_avx2(vhi);            \
+    _cgn_moments_th_tail
+
+AVX2 static void moments_th_u8_avx2(const uint8_t *row, int x1, int x2, int x0, double th, double m, double *s, int *count, double *min, double *max) {
+    _cgn_moments_th_row_avx2(AVX2_LOAD_U8)
+}
+
+AVX2 static void moments_th_u16_avx2(const uint16_t *row, int x1, int x2, int x0, double th, double m, double *s, int *count, double *min, double *max) {
+    _cgn_moments_th_row_avx2(AVX2_LOAD_U16)
+}
+
+#define _cgn_copy_row_avx2(load, store)                         \
+    __m256d hi = _mm256_set1_pd(max ? *max : 0);                \
+    int j = 0;                                                  \
+    for (; j <= n - 8; j += 8) {                                \
+        __m256d v0, v1;                                         \
+        load(src + j, v0, v1);                                  \
+        store(dst + j, v0);                                     \
+        store(dst + j + 4, v1);                                 \
+        hi = _mm256_max_pd(hi, _mm256_max_pd(v0, v1));          \
+    }                                                           \
+    if (max) *max = hmax_avx2(hi);                              \
+    if (j < n) {                                                \
+        src += j, dst += j, n -= j;                             \
+        _cgn_copy_row                                           \
+    }
+
+AVX2 static void copy_u8_avx2(const uint8_t *src, double *dst, int n, double *max) {
+    _cgn_copy_row_avx2(AVX2_LOAD_U8, AVX2_STORE_F64)
+}
+
+AVX2 static void copy_u16_avx2(const uint16_t *src, double *dst, int n, double *max) {
+    _cgn_copy_row_avx2(AVX2_LOAD_U16, AVX2_STORE_F64)
+}
+
+AVX2 static void copy_u8_f32_avx2(const uint8_t *src, float *dst, int n, double *max) {
+    _cgn_copy_row_avx2(AVX2_LOAD_U8, AVX2_STORE_F32)
+}
+
+AVX2 static void copy_u16_f32_avx2(const uint16_t *src, float *dst, int n, double *max) {
+    _cgn_copy_row_avx2(AVX2_LOAD_U16, AVX2_STORE_F32)
+}
+
+// 8-bit values are summed in 16-bit lanes, it doesn't overflow for up to 257 rows
+AVX2 static void sum_rows_u8_avx2(const uint8_t *src, int stride, int rows, uint32_t *dst, int n) {
+    int j = 0;
+    for (; j <= n - 16; j += 16) {
+        __m256i a = _mm256_setzero_si256();
+        for (int y = 0; y < rows; y++)
+            a = _mm256_add_epi16(a, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(src + y*stride + j))));
+        _mm256_storeu_si256((__m256i*)(dst + j), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(a)));
+        _mm256_storeu_si256((__m256i*)(dst + j + 8), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(a, 1)));
+    }
+    if (j < n) {
+        src += j, dst += j, n -= j;
+        _cgn_sum_rows
+    }
+}
+
+AVX2 static void sum_rows_u16_avx2(const uint16_t *src, int stride, int rows, uint32_t *dst, int n) {
+    int j = 0;
+    for (; j <= n - 8; j += 8) {
+        __m256i a = _mm256_setzero_si256();
+        for (int y = 0; y < rows; y++)
+            a = _mm256_add_epi32(a, _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + y*stride + j))));
+        _mm256_storeu_si256((__m256i*)(dst + j), a);
+    }
+    if (j < n) {
+        src += j, dst += j, n -= j;
+        _cgn_sum_rows
+    }
+}
+
+// The same as SSE42_UNPACK, the shuffle works in 128-bit lanes
+// so each lane gets its own load of 8 pixels
+#define AVX2_UNPACK(p, step, idx, mul, bits)                                      \
+    __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(                   \
+        _mm_loadu_si128((const __m128i*)(p))), _mm_loadu_si128((const __m128i*)((p) + step)), 1); \
+    v = _mm256_shuffle_epi8(v, idx);                                              \
+    v = _mm256_or_si256(                                                          \
+        _mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0xFF)), bits),    \
+        _mm256_srli_epi16(_mm256_mullo_epi16(v, mul), 16 - bits));
+
+AVX2 static void unpack_10g40_avx2(const uint8_t *src, uint16_t *dst, int n) {
+    const __m256i idx = _mm256_setr_epi8(0, 4, 1, 4, 2, 4, 3, 4, 5, 9, 6, 9, 7, 9, 8, 9,
+                                         0, 4, 1, 4, 2, 4, 3, 4, 5, 9, 6, 9, 7, 9, 8, 9);
+    const __m256i mul = _mm256_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1, 64, 16, 4, 1);
+    int j = 0;
+    for (; j <= n - 24; j += 16, src += 20) {
+        AVX2_UNPACK(src, 10, idx, mul, 2)
+        _mm256_storeu_si256((__m256i*)(dst + j), v);
+    }
+    if (j < n) {
+        dst += j, n -= j;
+        _cgn_unpack_10g40
+    }
+}
+
+AVX2 static void unpack_12g24_avx2(const uint8_t *src, uint16_t *dst, int n) {
+    const __m256i idx = _mm256_setr_epi8(0, 2, 1, 2, 3, 5, 4, 5, 6, 8, 7, 8, 9, 11, 10, 11,
+                                         0, 2, 1, 2, 3, 5, 4, 5, 6, 8, 7, 8, 9, 11, 10, 11);
+    const __m256i mul = _mm256_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1, 16, 1);
+    int j = 0;
+    for (; j <= n - 24; j += 16, src += 24) {
+        AVX2_UNPACK(src, 12, idx, mul, 4)
+        _mm256_storeu_si256((__m256i*)(dst + j), v);
+    }
+    if (j < n) {
+        dst += j, n -= j;
+        _cgn_unpack_12g24
+    }
+}
+
+// The same as SSE42_CALIB for 16 values, packing works in 128-bit lanes,
+// so quads are put back in order after it
+#define AVX2_CALIB(v0, v1) {                                                        \
+    __m256i d0 = _mm256_setzero_si256(), d1 = d0;                                   \
+    if (dark) {                                                                     \
+        d0 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(dark + j)));    \
+        d1 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(dark + j + 8)));\
+    }                                                                               \
+    if (gain) {                                                                     \
+        v0 = _mm256_cvttps_epi32(_mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps( \
+            _mm256_cvtepi32_ps(v0), _mm256_cvtepi32_ps(d0)), _mm256_loadu_ps(gain + j)), k), zero)); \
+        v1 = _mm256_cvttps_epi32(_mm256_max_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps( \
+            _mm256_cvtepi32_ps(v1), _mm256_cvtepi32_ps(d1)), _mm256_loadu_ps(gain + j + 8)), k), zero)); \
+    } else {                                                                        \
+        v0 = _mm256_sub_epi32(_mm256_add_epi32(v0, off), d0);                       \
+        v1 = _mm256_sub_epi32(_mm256_add_epi32(v1, off), d1);                       \
+    }                                                                               \
+    v0 = _mm256_permute4x64_epi64(_mm256_packus_epi32(v0, v1), 0xD8);               \
+    v0 = _mm256_min_epu16(v0, top16);                                               \
+}
+
+#define AVX2_CALIB_CONSTS                                                           \
+    const __m256i off = _mm256_set1_epi32(offset);                                  \
+    const __m256i top16 = _mm256_set1_epi16((short)top);                            \
+    const __m256 k = _mm256_set1_ps((float)offset + 0.5f);                          \
+    const __m256 zero = _mm256_setzero_ps();
+
+AVX2 static void calib_u8_avx2(const uint8_t *src, uint8_t *dst, const uint16_t *dark, const float *gain, int n, int offset, int top) {
+    AVX2_CALIB_CONSTS
+    int j = 0;
+    for (; j <= n - 16; j += 16) {
+        const __m128i v = _mm_loadu_si128((const __m128i*)(src + j));
+        __m256i v0 = _mm256_cvtepu8_epi32(v), v1 = _mm256_cvtepu8_epi32(_mm_srli_si128(v, 8));
+        AVX2_CALIB(v0, v1)
+        _mm_storeu_si128((__m128i*)(dst + j), _mm_packus_epi16(
+            _mm256_castsi256_si128(v0), _mm256_extracti128_si256(v0, 1)));
+    }
+    _cgn_calib_tail
+}
+
+AVX2 static void calib_u16_avx2(const uint16_t *src, uint16_t *dst, const uint16_t *dark, const float *gain, int n, int offset, int top) {
+    AVX2_CALIB_CONSTS
+    int j = 0;
+    for (; j <= n - 16; j += 16) {
+        __m256i v0 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + j)));
+        __m256i v1 = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src + j + 8)));
+        AVX2_CALIB(v0, v1)
+        _mm256_storeu_si256((__m256i*)(dst + j), v0);
+    }
+    _cgn_calib_tail
+}
+
+// Horizontal additions work in 128-bit lanes, so results are put back in order after them
+AVX2 static void sum_cols_avx2(const uint32_t *src, uint16_t *dst, int n, int k, int shift) {
+    const __m128i sh = _mm_cvtsi32_si128(shift);
+    #define LOAD(i) _mm256_loadu_si256((const __m256i*)(src + j*k + (i)*8))
+    int j = 0;
+    if (k == 2) {
+        for (; j <= n - 16; j += 16) {
+            const __m256i v0 = _mm256_srl_epi32(_mm256_hadd_epi32(LOAD(0), LOAD(1)), sh);
+            const __m256i v1 = _mm256_srl_epi32(_mm256_hadd_epi32(LOAD(2), LOAD(3)), sh);
+            const __m256i v = _mm256_packus_epi32(
+                _mm256_permute4x64_epi64(v0, 0xD8), _mm256_permute4x64_epi64(v1, 0xD8));
+            _mm256_storeu_si256((__m256i*)(dst + j), _mm256_permute4x64_epi64(v, 0xD8));
+        }
+    } else if (k == 4) {
+        const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        for (; j <= n - 8; j += 8) {
+            const __m256i v = _mm256_srl_epi32(_mm256_permutevar8x32_epi32(_mm256_hadd_epi32(
+                _mm256_hadd_epi32(LOAD(0), LOAD(1)), _mm256_hadd_epi32(LOAD(2), LOAD(3))), order), sh);
+            const __m256i p = _mm256_permute4x64_epi64(_mm256_packus_epi32(v, v), 0xD8);
+            _mm_storeu_si128((__m128i*)(dst + j), _mm256_castsi256_si128(p));
+        }
+    }
+    #undef LOAD
+    _cgn_sum_cols_tail
+}
+
+#define AVX2_ADD_SUM(p, v) \
+    _mm256_storeu_si256((__m256i*)(p), _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(p)), v))
+
+AVX2 static void stack_u8_avx2(const uint8_t *src, uint8_t *old, uint32_t *sum, int n) {
+    int j = 0;
+    for (; j <= n - 32; j += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(src + j));
+        const __m256i o = _mm256_loadu_si256((const __m256i*)(old + j));
+        _mm256_storeu_si256((__m256i*)(old + j), v);
+        const __m256i d0 = _mm256_sub_epi16(
+            _mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(o)));
+        const __m256i d1 = _mm256_sub_epi16(
+            _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(o, 1)));
+        AVX2_ADD_SUM(sum + j, _mm256_cvtepi16_epi32(_mm256_castsi256_si128(d0)));
+        AVX2_ADD_SUM(sum + j + 8, _mm256_cvtepi16_epi32(_mm256_extracti128_si256(d0, 1)));
+        AVX2_ADD_SUM(sum + j + 16, _mm256_cvtepi16_epi32(_mm256_castsi256_si128(d1)));
+        AVX2_ADD_SUM(sum + j + 24, _mm256_cvtepi16_epi32(_mm256_extracti128_si256(d1, 1)));
+    }
+    _cgn_stack_tail
+}
+
+AVX2 static void stack_u16_avx2(const uint16_t *src, uint16_t *old, uint32_t *sum, int n) {
+    int j = 0;
+    for (; j <= n - 16; j += 16) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(src + j));
+        const __m256i o = _mm256_loadu_si256((const __m256i*)(old + j));
+        _mm256_storeu_si256((__m256i*)(old + j), v);
+        AVX2_ADD_SUM(sum + j, _mm256_sub_epi32(
+            _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)), _mm256_cvtepu16_epi32(_mm256_castsi256_si128(o))));
+        AVX2_ADD_SUM(sum + j + 8, _mm256_sub_epi32(
+            _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(o, 1))));
+    }
+    _cgn_stack_tail
+}
+
+#define AVX2_AVERAGE(p) \
+    _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*)(p))), kk))
+
+// Packing works in 128-bit lanes, so quads of bytes are put back in order after it
+AVX2 static void average_u8_avx2(const uint32_t *sum, uint8_t *dst, int n, float k) {
+    const __m256 kk = _mm256_set1_ps(k);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int j = 0;
+    for (; j <= n - 32; j += 32) {
+        const __m256i v0 = _mm256_packus_epi32(AVX2_AVERAGE(sum + j), AVX2_AVERAGE(sum + j + 8));
+        const __m256i v1 = _mm256_packus_epi32(AVX2_AVERAGE(sum + j + 16), AVX2_AVERAGE(sum + j + 24));
+        _mm256_storeu_si256((__m256i*)(dst + j), _mm256_permutevar8x32_epi32(_mm256_packus_epi16(v0, v1), order));
+    }
+    _cgn_average_tail
+}
+
+AVX2 static void average_u16_avx2(const uint32_t *sum, uint16_t *dst, int n, float k) {
+    const __m256 kk = _mm256_set1_ps(k);
+    int j = 0;
+    for (; j <= n - 16; j += 16) {
+        const __m256i v = _mm256_packus_epi32(AVX2_AVERAGE(sum + j), AVX2_AVERAGE(sum + j + 8));
+        _mm256_storeu_si256((__m256i*)(dst + j), _mm256_permute4x64_epi64(v, 0xD8));
+    }
+    _cgn_average_tail
+}
+
+AVX2 static int skip_below_u8_avx2(const uint8_t *row, int j, int n, int th, int64_t *sum) {
+    const __m256i t = _mm256_set1_epi8((char)th), zero = _mm256_setzero_si256();
+    __m256i acc = zero;
+    for (; j <= n - 32; j += 32) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(row + j));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(v, t), t)) != -1)
+            break;
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(v, zero));
+    }
+    const __m128i a = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    int64_t s = _mm_cvtsi128_si64(a) + _mm_extract_epi64(a, 1);
+    _cgn_skip_below_row
+}
+
+AVX2 static int skip_below_u16_avx2(const uint16_t *row, int j, int n, int th, int64_t *sum) {
+    const __m256i t = _mm256_set1_epi16((short)th);
+    __m256i acc = _mm256_setzero_si256();
+    for (; j <= n - 16; j += 16) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)(row + j));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_max_epu16(v, t), t)) != -1)
+            break;
+        acc = _mm256_add_epi32(acc, _mm256_add_epi32(
+            _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)), _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1))));
+    }
+    __m128i a = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    a = _mm_hadd_epi32(a, a);
+    int64_t s = (int64_t)(uint32_t)_mm_cvtsi128_si32(a) + (uint32_t)_mm_extract_epi32(a, 1);
+    _cgn_skip_below_row
+}
+
+//------------------------------------------------------------------------------
+//                                 AVX-512
+//------------------------------------------------------------------------------
+
+#define AVX512 __attribute__((target("avx512f")))
+
+// Loads 16 unsigned bytes as two octets of doubles
+#define AVX512_LOAD_U8(p, v0, v1) {                                               \
+    __m512i i32 = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(p)));    \
+    v0 = _mm512_cvtepi32_pd(_mm512_castsi512_si256(i32));                         \
+    v1 = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(i32, 1));                   \
+}
+
+// Loads 16 unsigned shorts as two octets of doubles
+#define AVX512_LOAD_U16(p, v0, v1) {                                              \
+    __m512i i32 = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(p))); \
+    v0 = _mm512_cvtepi32_pd(_mm512_castsi512_si256(i32));                         \
+    v1 = _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(i32, 1));                   \
+}
+
+#define AVX512_LOAD_F64(p, v0, v1) {                                              \
+    v0 = _mm512_loadu_pd(p);                                                      \
+    v1 = _mm512_loadu_pd(p + 8);                                                  \
+}
+
+// Loads floats as doubles
+#define AVX512_LOAD_F32(p, v0, v1) {                                              \
+    v0 = _mm512_cvtps_pd(_mm256_loadu_ps(p));                                     \
+    v1 = _mm512_cvtps_pd(_mm256_loadu_ps(p + 8));                                 \
+}
+
+#define _cgn_moments_row_avx512(load)                                             \
+    __m512d a0 = _mm512_setzero_pd(), a1 = _mm512_setzero_pd();                   \
+    __m512d a2 = _mm512_setzero_pd(), a3 = _mm512_setzero_pd();                   \
+    __m512d d0 = _mm512_add_pd(_mm512_set1_pd(x1 - x0),                           \
+        _mm512_setr_pd(0, 1, 2, 3, 4, 5, 6, 7));                                  \
+    __m512d d1 = _mm512_add_pd(d0, _mm512_set1_pd(8));                            \
+    const __m512d step = _mm512_set1_pd(16);                                      \
+    int j = x1;                                                                   \
+    for (; j <= x2 - 16; j += 16) {                                               \
+        __m512d v0, v1;                                                           \
+        load(row + j, v0, v1);                                                    \
+        const __m512d w0 = _mm512_mul_pd(v0, d0);                                 \
+        const __m512d w1 = _mm512_mul_pd(v1, d1);                                 \
+        a0 = _mm512_add_pd(a0, _mm512_add_pd(v0, v1));                            \
+        a1 = _mm512_add_pd(a1, _mm512_add_pd(w0, w1));                            \
+        a2 = _mm512_fmadd_pd(w0, d0, a2);                                         \
+        a3 = _mm512_fmadd_pd(w1, d1, a3);                                         \
+        d0 = _mm512_add_pd(d0, step);                                             \
+        d1 = _mm512_add_pd(d1, step);                                             \
+    }                                                                             \
+    double p0 = _mm512_reduce_add_pd(a0), s1 = _mm512_reduce_add_pd(a1);          \
+    double s2 = _mm512_reduce_add_pd(_mm512_add_pd(a2, a3));                      \
+    for (; j < x2; j++) {                                                         \
+        const double v = row[j];                                                  \
+        const double dj = j - x0;                                                 \
+        p0 += v;                                                                  \
+        s1 += v * dj;                                                             \
+        s2 += v * dj * dj;                                                        \
+    }                                                                             \
+    s[0] = p0;                                                                    \
+    s[1] = s1;                                                                    \
+    s[2] = s2;
+
+// Pixels are converted to doubles for vector multiplication but all products
+// and sums are integers below 2^53, so they are exact and converted back without loss
+AVX512 static void moments_u8_avx512(const uint8_t *row, int x1, int x2, int x0, int64_t *s) {
+    _cgn_moments_row_avx512(AVX512_LOAD_U8)
+}
+
+AVX512 static void moments_u16_avx512(const uint16_t *row, int x1, int x2, int x0, int64_t *s) {
+    _cgn_moments_row_avx512(AVX512_LOAD_U16)
+}
+
+AVX512 static void moments_f64_avx512(const double *row, int x1, int x2, int x0, double *s) {
+    _cgn_moments_row_avx512(AVX512_LOAD_F64)
+}
+
+AVX512 static void moments_f32_avx512(const float *row, int x1, int x2, int x0, double *s) {
+    _cgn_moments_row_avx512(AVX512_LOAD_F32)
+}
+
+#define AVX512_STORE_F64(p, v) _mm512_storeu_pd(p, v)
+#define AVX512_STORE_F32(p, v) _mm256_storeu_ps(p, _mm512_cvtpd_ps(v))
+
+#define AVX512_SUBTRACT(v, k, store) {                                  \
+    const __mmask8 mask = _mm512_cmp_pd_mask(v, vth, _CMP_GT_OQ);       \
+    const __m512d t = _mm512_maskz_sub_pd(mask, v, vm);                 \
+    store(dst + k, t);                                                  \
+    cnt += __builtin_popcount(mask);                                    \
+    lo = _mm512_min_pd(lo, t);                                          \
+    hi = _mm512_max_pd(hi, t);                                          \
+}
+
+#define _cgn_subtract_row_avx512(load, store)                   \
+    const __m512d vth = _mm512_set1_pd(th);                     \
+    const __m512d vm = _mm512_set1_pd(m);                       \
+    __m512d lo = _mm512_set1_pd(*min);                          \
+    __m512d hi = _mm512_set1_pd(*max);                          \
+    int cnt = 0;                                                \
+    int j = 0;                                                  \
+    for (; j <= n - 16; j += 16) {                              \
+        __m512d v0, v1;                                         \
+        load(row + j, v0, v1);                                  \
+        AVX512_SUBTRACT(v0, j, store);                          \
+        AVX512_SUBTRACT(v1, j + 8, store);                      \
+    }                                                           \
+    *count += cnt;                                              \
+    *min = _mm512_reduce_min_pd(lo);                            \
+    *max = _mm512_reduce_max_pd(hi);                            \
+    if (j < n) {                                                \
+        row += j, dst += j, n -= j;                             \
+        _cgn_subtract_row                                       \
+    }
+
+AVX512 static void subtract_u8_avx512(const uint8_t *row, double *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row_avx512(AVX512_LOAD_U8, AVX512_STORE_F64)
+}
+
+AVX512 static void subtract_u16_avx512(const uint16_t *row, double *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row_avx512(AVX512_LOAD_U16, AVX512_STORE_F64)
+}
+
+AVX512 static void subtract_u8_f32_avx512(const uint8_t *row, float *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row_avx512(AVX512_LOAD_U8, AVX512_STORE_F32)
+}
+
+AVX512 static void subtract_u16_f32_avx512(const uint16_t *row, float *dst, int n, double th, double m, int *count, double *min, double *max) {
+    _cgn_subtract_row_avx512(AVX512_LOAD_U16, AVX512_STORE_F32)
+}
+
+#define AVX512_MOMENTS_TH(v, d, a2) {                            \
+    const __mmask8 mask = _mm512_cmp_pd_mask(v, vth, _CMP_GT_OQ); \
+    const __m512d t = _mm512_maskz_sub_pd(mask, v, vm);         \
+    const __m512d w = _mm512_mul_pd(t, d);                      \
+    a0 = _mm512_add_pd(a0, t);                                  \
+    a1 = _mm512_add_pd(a1, w);                                  \
+    a2 = _mm512_fmadd_pd(w, d, a2);                             \
+    cnt += __builtin_popcount(mask);                            \
+    vlo = _mm512_min_pd(vlo, t);                                \
+    vhi = _mm512_max_pd(vhi, t);                                \
+}
+
+#define _cgn_moments_th_row_avx512(load)                        \
+    const __m512d vth = _mm512_set1_pd(th);                     \
+    const __m512d vm = _mm512_set1_pd(m);                       \
+    __m512d a0 = _mm512_setzero_pd(), a1 = _mm512_setzero_pd(); \
+    __m512d a2 = _mm512_setzero_pd(), a3 = _mm512_setzero_pd(); \
+    __m512d vlo = _mm512_set1_pd(*min);                         \
+    __m512d vhi = _mm512_set1_pd(*max);                         \
+    __m512d d0 = _mm512_add_pd(_mm512_set1_pd(x1 - x0),         \
+        _mm512_setr_pd(0, 1, 2, 3, 4, 5, 6, 7));                \
+    __m512d d1 = _mm512_add_pd(d0, _mm512_set1_pd(8));          \
+    const __m512d step = _mm512_set1_pd(16);                    \
+    int cnt = 0;                                                \
+    int j = x1;                                                 \
+    for (; j <= x2 - 16; j += 16) {                             \
+        __m512d v0, v1;                                         \
+        load(row + j, v0, v1);                                  \
+        AVX512_MOMENTS_TH(v0, d0, a2);                          \
+        AVX512_MOMENTS_TH(v1, d1, a3);                          \
+        d0 = _mm512_add_pd(d0, step);                           \
+        d1 = _mm512_add_pd(d1, step);                           \
+    }                                                           \
+    double p0 = _mm512_reduce_add_pd(a0);                       \
+    double s1 = _mm512_reduce_add_pd(a1);                       \
+    double s2 = _mm512_reduce_add_pd(_mm512_add_pd(a2, a3));    \
+    double lo = _mm512_reduce_min_pd(vlo);                      \
+    double hi = _mm512_reduce_max_pd(vhi);                      \
+    _cgn_moments_th_tail
+
+AVX512 static void moments_th_u8_avx512(const uint8_t *row, int x1, int x2, int x0, double th, double m, double *s, int *count, double *min, double *max) {
+    _cgn_moments_th_row_avx512(AVX512_LOAD_U8)
+}
+
+AVX512 static void moments_th_u16_avx512(const uint16_t *row, int x1, int x2, int x0, double th, double m, double *s, int *count, double *min, double *max) {
+    _cgn_moments_th_row_avx512(AVX512_LOAD_U16)
+}
+
+#define _cgn_copy_row_avx512(load, store)                       \
+    __m512d hi = _mm512_set1_pd(max ? *max : 0);                \
+    int j = 0;                                                  \
+    for (; j <= n - 16; j += 16) {                              \
+        __m512d v0, v1;                                         \
+        load(src + j, v0, v1);                                  \
+        store(dst + j, v0);                                     \
+        store(dst + j + 8, v1);                                 \
+        hi = _mm512_max_pd(hi, _mm512_max_pd(v0, v1));          \
+    }                                                           \
+    if (max) *max = _mm512_reduce_max_pd(hi);                   \
+    if (j < n) {                                                \
+        src += j, dst += j, n -= j;                             \
+        _cgn_copy_row                                           \
+    }
+
+AVX512 static void copy_u8_avx512(const uint8_t *src, double *dst, int n, double *max) {
+    _cgn_copy_row_avx512(AVX512_LOAD_U8, AVX512_STORE_F64)
+}
+
+AVX512 static void copy_u16_avx512(const uint16_t *src, double *dst, int n, double *max) {
+    _cgn_copy_row_avx512(AVX512_LOAD_U16, AVX512_STORE_F64)
+}
+
+AVX512 static void copy_u8_f32_avx512(const uint8_t *src, float *dst, int n, double *max) {
+    _cgn_copy_row_avx512(AVX512_LOAD_U8, AVX512_STORE_F32)
+}
+
+AVX512 static void copy_u16_f32_avx512(const uint16_t *src, float *dst, int n, double *max) {
+    _cgn_copy_row_avx512(AVX512_LOAD_U16, AVX512_STORE_F32)
+}
+
+#define _cgn_sum_rows_avx512(widen)                                 \
+    int j = 0;                                                      \
+    for (; j <= n - 16; j += 16) {                                  \
+        __m512i a = _mm512_setzero_si512();                         \
+        for (int y = 0; y < rows; y++)                              \
+            a = _mm512_add_epi32(a, widen(src + y*stride + j));     \
+        _mm512_storeu_si512(dst + j, a);                            \
+    }                                                               \
+    if (j < n) {                                                    \
+        src += j, dst += j, n -= j;                                 \
+        _cgn_sum_rows                                               \
+    }
+
+// Loads 16 unsigned bytes as 32-bit integers
+#define AVX512_WIDEN_U8(p) _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(p)))
+
+// Loads 16 unsigned shorts as 32-bit integers
+#define AVX512_WIDEN_U16(p) _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(p)))
+
+AVX512 static void sum_rows_u8_avx512(const uint8_t *src, int stride, int rows, uint32_t *dst, int n) {
+    _cgn_sum_rows_avx512(AVX512_WIDEN_U8)
+}
+
+AVX512 static void sum_rows_u16_avx512(const uint16_t *src, int stride, int rows, uint32_t *dst, int n) {
+    _cgn_sum_rows_avx512(AVX512_WIDEN_U16)
+}
+
+#define _cgn_stack_avx512(widen, copy)                                       \
+    int j = 0;                                                              \
+    for (; j <= n - 16; j += 16) {                                          \
+        const __m512i d = _mm512_sub_epi32(widen(src + j), widen(old + j)); \
+        copy;                                                               \
+        _mm512_storeu_si512(sum + j, _mm512_add_epi32(_mm512_loadu_si512(sum + j), d)); \
+    }                                                                       \
+    _cgn_stack_tail
+
+AVX512 static void stack_u8_avx512(const uint8_t *src, uint8_t *old, uint32_t *sum, int n) {
+    _cgn_stack_avx512(AVX512_WIDEN_U8,
+        _mm_storeu_si128((__m128i*)(old + j), _mm_loadu_si128((const __m128i*)(src + j))))
+}
+
+AVX512 static void stack_u16_avx512(const uint16_t *src, uint16_t *old, uint32_t *sum, int n) {
+    _cgn_stack_avx512(AVX512_WIDEN_U16,
+        _mm256_storeu_si256((__m256i*)(old + j), _mm256_loadu_si256((const __m256i*)(src + j))))
+}
+
+// AVX-512F has no 16-bit shuffles and multiplications, AVX2 versions are used
+#define unpack_10g40_avx512 unpack_10g40_avx2
+#define unpack_12g24_avx512 unpack_12g24_avx2
+
+// Packing with saturation needs AVX-512BW, AVX2 versions are used
+#define calib_u8_avx512 calib_u8_avx2
+#define calib_u16_avx512 calib_u16_avx2
+#define sum_cols_avx512 sum_cols_avx2
+#define average_u8_avx512 average_u8_avx2
+#define average_u16_avx512 average_u16_avx2
+
+// Byte and word comparisons need AVX-512BW, AVX2 versions are used
+#define skip_below_u8_avx512 skip_below_u8_avx2
+#define skip_below_u16_avx512 skip_below_u16_avx2
+
+#endif // CGN_SIMD_X86
+
+//------------------------------------------------------------------------------
+//                                 Dispatch
+//------------------------------------------------------------------------------
+
+#define KERNELS(suffix) {                           \
+    .moments_u8 = moments_u8 ## suffix,             \
+    .moments_u16 = moments_u16 ## suffix,           \
+    .moments_f64 = moments_f64 ## suffix,           \
+    .moments_f32 = moments_f32 ## suffix,           \
+    .moments_th_u8 = moments_th_u8 ## suffix,       \
+    .moments_th_u16 = moments_th_u16 ## suffix,     \
+    .subtract_u8 = subtract_u8 ## suffix,           \
+    .subtract_u16 = subtract_u16 ## suffix,         \
+    .subtract_u8_f32 = subtract_u8_f32 ## suffix,   \
+    .subtract_u16_f32 = subtract_u16_f32 ## suffix, \
+    .copy_u8 = copy_u8 ## suffix,                   \
+    .copy_u16 = copy_u16 ## suffix,                 \
+    .copy_u8_f32 = copy_u8_f32 ## suffix,           \
+    .copy_u16_f32 = copy_u16_f32 ## suffix,         \
+    .sum_rows_u8 = sum_rows_u8 ## suffix,           \
+    .sum_rows_u16 = sum_rows_u16 ## suffix,         \
+    .sum_cols = sum_cols ## suffix,                 \
+    .unpack_10g40 = unpack_10g40 ## suffix,         \
+    .unpack_12g24 = unpack_12g24 ## suffix,         \
+    .calib_u8 = calib_u8 ## suffix,                 \
+    .calib_u16 = calib_u16 ## suffix,               \
+    .stack_u8 = stack_u8 ## suffix,                 \
+    .stack_u16 = stack_u16 ## suffix,               \
+    .average_u8 = average_u8 ## suffix,             \
+    .average_u16 = average_u16 ## suffix,           \
+    .skip_below_u8 = skip_below_u8 ## suffix,       \
+    .skip_below_u16 = skip_below_u16 ## suffix,     \
+}
+
+static const CgnKernels kernels_none = KERNELS();
+#ifdef CGN_SIMD_X86
+static const CgnKernels kernels_sse42 = KERNELS(_sse42);
+static const CgnKernels kernels_avx2 = KERNELS(_avx2);
+static const CgnKernels kernels_avx512 = KERNELS(_avx512);
+#endif
+
+CgnKernels cgn_kernels = KERNELS();
+static int simd_level = CGN_SIMD_NONE;
+
+int cgn_detect_simd() {
+#ifdef CGN_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return CGN_SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return CGN_SIMD_AVX2;
+    if (__builtin_cpu_supports("sse4.2"))
+        return CGN_SIMD_SSE42;
+#endif
+    return CGN_SIMD_NONE;
+}
+
+int cgn_init_simd() {
+    return cgn_set_simd(cgn_detect_simd());
+}
+
+int cgn_set_simd(int level) {
+    level = min(max(level, CGN_SIMD_NONE), cgn_detect_simd());
+    switch (level) {
+#ifdef CGN_SIMD_X86
+    case CGN_SIMD_AVX512: cgn_kernels = kernels_avx512; break;
+    case CGN_SIMD_AVX2: cgn_kernels = kernels_avx2; break;
+    case CGN_SIMD_SSE42: cgn_kernels = kernels_sse42; break;
+#endif
+    default: cgn_kernels = kernels_none; break;
+    }
+    simd_level = level;
+    return level;
+}
+
+int cgn_get_simd() {
+    return simd_level;
+}
+
+const char* cgn_simd_name(int level) {
+    switch (level) {
+    case CGN_SIMD_SSE42: return "SSE4.2";
+    case CGN_SIMD_AVX2: return "AVX2";
+    case CGN_SIMD_AVX512: return "AVX-512";
+    }
+    return "none";
+}
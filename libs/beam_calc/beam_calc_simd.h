@@ -0,0 +1,72 @@
+#ifndef _CIGNUS_BEAM_CALC_SIMD_H_
+#define _CIGNUS_BEAM_CALC_SIMD_H_
+
+#include <stdint.h>
+
+// Row kernels used by the calculation functions.
+// Implementations are selected once by cgn_init_simd()
+// according to instruction sets supported by the CPU.
+typedef struct {
+    // Moments of the row segment [x1, x2) around the point x0:
+    // s[0] = Σp, s[1] = Σp(x-x0), s[2] = Σp(x-x0)²
+    // They are exact for integer pixels in rows up to 8192 px
+    void (*moments_u8)(const uint8_t *row, int x1, int x2, int x0, int64_t *s);
+    void (*moments_u16)(const uint16_t *row, int x1, int x2, int x0, int64_t *s);
+    void (*moments_f64)(const double *row, int x1, int x2, int x0, double *s);
+    void (*moments_f32)(const float *row, int x1, int x2, int x0, double *s);
+
+    // Moments of the row segment like above but of values `v - m`
+    // for values above the threshold `th` and 0 for others, without writing them anywhere.
+    // Counts values above the threshold and extends min and max like `subtract_*` do.
+    void (*moments_th_u8)(const uint8_t *row, int x1, int x2, int x0, double th, double m, double *s, int *count, double *min, double *max);
+    void (*moments_th_u16)(const uint16_t *row, int x1, int x2, int x0, double th, double m, double *s, int *count, double *min, double *max);
+
+    // Writes `v - m` for values above the threshold `th` and 0 for others,
+    // increments the number of values above the threshold,
+    // and extends min and max of written values.
+    void (*subtract_u8)(const uint8_t *row, double *dst, int n, double th, double m, int *count, double *min, double *max);
+    void (*subtract_u16)(const uint16_t *row, double *dst, int n, double th, double m, int *count, double *min, double *max);
+    void (*subtract_u8_f32)(const uint8_t *row, float *dst, int n, double th, double m, int *count, double *min, double *max);
+    void (*subtract_u16_f32)(const uint16_t *row, float *dst, int n, double th, double m, int *count, double *min, double *max);
+
+    // Converts values to doubles (or floats), extends max when it's not NULL
+    void (*copy_u8)(const uint8_t *src, double *dst, int n, double *max);
+    void (*copy_u16)(const uint16_t *src, double *dst, int n, double *max);
+    void (*copy_u8_f32)(const uint8_t *src, float *dst, int n, double *max);
+    void (*copy_u16_f32)(const uint16_t *src, float *dst, int n, double *max);
+
+    // Column sums of `rows` rows (up to 257) of `stride` elements, used for decimation of frames
+    void (*sum_rows_u8)(const uint8_t *src, int stride, int rows, uint32_t *dst, int n);
+    void (*sum_rows_u16)(const uint16_t *src, int stride, int rows, uint32_t *dst, int n);
+
+    // Sums of `k` adjacent values shifted right by `shift` for `n` groups, used for binning of frames
+    void (*sum_cols)(const uint32_t *src, uint16_t *dst, int n, int k, int shift);
+
+    // Unpacks `n` pixels of Mono10g40 (4 pixels in 5 bytes) or Mono12g24 (2 pixels in 3 bytes)
+    // format, `n` should be a multiple of 4 or 2 respectively
+    void (*unpack_10g40)(const uint8_t *src, uint16_t *dst, int n);
+    void (*unpack_12g24)(const uint8_t *src, uint16_t *dst, int n);
+
+    // Writes `(v - dark) * gain + offset` rounded and clamped to [0, top], see CgnCalib.
+    // `dark` or `gain` can be NULL but not both, `dst` can be `src`.
+    void (*calib_u8)(const uint8_t *src, uint8_t *dst, const uint16_t *dark, const float *gain, int n, int offset, int top);
+    void (*calib_u16)(const uint16_t *src, uint16_t *dst, const uint16_t *dark, const float *gain, int n, int offset, int top);
+
+    // Adds `src - old` to `sum` and copies `src` over `old`, see CgnStack
+    void (*stack_u8)(const uint8_t *src, uint8_t *old, uint32_t *sum, int n);
+    void (*stack_u16)(const uint16_t *src, uint16_t *old, uint32_t *sum, int n);
+
+    // Returns the first index in [j, n) of a value above the threshold `th` or `n` if there is no such,
+    // adds skipped values to `sum`. `th` should be in the range of pixel values.
+    int (*skip_below_u8)(const uint8_t *row, int j, int n, int th, int64_t *sum);
+    int (*skip_below_u16)(const uint16_t *row, int j, int n, int th, int64_t *sum);
+
+    // Writes `sum * k` rounded to nearest (ties to even), results should fit into `dst`
+    // and sums should be less than 2^24 to be exact in floats
+    void (*average_u8)(const uint32_t *sum, uint8_t *dst, int n, float k);
+    void (*average_u16)(const uint32_t *sum, uint16_t *dst, int n, float k);
+} CgnKernels;
+
+extern CgnKernels cgn_kernels;
+
+#endif // _CIGNUS_BEAM_CALC_SIMD_H_
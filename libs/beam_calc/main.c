@@ -67,9 +67,18 @@ center=[1567,965], diam=[979,673], angle=-11.6
 Elapsed: 1.118s, FPS: 26.8, 37.3ms/frame
 mean=927.29, sdev=324.80, min=0.00, max=53555.71, iters=2
 
+*** Single pass calculation of moments (cgn_calc_beam_naive_1, calc_beam_v=1)
+*** GCC 12.2x64 Intel Xeon (Ice Lake), the same image size:
+
+naive_8     12.4ms/frame
+naive_1_8    5.7ms/frame, diff: center=[2.3e-13,0.0e+00], diam=[9.1e-13,4.5e-13]
+bkgnd_8     25.3ms/frame
+bkgnd_1_8   21.9ms/frame, diff: center=[9.1e-12,5.0e-12], diam=[4.7e-12,6.8e-13]
+
 */
 #include "beam_calc.h"
 
+#include <math.h>
 #include <stdlib.h>
 #include <time.h>
 
@@ -79,16 +88,1174 @@ mean=927.29, sdev=324.80, min=0.00, max=53555.71, iters=2
 #define FILENAME_8 "../../beams/beam_8b_ast.pgm"
 #define FILENAME_16 "../../beams/beam_16b_ast.pgm"
 
+// Wall time, clock() would sum the time of all calculation threads
+static double now() {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
 #define MEASURE(ident, func) { \
     printf("\n" ident "\n"); \
-    clock_t tm = clock(); \
+    double tm = now(); \
     for (int i = 0; i < FRAMES; i++) func; \
-    double elapsed = (clock() - tm)/(double)CLOCKS_PER_SEC; \
+    double elapsed = now() - tm; \
     printf("center=[%.0f,%.0f], diam=[%.0f,%.0f], angle=%.1f\n", r.xc, r.yc, r.dx, r.dy, r.phi); \
     printf("Elapsed: %.3fs, FPS: %.1f, %.1fms/frame\n", elapsed, FRAMES/elapsed, elapsed/(double)FRAMES*1000); \
 }
 
+#define PRINT_DIFF(r0, r) \
+    printf("diff: center=[%.1e,%.1e], diam=[%.1e,%.1e], angle=%.1e\n", \
+        fabs(r.xc-r0.xc), fabs(r.yc-r0.yc), fabs(r.dx-r0.dx), fabs(r.dy-r0.dy), fabs(r.phi-r0.phi));
+
+// Centers and widths differ by not more than `tol`, NaN results only match each other
+static int results_close(const CgnBeamResult *r0, const CgnBeamResult *r, double tol) {
+    return r->nan == r0->nan && (r->nan || (
+        fabs(r->xc - r0->xc) <= tol && fabs(r->yc - r0->yc) <= tol &&
+        fabs(r->dx - r0->dx) <= tol && fabs(r->dy - r0->dy) <= tol));
+}
+
+// Prints the difference and fails the run when it's more than `tol`
+#define CHECK_DIFF(r0, r, tol) { \
+    PRINT_DIFF(r0, r); \
+    if (!results_close(&r0, &r, tol)) { \
+        printf("FAILED\n"); \
+        failed = 1; \
+    } \
+}
+
+// Compares results of single and double precision `subtracted` buffers.
+// Returns 0 when centers and widths are within 0.01 px for all calculation versions.
+static int check_f32(const char *filename, int bpp) {
+    int w, h, offset;
+    uint8_t *buf = read_pgm(filename, &w, &h, &offset);
+    if (!buf) {
+        return 1;
+    }
+    double *subtracted = (double*)malloc(sizeof(double)*w*h);
+    float *subtracted_f32 = (float*)malloc(sizeof(float)*w*h);
+    if (!subtracted || !subtracted_f32) {
+        perror("Unable to allocate buffers");
+        exit(EXIT_FAILURE);
+    }
+    CgnBeamCalc c = { .w = w, .h = h, .bpp = bpp, .buf = buf + offset };
+    CgnBeamBkgnd b;
+    memset(&b, 0, sizeof(CgnBeamBkgnd));
+    b.max_iter = 25;
+    b.precision = 0.001;
+    // Larger corners, otherwise they are empty for small sample images
+    b.corner_fraction = 0.1;
+    b.nT = 3;
+    b.mask_diam = 3;
+    b.ax1 = 0;
+    b.ay1 = 0;
+    b.ax2 = w;
+    b.ay2 = h;
+    int failed = 0;
+    for (int v = 0; v < 4; v++) {
+        CgnBeamResult r0, r;
+        b.subtract_bkgnd_v = v / 2;
+        b.calc_beam_v = v % 2;
+        b.subtracted = subtracted;
+        b.subtracted_f32 = NULL;
+        cgn_calc_beam_bkgnd(&c, &b, &r0);
+        b.subtracted = NULL;
+        b.subtracted_f32 = subtracted_f32;
+        cgn_calc_beam_bkgnd(&c, &b, &r);
+        double d = fmax(fmax(fabs(r.xc-r0.xc), fabs(r.yc-r0.yc)), fmax(fabs(r.dx-r0.dx), fabs(r.dy-r0.dy)));
+        int ok = r.nan == r0.nan && (r.nan || d < 0.01);
+        printf("subtract_bkgnd_v=%d, calc_beam_v=%d, nan=%d, ", b.subtract_bkgnd_v, b.calc_beam_v, r.nan);
+        PRINT_DIFF(r0, r);
+        if (!ok) {
+            printf("FAILED\n");
+            failed = 1;
+        }
+    }
+    free(buf);
+    free(subtracted);
+    free(subtracted_f32);
+    return failed;
+}
+
+// Moments of raw integer frames are accumulated in integers, so results
+// of the single pass calculation must be exactly the same for any thread count.
+// The second pass of the two-pass calculation is in double around
+// the fractional center, so only centers are exact there.
+static int check_threads(const char *filename, int bpp) {
+    int w, h, offset;
+    uint8_t *buf = read_pgm(filename, &w, &h, &offset);
+    if (!buf) {
+        return 1;
+    }
+    CgnBeamCalc c = { .w = w, .h = h, .bpp = bpp, .buf = buf + offset };
+    int failed = 0;
+    for (int v = 0; v < 2; v++) {
+        CgnBeamResult r0 = { .x1 = 0, .x2 = w, .y1 = 0, .y2 = h }, r = r0;
+        cgn_set_threads(1);
+        if (v) cgn_calc_beam_naive_1(&c, &r0); else cgn_calc_beam_naive(&c, &r0);
+        for (int n = 2; n <= 16; n *= 2) {
+            cgn_set_threads(n);
+            if (v) cgn_calc_beam_naive_1(&c, &r); else cgn_calc_beam_naive(&c, &r);
+            if (r.xc != r0.xc || r.yc != r0.yc || (v && (r.dx != r0.dx || r.dy != r0.dy || r.phi != r0.phi))) {
+                printf("naive%s, threads=%d, ", v ? "_1" : "", n);
+                PRINT_DIFF(r0, r);
+                printf("FAILED\n");
+                failed = 1;
+            }
+        }
+    }
+    cgn_set_threads(0);
+    free(buf);
+    return failed;
+}
+
+// Compares apertures of a grid calculated one by one into the prefilled
+// subtracted buffer and in parallel into the buffer that is never written
+// outside of apertures, results and displayed images must be exactly the same.
+static int check_multi(const char *filename, int bpp) {
+    int w, h, offset;
+    uint8_t *buf = read_pgm(filename, &w, &h, &offset);
+    if (!buf) {
+        return 1;
+    }
+    const int n = 6;
+    const int count = n * n;
+    double *subtracted0 = (double*)malloc(sizeof(double)*w*h);
+    double *subtracted = (double*)malloc(sizeof(double)*w*h);
+    double *img0 = (double*)malloc(sizeof(double)*w*h);
+    double *img = (double*)malloc(sizeof(double)*w*h);
+    CgnBeamBkgnd *b = (CgnBeamBkgnd*)malloc(sizeof(CgnBeamBkgnd)*count);
+    CgnBeamResult *r = (CgnBeamResult*)malloc(sizeof(CgnBeamResult)*count);
+    CgnBeamResult *r0 = (CgnBeamResult*)malloc(sizeof(CgnBeamResult)*count);
+    if (!subtracted0 || !subtracted || !img0 || !img || !b || !r || !r0) {
+        perror("Unable to allocate buffers");
+        exit(EXIT_FAILURE);
+    }
+    CgnBeamCalc c = { .w = w, .h = h, .bpp = bpp, .buf = buf + offset };
+    for (int i = 0; i < count; i++) {
+        memset(&b[i], 0, sizeof(CgnBeamBkgnd));
+        b[i].max_iter = 25;
+        b[i].precision = 0.001;
+        b[i].corner_fraction = 0.035;
+        b[i].nT = 3;
+        b[i].mask_diam = 3;
+        b[i].subtract_bkgnd_v = 1;
+        b[i].calc_beam_v = 1;
+        b[i].ax1 = w * (i % n) / n;
+        b[i].ax2 = w * (i % n + 1) / n;
+        b[i].ay1 = h * (i / n) / n;
+        b[i].ay2 = h * (i / n + 1) / n;
+    }
+    CgnBeamBkgnd g0, g;
+    memset(&g0, 0, sizeof(CgnBeamBkgnd));
+    g0.subtract_bkgnd_v = 1;
+    g = g0;
+    g0.subtracted = subtracted0;
+    g.subtracted = subtracted;
+    for (int i = 0; i < w*h; i++)
+        subtracted[i] = NAN;
+
+    double tm = now();
+    for (int f = 0; f < FRAMES; f++) {
+        cgn_copy_to_f64(&c, subtracted0, NULL);
+        g0.min = 1e10;
+        g0.max = -1e10;
+        for (int i = 0; i < count; i++) {
+            b[i].subtracted = subtracted0;
+            b[i].min = 1e10;
+            b[i].max = -1e10;
+            r0[i].x1 = b[i].ax1, r0[i].x2 = b[i].ax2;
+            r0[i].y1 = b[i].ay1, r0[i].y2 = b[i].ay2;
+            cgn_calc_beam_bkgnd(&c, &b[i], &r0[i]);
+            g0.min = fmin(g0.min, b[i].min);
+            g0.max = fmax(g0.max, b[i].max);
+        }
+    }
+    const double elapsed0 = now() - tm;
+    tm = now();
+    for (int f = 0; f < FRAMES; f++) {
+        g.min = 1e10;
+        g.max = -1e10;
+        for (int i = 0; i < count; i++) {
+            b[i].subtracted = subtracted;
+            b[i].min = 1e10;
+            b[i].max = -1e10;
+        }
+        cgn_calc_beam_bkgnd_multi(&c, b, r, count);
+        for (int i = 0; i < count; i++) {
+            g.min = fmin(g.min, b[i].min);
+            g.max = fmax(g.max, b[i].max);
+        }
+    }
+    const double elapsed = now() - tm;
+    printf("%s: %d apertures, sequential %.1fms/frame, parallel %.1fms/frame\n", filename, count,
+        elapsed0/(double)FRAMES*1000, elapsed/(double)FRAMES*1000);
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (r[i].nan != r0[i].nan || r[i].xc != r0[i].xc || r[i].yc != r0[i].yc ||
+            r[i].dx != r0[i].dx || r[i].dy != r0[i].dy || r[i].phi != r0[i].phi) {
+            printf("aperture=%d, ", i);
+            PRINT_DIFF(r0[i], r[i]);
+            printf("FAILED\n");
+            failed = 1;
+        }
+    }
+    for (int norm = 0; norm < 2; norm++) {
+        double min_z0, max_z0, min_z, max_z;
+        cgn_ext_copy_to_f64(&c, &g0, img0, norm, 0, &min_z0, &max_z0);
+        cgn_ext_copy_apertures_to_f64(&c, &g, b, count, img, norm, 0, &min_z, &max_z);
+        if (min_z != min_z0 || max_z != max_z0 || memcmp(img, img0, sizeof(double)*w*h) != 0) {
+            printf("normalize=%d, displayed image differs\nFAILED\n", norm);
+            failed = 1;
+        }
+    }
+    free(buf);
+    free(subtracted0);
+    free(subtracted);
+    free(img0);
+    free(img);
+    free(b);
+    free(r);
+    free(r0);
+    return failed;
+}
+
+// Packs `w` x `h` pixels of the 16-bit frame (with row stride `stride`) into Mono10g40 or Mono12g24,
+// high `bpp` bits of each pixel are taken, they are also written into `unpacked` as is
+static void pack_frame(const uint16_t *src, int w, int h, int stride, int bpp, uint8_t *dst, uint16_t *unpacked) {
+    const int n = bpp == 10 ? 4 : 2;
+    uint16_t p[4];
+    int k = 0;
+    for (int i = 0; i < w*h; i++) {
+        p[k] = src[(i / w)*stride + i % w] >> (16 - bpp);
+        unpacked[i] = p[k];
+        if (++k < n && i < w*h - 1)
+            continue;
+        for (; k < n; k++)
+            p[k] = 0;
+        if (bpp == 10) {
+            for (int j = 0; j < 4; j++)
+                *dst++ = p[j] >> 2;
+            *dst++ = (p[0] & 3) | (p[1] & 3) << 2 | (p[2] & 3) << 4 | (p[3] & 3) << 6;
+        } else {
+            *dst++ = p[0] >> 4;
+            *dst++ = p[1] >> 4;
+            *dst++ = (p[0] & 15) | (p[1] & 15) << 4;
+        }
+        k = 0;
+    }
+}
+
+// Frame statistics needed by the live view followed by the beam calculation
+static void calc_frame(const CgnBeamCalc *c, CgnBeamBkgnd *b, CgnBeamResult *r) {
+    volatile double brightness = cgn_calc_brightness_1(c);
+    volatile double overexposed = cgn_calc_overexposure(c, 0.8);
+    (void)brightness; (void)overexposed;
+    cgn_calc_beam_bkgnd(c, b, r);
+}
+
+// The same as calc_frame for a packed frame that is unpacked first
+static void calc_packed_frame(uint8_t *packed, const CgnBeamCalc *c, CgnBeamBkgnd *b, CgnBeamResult *r) {
+    const int sz = c->bpp == 10 ? c->w*c->h/4*5 : c->w*c->h/2*3;
+    if (c->bpp == 10)
+        cgn_convert_10g40_to_u16(c->buf, packed, sz);
+    else
+        cgn_convert_12g24_to_u16(c->buf, packed, sz);
+    calc_frame(c, b, r);
+}
+
+// The same as calc_packed_frame with statistics collected (and calibration applied) while unpacking,
+// only the aperture is unpacked when it's smaller than the frame
+static void calc_packed_frame_1(uint8_t *packed, const CgnBeamCalc *c, const CgnCalib *cal, CgnBeamBkgnd *b, CgnBeamResult *r) {
+    CgnFrameStats s = { .overexposure_th = 0.8, .bkgnd = b,
+        .x1 = b->ax1, .y1 = b->ay1, .x2 = b->ax2, .y2 = b->ay2, .calib = cal };
+    cgn_convert_packed_to_u16(packed, c, &s);
+    cgn_calc_beam_bkgnd(c, b, r);
+}
+
+// Unpacks 10 and 12-bit frames with all instruction sets, results must be exactly the same
+// as unpacked pixels and statistics calculated over them separately.
+// Odd width makes rows start in the middle of pixel groups, such frames are unpacked as a whole.
+// When only the aperture is unpacked, it must be the same as in the full frame.
+static int check_packed(const char *filename) {
+    int w0, h, offset;
+    uint8_t *buf = read_pgm(filename, &w0, &h, &offset);
+    if (!buf) {
+        return 1;
+    }
+    uint8_t *packed = (uint8_t*)malloc(w0*h*2);
+    uint16_t *unpacked0 = (uint16_t*)malloc(sizeof(uint16_t)*w0*h);
+    uint16_t *unpacked = (uint16_t*)malloc(sizeof(uint16_t)*w0*h);
+    if (!packed || !unpacked0 || !unpacked) {
+        perror("Unable to allocate buffers");
+        exit(EXIT_FAILURE);
+    }
+    const int simd = cgn_get_simd();
+    int failed = 0;
+    for (int bpp = 10; bpp <= 12; bpp += 2) {
+        for (int w = w0; w >= w0-1; w--) {
+            pack_frame((const uint16_t*)(buf + offset), w, h, w0, bpp, packed, unpacked0);
+            CgnBeamCalc c = { .w = w, .h = h, .bpp = bpp, .buf = (uint8_t*)unpacked0 };
+            CgnBeamBkgnd b;
+            memset(&b, 0, sizeof(CgnBeamBkgnd));
+            b.corner_fraction = 0.035;
+            b.nT = 3;
+            b.mask_diam = 3;
+            b.subtract_bkgnd_v = 2;
+            b.calc_beam_v = 1;
+            b.ax1 = w / 8, b.ax2 = w - w / 8;
+            b.ay1 = h / 8, b.ay2 = h - h / 8;
+            const double brightness = cgn_calc_brightness_1(&c);
+            const double overexposed = cgn_calc_overexposure(&c, 0.5);
+            for (int level = CGN_SIMD_NONE; level <= simd; level++) {
+                // Moments with thresholds are in doubles and can differ between instruction sets
+                cgn_set_simd(level);
+                CgnBeamResult r0, r;
+                c.buf = (uint8_t*)unpacked0;
+                cgn_calc_beam_bkgnd(&c, &b, &r0);
+                const double mean = b.mean, sdev = b.sdev;
+                c.buf = (uint8_t*)unpacked;
+                memset(unpacked, 0, sizeof(uint16_t)*w*h);
+                CgnFrameStats s = { .overexposure_th = 0.5, .bkgnd = &b };
+                cgn_convert_packed_to_u16(packed, &c, &s);
+                int ok = memcmp(unpacked, unpacked0, sizeof(uint16_t)*w*h) == 0 &&
+                    s.brightness == brightness && s.overexposed == overexposed &&
+                    b.mean == mean && b.sdev == sdev && b.corners_ready;
+                cgn_calc_beam_bkgnd(&c, &b, &r);
+                ok = ok && s.full && !b.corners_ready && r.nan == r0.nan && r.xc == r0.xc && r.yc == r0.yc &&
+                    r.dx == r0.dx && r.dy == r0.dy;
+                printf("bpp=%d, w=%d, %s: brightness=%.4f, overexposed=%.4f, mean=%.2f, sdev=%.2f\n",
+                    bpp, w, cgn_simd_name(level), s.brightness, s.overexposed, b.mean, b.sdev);
+
+                memset(unpacked, 0, sizeof(uint16_t)*w*h);
+                s.x1 = b.ax1, s.x2 = b.ax2;
+                s.y1 = b.ay1, s.y2 = b.ay2;
+                cgn_convert_packed_to_u16(packed, &c, &s);
+                for (int i = b.ay1; i < b.ay2; i++)
+                    if (memcmp(unpacked + i*w + b.ax1, unpacked0 + i*w + b.ax1, sizeof(uint16_t)*(b.ax2 - b.ax1)) != 0)
+                        ok = 0;
+                // Rows not starting at pixel groups are always unpacked completely
+                ok = ok && s.full == (w % (bpp == 10 ? 4 : 2) != 0) &&
+                    b.mean == mean && b.sdev == sdev && b.corners_ready;
+                cgn_calc_beam_bkgnd(&c, &b, &r);
+                ok = ok && r.nan == r0.nan && r.xc == r0.xc && r.yc == r0.yc &&
+                    r.dx == r0.dx && r.dy == r0.dy;
+                if (!ok) {
+                    printf("FAILED\n");
+                    failed = 1;
+                }
+            }
+            cgn_set_simd(simd);
+        }
+    }
+    free(buf);
+    free(packed);
+    free(unpacked0);
+    free(unpacked);
+    return failed;
+}
+
+// Histograms counted in parallel with different steps must be the same as counted directly,
+// their statistics must be the same as calculated by other functions
+static int check_histogram(const char *filename, int bpp) {
+    int w, h, offset;
+    uint8_t *buf = read_pgm(filename, &w, &h, &offset);
+    if (!buf) {
+        return 1;
+    }
+    const int parts = 4;
+    uint32_t *data = (uint32_t*)malloc(sizeof(uint32_t)*cgn_histogram_size(bpp, parts));
+    uint32_t *data0 = (uint32_t*)malloc(sizeof(uint32_t)*cgn_histogram_size(bpp, 1));
+    if (!data || !data0) {
+        perror("Unable to allocate histograms");
+        exit(EXIT_FAILURE);
+    }
+    CgnBeamCalc c = { .w = w, .h = h, .bpp = bpp, .buf = buf + offset };
+    CgnBeamBkgnd b;
+    memset(&b, 0, sizeof(CgnBeamBkgnd));
+    b.corner_fraction = 0.035;
+    b.subtract_bkgnd_v = 2;
+    b.ax1 = w / 8, b.ax2 = w - w / 8;
+    b.ay1 = h / 8, b.ay2 = h - h / 8;
+    CgnBeamResult r = { .x1 = b.ax1, .x2 = b.ax2, .y1 = b.ay1, .y2 = b.ay2 };
+    cgn_calc_beam_bkgnd(&c, &b, &r);
+    const double mean0 = b.mean, sdev0 = b.sdev;
+    int failed = 0;
+    cgn_set_threads(parts);
+    for (int step = 1; step <= 3; step++) {
+        CgnHistogram hist = { .step = step, .bkgnd = &b, .parts = parts, .data = data };
+        b.mean = b.sdev = 0;
+        cgn_calc_histogram(&c, &hist);
+        const int bins = hist.bins;
+        memset(data0, 0, sizeof(uint32_t)*bins);
+        int64_t count = 0;
+        double sum = 0, sum_sq = 0;
+        for (int i = 0; i < h; i += step)
+            for (int j = 0; j < w; j += step) {
+                const int v = bpp > 8 ? ((const uint16_t*)c.buf)[i*w + j] : c.buf[i*w + j];
+                data0[v]++;
+                count++;
+                sum += v;
+                sum_sq += (double)v * v;
+            }
+        const double mean = sum / count;
+        const double sdev = sqrt(sum_sq / count - mean * mean);
+        double hist_mean, hist_sdev;
+        cgn_histogram_stats(&hist, &hist_mean, &hist_sdev);
+        const double over = cgn_histogram_overexposure(&hist, 0.5);
+        printf("%s, step=%d: p50=%d, p99=%d, p99.9=%d, overexposed=%.4f, mean=%.2f, sdev=%.2f\n", filename, step,
+            cgn_histogram_percentile(&hist, 0.5), cgn_histogram_percentile(&hist, 0.99),
+            cgn_histogram_percentile(&hist, 0.999), over, hist_mean, hist_sdev);
+        int ok = hist.count == count && memcmp(data, data0, sizeof(uint32_t)*bins) == 0 &&
+            fabs(hist_mean - mean) < 1e-9 * mean && fabs(hist_sdev - sdev) < 1e-6 * sdev;
+        // Corners are only collected when all pixels are counted
+        if (step == 1)
+            ok = ok && b.mean == mean0 && b.sdev == sdev0 && b.corners_ready;
+        else
+            ok = ok && b.mean == 0 && !b.corners_ready;
+        if (step == 2)
+            ok = ok && over == cgn_calc_overexposure(&c, 0.5);
+        b.corners_ready = 0;
+        if (!ok) {
+            printf("FAILED\n");
+            failed = 1;
+        }
+    }
+    cgn_set_threads(0);
+    free(buf);
+    free(data);
+    free(data0);
+    return failed;
+}
+
+// The same as calc_packed_frame_1 with defect pixels patched while unpacking
+static void calc_packed_frame_defects(uint8_t *packed, const CgnBeamCalc *c, const CgnDefects *d, CgnBeamBkgnd *b, CgnBeamResult *r) {
+    CgnFrameStats s = { .overexposure_th = 0.8, .bkgnd = b, .defects = d };
+    cgn_convert_packed_to_u16(packed, c, &s);
+    cgn_calc_beam_bkgnd(c, b, r);
+}
+
+// The same as calc_frame for a calibrated frame
+static void calc_calib_frame(const uint8_t *src, const CgnBeamCalc *c, const CgnCalib *cal, CgnBeamBkgnd *b, CgnBeamResult *r) {
+    cgn_calibrate(src, c, cal);
+    calc_frame(c, b, r);
+}
+
+static int clamp_int(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+// Fixed pattern of the dark frame `k` used by check_calib, values are 4..33 with noise 0..2
+static int dark_pixel(int i, int k) {
+    return 4 + (int)((int64_t)i * 7919 % 29) + (i + k) % 3;
+}
+
+// Pixel response used by check_calib for the flat field, from 0.75 to 1.25 of the mean
+static double flat_response(int i) {
+    return 0.75 + (int)((int64_t)i * 104729 % 11) * 0.05;
+}
+
+// Master frames made of synthetic dark and flat frames must remove the fixed pattern
+// and the pixel response, calibrated frames must be the same with all instruction sets,
+// and packed frames calibrated while unpacking must be the same as calibrated after it
+static int check_calib(const char *filename, int bpp) {
+    int w, h, offset;
+    uint8_t *buf = read_pgm(filename, &w, &h, &offset);
+    if (!buf) {
+        return 1;
+    }
+    const int sz = w*h, frames = 4;
+    const int pixel_size = bpp > 8 ? 2 : 1;
+    uint32_t *sum = (uint32_t*)malloc(sizeof(uint32_t)*sz);
+    uint16_t *dark = (uint16_t*)malloc(sizeof(uint16_t)*sz);
+    float *gain = (float*)malloc(sizeof(float)*sz);
+    uint8_t *frame = (uint8_t*)malloc(sz*2);
+    uint8_t *res0 = (uint8_t*)malloc(sz*2);
+    uint8_t *res = (uint8_t*)malloc(sz*2);
+    uint8_t *packed = (uint8_t*)malloc(sz*2);
+    if (!sum || !dark || !gain || !frame || !res0 || !res || !packed) {
+        perror("Unable to allocate buffers");
+        exit(EXIT_FAILURE);
+    }
+    // 16-bit frames are taken as 12-bit ones to be packed
+    #define CALIB_PIXEL(b, i) (pixel_size == 2 ? ((uint16_t*)(b))[i] : (b)[i])
+    #define CALIB_SET_PIXEL(b, i, v) { if (pixel_size == 2) ((uint16_t*)(b))[i] = (v); else (b)[i] = (v); }
+    const uint16_t *src16 = (const uint16_t*)(buf + offset);
+    CgnBeamCalc c = { .w = w, .h = h, .bpp = bpp > 8 ? 12 : 8, .buf = frame };
+    const int top_c = (1 << c.bpp) - 1;
+    int failed = 0;
+
+    memset(sum, 0, sizeof(uint32_t)*sz);
+    for (int k = 0; k < frames; k++) {
+        for (int i = 0; i < sz; i++)
+            CALIB_SET_PIXEL(frame, i, dark_pixel(i, k));
+        cgn_accumulate(&c, sum, NULL);
+    }
+    const int dark_offset = cgn_calib_make_dark(sum, frames, sz, dark);
+    int ok = 1;
+    int64_t total = 0;
+    for (int i = 0; i < sz; i++) {
+        int s = 0;
+        for (int k = 0; k < frames; k++)
+            s += dark_pixel(i, k);
+        ok = ok && dark[i] == (s + frames/2) / frames;
+        total += dark[i];
+    }
+    ok = ok && dark_offset == (total + sz/2) / sz;
+
+    memset(sum, 0, sizeof(uint32_t)*sz);
+    for (int k = 0; k < frames; k++) {
+        for (int i = 0; i < sz; i++)
+            CALIB_SET_PIXEL(frame, i, dark_pixel(i, k) + lround(top_c * 0.4 * flat_response(i)));
+        cgn_accumulate(&c, sum, NULL);
+    }
+    cgn_calib_make_gain(sum, frames, sz, dark, gain);
+    printf("%s: dark offset=%d, gain=%.3f..%.3f\n", filename, dark_offset, gain[0], gain[1]);
+
+    // Dark subtraction only, it's exact
+    CgnCalib cal = { .dark = dark, .offset = dark_offset };
+    for (int i = 0; i < sz; i++) {
+        const int v = bpp > 8 ? src16[i] >> 4 : buf[offset + i];
+        CALIB_SET_PIXEL(frame, i, clamp_int(v + dark_pixel(i, 0), 0, top_c));
+    }
+    c.buf = res0;
+    cgn_calibrate(frame, &c, &cal);
+    for (int i = 0; i < sz; i++) {
+        const int v = bpp > 8 ? src16[i] >> 4 : buf[offset + i];
+        const int d = dark_pixel(i, 0) - dark[i];
+        const int v0 = clamp_int(v + dark_pixel(i, 0), 0, top_c) - dark[i] + dark_offset;
+        if (CALIB_PIXEL(res0, i) != clamp_int(v0, 0, top_c) || abs(d) > 1)
+            ok = 0;
+    }
+
+    // Calibrated flat frame must be uniform
+    cal.gain = gain;
+    for (int i = 0; i < sz; i++)
+        CALIB_SET_PIXEL(frame, i, dark_pixel(i, 0) + lround(top_c * 0.4 * flat_response(i)));
+    cgn_calibrate(frame, &c, &cal);
+    int flat_min = top_c, flat_max = 0;
+    for (int i = 0; i < sz; i++) {
+        const int v = CALIB_PIXEL(res0, i);
+        if (v < flat_min) flat_min = v;
+        if (v > flat_max) flat_max = v;
+    }
+    printf("%s: calibrated flat frame=%d..%d\n", filename, flat_min, flat_max);
+    ok = ok && flat_max - flat_min <= 2;
+
+    for (int i = 0; i < sz; i++) {
+        const int v = bpp > 8 ? src16[i] >> 4 : buf[offset + i];
+        CALIB_SET_PIXEL(frame, i, clamp_int(v + dark_pixel(i, 1), 0, top_c));
+    }
+    const int simd = cgn_get_simd();
+    for (int with_gain = 0; with_gain <= 1; with_gain++) {
+        cal.gain = with_gain ? gain : NULL;
+        cgn_set_simd(CGN_SIMD_NONE);
+        c.buf = res0;
+        cgn_calibrate(frame, &c, &cal);
+        for (int level = CGN_SIMD_NONE; level <= simd; level++) {
+            cgn_set_simd(level);
+            c.buf = res;
+            cgn_calibrate(frame, &c, &cal);
+            int ok_level = memcmp(res, res0, sz*pixel_size) == 0;
+            // Calibrated in place
+            memcpy(res, frame, sz*pixel_size);
+            cgn_calibrate(res, &c, &cal);
+            ok_level = ok_level && memcmp(res, res0, sz*pixel_size) == 0;
+            if (bpp > 8) {
+                // Packing takes high bits of 16-bit pixels
+                for (int i = 0; i < sz; i++)
+                    ((uint16_t*)res)[i] = ((uint16_t*)frame)[i] << 4;
+                pack_frame((const uint16_t*)res, w, h, w, c.bpp, packed, (uint16_t*)res);
+                CgnFrameStats s = { .overexposure_th = 0.5, .calib = &cal };
+                cgn_convert_packed_to_u16(packed, &c, &s);
+                ok_level = ok_level && memcmp(res, res0, sz*pixel_size) == 0;
+                memset(res, 0, sz*pixel_size);
+                s.x1 = w/4, s.x2 = w - w/4;
+                s.y1 = h/4, s.y2 = h - h/4;
+                cgn_convert_packed_to_u16(packed, &c, &s);
+                for (int i = s.y1; i < s.y2; i++)
+                    for (int j = s.x1; j < s.x2; j++)
+                        if (((uint16_t*)res)[i*w + j] != ((uint16_t*)res0)[i*w + j])
+                            ok_level = 0;
+            }
+            printf("%s, %s, %s\n", filename, with_gain ? "dark and gain" : "dark", cgn_simd_name(level));
+            if (!ok_level)
+                ok = 0;
+        }
+    }
+    cgn_set_simd(simd);
+    #undef CALIB_PIXEL
+    #undef CALIB_SET_PIXEL
+    if (!ok) {
+        printf("FAILED\n");
+        failed = 1;
+    }
+    free(buf);
+    free(sum);
+    free(dark);
+    free(gain);
+    free(frame);
+    free(res0);
+    free(res);
+    free(packed);
+    return failed;
+}
+
+// Every 7919th pixel of check_defects is hot and every 10007th one is stuck
+static int defect_kind(int i) {
+    return i % 7919 == 100 ? 1 : (i % 10007 == 200 ? 2 : 0);
+}
+
+// Defects found in a synthetic dark series must be exactly the planted ones,
+// they must be patched with the median of good neighbours both in a frame
+// and while unpacking a packed frame, where statistics must account patched values
+static int check_defects(const char *filename, int bpp) {
+    int w, h, offset;
+    uint8_t *buf = read_pgm(filename, &w, &h, &offset);
+    if (!buf) {
+        return 1;
+    }
+    const int sz = w*h, frames = CGN_DEFECT_STUCK_FRAMES;
+    uint32_t *sum = (uint32_t*)malloc(sizeof(uint32_t)*sz);
+    uint64_t *sum_sq = (uint64_t*)malloc(sizeof(uint64_t)*sz);
+    uint32_t *hist = (uint32_t*)malloc(sizeof(uint32_t)*CGN_DEFECT_BINS);
+    int32_t *idx = (int32_t*)malloc(sizeof(int32_t)*sz);
+    uint16_t *frame = (uint16_t*)malloc(sizeof(uint16_t)*sz);
+    uint16_t *fixed = (uint16_t*)malloc(sizeof(uint16_t)*sz);
+    uint16_t *unpacked = (uint16_t*)malloc(sizeof(uint16_t)*sz);
+    uint8_t *packed = (uint8_t*)malloc(sz*2);
+    if (!sum || !sum_sq || !hist || !idx || !frame || !fixed || !unpacked || !packed) {
+        perror("Unable to allocate buffers");
+        exit(EXIT_FAILURE);
+    }
+    // Frames are kept in 16-bit buffers, 16-bit frames are taken as 12-bit ones to be packed
+    const int bpp_c = bpp > 8 ? 12 : 8;
+    const int top = (1 << bpp_c) - 1;
+    CgnBeamCalc c = { .w = w, .h = h, .bpp = 16, .buf = (uint8_t*)frame };
+    memset(sum, 0, sizeof(uint32_t)*sz);
+    memset(sum_sq, 0, sizeof(uint64_t)*sz);
+    int planted = 0;
+    for (int k = 0; k < frames; k++) {
+        for (int i = 0; i < sz; i++) {
+            const int kind = defect_kind(i);
+            frame[i] = kind == 1 ? dark_pixel(i, k) + 100 : dark_pixel(i, kind == 2 ? 0 : k);
+            if (k == 0 && kind)
+                planted++;
+        }
+        cgn_accumulate(&c, sum, sum_sq);
+    }
+    const int count = cgn_find_defects(sum, sum_sq, frames, sz, bpp_c, 6, hist, idx, sz);
+    int ok = count == planted;
+    for (int n = 0, i = 0; ok && i < sz; i++)
+        if (defect_kind(i))
+            ok = idx[n++] == i;
+    printf("%s: planted defects=%d, found=%d\n", filename, planted, count);
+    const CgnDefects d = { .idx = idx, .count = count };
+
+    // Defects are overexposed in the frame
+    for (int i = 0; i < sz; i++) {
+        const int v = bpp > 8 ? ((const uint16_t*)(buf + offset))[i] >> 4 : buf[offset + i];
+        frame[i] = defect_kind(i) ? top : v;
+    }
+    memcpy(fixed, frame, sizeof(uint16_t)*sz);
+    c.bpp = bpp_c;
+    if (bpp_c > 8) {
+        c.buf = (uint8_t*)fixed;
+        cgn_fix_defects(&c, &d);
+    } else {
+        c.buf = packed;
+        for (int i = 0; i < sz; i++)
+            packed[i] = frame[i];
+        cgn_fix_defects(&c, &d);
+        for (int i = 0; i < sz; i++)
+            fixed[i] = packed[i];
+    }
+    for (int i = 0; i < sz; i++) {
+        if (!defect_kind(i)) {
+            ok = ok && fixed[i] == frame[i];
+            continue;
+        }
+        int v[8], n = 0;
+        for (int y = i/w - 1; y <= i/w + 1; y++)
+            for (int x = i%w - 1; x <= i%w + 1; x++)
+                if (y >= 0 && y < h && x >= 0 && x < w && !defect_kind(y*w + x)) {
+                    int p = n++;
+                    for (; p > 0 && v[p-1] > frame[y*w + x]; p--)
+                        v[p] = v[p-1];
+                    v[p] = frame[y*w + x];
+                }
+        ok = ok && fixed[i] == (n % 2 ? v[n/2] : (v[n/2-1] + v[n/2] + 1) / 2);
+    }
+
+    if (bpp > 8) {
+        for (int i = 0; i < sz; i++)
+            unpacked[i] = frame[i] << 4;
+        pack_frame(unpacked, w, h, w, bpp_c, packed, unpacked);
+        CgnBeamBkgnd b;
+        memset(&b, 0, sizeof(CgnBeamBkgnd));
+        b.corner_fraction = 0.035;
+        b.subtract_bkgnd_v = 2;
+        b.ax1 = 0, b.ax2 = w;
+        b.ay1 = 0, b.ay2 = h;
+        CgnBeamResult r = { .x1 = 0, .x2 = w, .y1 = 0, .y2 = h };
+        cgn_calc_beam_bkgnd(&c, &b, &r);
+        const double mean = b.mean, sdev = b.sdev;
+        const double over = cgn_calc_overexposure(&c, 0.9);
+        c.buf = (uint8_t*)unpacked;
+        CgnFrameStats s = { .overexposure_th = 0.9, .bkgnd = &b, .defects = &d };
+        cgn_convert_packed_to_u16(packed, &c, &s);
+        printf("%s: overexposed=%.6f, mean=%.4f, sdev=%.4f\n", filename, s.overexposed, b.mean, b.sdev);
+        ok = ok && memcmp(unpacked, fixed, sizeof(uint16_t)*sz) == 0 &&
+            s.overexposed == over && b.mean == mean && b.sdev == sdev && b.corners_ready;
+        // Defects whose neighbours are all inside of the area are patched the same way
+        memset(unpacked, 0, sizeof(uint16_t)*sz);
+        s.x1 = w/4, s.x2 = w - w/4;
+        s.y1 = h/4, s.y2 = h - h/4;
+        cgn_convert_packed_to_u16(packed, &c, &s);
+        for (int i = s.y1 + 1; i < s.y2 - 1; i++)
+            for (int j = s.x1 + 1; j < s.x2 - 1; j++)
+                ok = ok && unpacked[i*w + j] == fixed[i*w + j];
+    }
+    if (!ok) {
+        printf("FAILED\n");
+    }
+    free(buf);
+    free(sum);
+    free(sum_sq);
+    free(hist);
+    free(idx);
+    free(frame);
+    free(fixed);
+    free(unpacked);
+    free(packed);
+    return !ok;
+}
+
+// Dark pixel of check_defects_clipped, a low level with noise of one step that is clipped at 0
+static int clipped_dark_pixel(int i, int k) {
+    uint32_t r = (uint32_t)i * 2654435761u ^ (uint32_t)k * 2246822519u;
+    r = (r ^ (r >> 15)) * 2246822519u;
+    r ^= r >> 13;
+    return clamp_int((int)((int64_t)i * 7919 % 7) - 2 + (int)(r % 3) - 1, 0, 255);
+}
+
+// Low noise 8-bit dark series where many pixels are clipped at 0 or don't change
+// over a short series by chance, neither of them are stuck pixels
+static int check_defects_clipped(int frames) {
+    const int w = 640, h = 480, sz = w*h;
+    uint32_t *sum = (uint32_t*)malloc(sizeof(uint32_t)*sz);
+    uint64_t *sum_sq = (uint64_t*)malloc(sizeof(uint64_t)*sz);
+    uint32_t *hist = (uint32_t*)malloc(sizeof(uint32_t)*CGN_DEFECT_BINS);
+    uint8_t *frame = (uint8_t*)malloc(sz);
+    if (!sum || !sum_sq || !hist || !frame) {
+        perror("Unable to allocate buffers");
+        exit(EXIT_FAILURE);
+    }
+    CgnBeamCalc c = { .w = w, .h = h, .bpp = 8, .buf = frame };
+    memset(sum, 0, sizeof(uint32_t)*sz);
+    memset(sum_sq, 0, sizeof(uint64_t)*sz);
+    int clipped = 0;
+    for (int k = 0; k < frames; k++) {
+        for (int i = 0; i < sz; i++)
+            frame[i] = clipped_dark_pixel(i, k);
+        cgn_accumulate(&c, sum, sum_sq);
+    }
+    for (int i = 0; i < sz; i++)
+        if (sum_sq[i] * frames == (uint64_t)sum[i] * sum[i])
+            clipped++;
+    const int count = cgn_find_defects(sum, sum_sq, frames, sz, 8, 6, hist, NULL, 0);
+    printf("frames=%d: constant pixels=%d, found=%d\n", frames, clipped, count);
+    const int ok = count == 0;
+    if (!ok) {
+        printf("FAILED\n");
+    }
+    free(sum);
+    free(sum_sq);
+    free(hist);
+    free(frame);
+    return !ok;
+}
+
+// Frame `k` of check_stack, the image with noise varying over frames
+static int stack_pixel(const uint8_t *buf, int offset, int bpp, int i, int k) {
+    const int v = bpp > 8 ? ((const uint16_t*)(buf + offset))[i] : buf[offset + i];
+    return clamp_int(v + (i + k) % 3 + (k % 2 ? 1 : -1) * (i % 5), 0, bpp > 8 ? 65535 : 255);
+}
+
+// Averages of the stack must be the rounded means of the last frames with all instruction sets,
+// running sums must stay exact while the ring wraps around
+static int check_stack(const char *filename, int bpp) {
+    int w, h, offset;
+    uint8_t *buf = read_pgm(filename, &w, &h, &offset);
+    if (!buf) {
+        return 1;
+    }
+    const int sz = w*h, frames = 5, total = 12;
+    const int pixel_size = bpp > 8 ? 2 : 1;
+    uint8_t *ring = (uint8_t*)malloc(sz*pixel_size*frames);
+    uint32_t *sum = (uint32_t*)malloc(sizeof(uint32_t)*sz);
+    uint8_t *frame = (uint8_t*)malloc(sz*pixel_size);
+    uint8_t *res0 = (uint8_t*)malloc(sz*pixel_size);
+    uint8_t *res = (uint8_t*)malloc(sz*pixel_size);
+    if (!ring || !sum || !frame || !res0 || !res) {
+        perror("Unable to allocate buffers");
+        exit(EXIT_FAILURE);
+    }
+    #define STACK_PIXEL(b, i) (pixel_size == 2 ? ((uint16_t*)(b))[i] : (b)[i])
+    CgnBeamCalc c = { .w = w, .h = h, .bpp = bpp };
+    CgnStack st = { .frames = frames, .ring = ring, .sum = sum };
+    const int simd = cgn_get_simd();
+    int ok = 1;
+    for (int level = CGN_SIMD_NONE; level <= simd; level++) {
+        cgn_set_simd(level);
+        cgn_stack_reset(&st, &c);
+        int ok_level = 1;
+        double max_err = 0;
+        for (int k = 0; k < total; k++) {
+            for (int i = 0; i < sz; i++) {
+                const int v = stack_pixel(buf, offset, bpp, i, k);
+                if (pixel_size == 2) ((uint16_t*)frame)[i] = v; else frame[i] = v;
+            }
+            c.buf = frame;
+            cgn_stack_add(&st, &c);
+            // Partially filled and wrapped around rings
+            if (k != 2 && k != total-1)
+                continue;
+            c.buf = res;
+            cgn_stack_average(&st, &c);
+            for (int i = 0; i < sz; i++) {
+                uint32_t s = 0;
+                for (int kk = k - st.count + 1; kk <= k; kk++)
+                    s += stack_pixel(buf, offset, bpp, i, kk);
+                const double err = fabs(STACK_PIXEL(res, i) - (double)s / st.count);
+                if (err > max_err) max_err = err;
+                ok_level = ok_level && sum[i] == s;
+            }
+        }
+        // Sums are exact in floats, only the product can be off by a bit
+        ok_level = ok_level && st.count == frames && max_err < 0.51;
+        if (level == CGN_SIMD_NONE)
+            memcpy(res0, res, sz*pixel_size);
+        else
+            ok_level = ok_level && memcmp(res, res0, sz*pixel_size) == 0;
+        printf("%s, %s: max error=%.3f\n", filename, cgn_simd_name(level), max_err);
+        if (!ok_level)
+            ok = 0;
+    }
+    cgn_set_simd(simd);
+    #undef STACK_PIXEL
+    if (!ok) {
+        printf("FAILED\n");
+    }
+    free(buf);
+    free(ring);
+    free(sum);
+    free(frame);
+    free(res0);
+    free(res);
+    return !ok;
+}
+
+// Binned frames must hold exact sums of blocks, truncated to the binned bit depth,
+// with all instruction sets and with widths not divisible by the factor
+static int check_binning(const char *filename, int bpp) {
+    int w, h, offset;
+    uint8_t *buf = read_pgm(filename, &w, &h, &offset);
+    if (!buf) {
+        return 1;
+    }
+    const int pixel_size = bpp > 8 ? 2 : 1;
+    uint8_t *src = (uint8_t*)malloc(w*h*pixel_size);
+    uint16_t *res = (uint16_t*)malloc(sizeof(uint16_t)*w*h);
+    if (!src || !res) {
+        perror("Unable to allocate buffers");
+        exit(EXIT_FAILURE);
+    }
+    #define SRC_PIXEL(i) (pixel_size == 2 ? ((const uint16_t*)(buf + offset))[i] : buf[offset + (i)])
+    const int simd = cgn_get_simd();
+    int ok = 1;
+    for (int crop = 0; crop <= 3; crop += 3) {
+        // Cropped copy makes the width odd and leaves a partial block at the right and bottom
+        const int sw = w - crop, sh = h - crop/3;
+        for (int i = 0; i < sh; i++)
+            memcpy(src + i*sw*pixel_size, buf + offset + i*w*pixel_size, sw*pixel_size);
+        for (int k = 2; k <= CGN_MAX_BINNING; k *= 2) {
+            const int dbpp = cgn_binned_bpp(bpp, k);
+            int bits = 0;
+            while ((1 << bits) < k*k) bits++;
+            const int shift = bpp + bits - dbpp;
+            CgnBeamCalc s = { .w = sw, .h = sh, .bpp = bpp, .buf = src };
+            CgnBeamCalc d = { .w = sw/k, .h = sh/k, .bpp = dbpp, .buf = (uint8_t*)res };
+            for (int level = CGN_SIMD_NONE; level <= simd; level++) {
+                cgn_set_simd(level);
+                memset(res, 0xff, sizeof(uint16_t)*w*h);
+                cgn_bin_frame(&s, &d, k);
+                int errors = 0;
+                for (int i = 0; i < d.h; i++) {
+                    for (int j = 0; j < d.w; j++) {
+                        uint32_t v = 0;
+                        for (int ii = i*k; ii < i*k + k; ii++)
+                            for (int jj = j*k; jj < j*k + k; jj++)
+                                v += SRC_PIXEL(ii*w + jj);
+                        if (res[i*d.w + j] != (v >> shift))
+                            errors++;
+                    }
+                }
+                printf("%s, %dx%d, %dx%d, %s: bpp=%d, errors=%d\n",
+                    filename, sw, sh, k, k, cgn_simd_name(level), dbpp, errors);
+                if (errors)
+                    ok = 0;
+            }
+        }
+    }
+    cgn_set_simd(simd);
+    #undef SRC_PIXEL
+    if (!ok) {
+        printf("FAILED\n");
+    }
+    free(buf);
+    free(src);
+    free(res);
+    return !ok;
+}
+
+#define SPOTS_GX 14
+#define SPOTS_GY 10
+#define sqr(x) ((x)*(x))
+
+// Frame of check_spots: a grid of Gaussian spots of different sizes and amplitudes shifted by (dx, dy)
+// on a noisy background, and a few components whose parts are joined late.
+// The spot `skip` is not drawn.
+static void render_spots(uint8_t *buf, int w, int h, int bpp, double dx, double dy, int skip) {
+    const int top = (1 << bpp) - 1;
+    const double k = top / 255.0;
+    int *v = (int*)malloc(sizeof(int)*w*h);
+    if (!v) {
+        perror("Unable to allocate buffer");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < w*h; i++)
+        v[i] = (int)(k * (12 + (int)((int64_t)i * 7919 % 13)));
+    for (int n = 0; n < SPOTS_GX*SPOTS_GY; n++) {
+        if (n == skip)
+            continue;
+        const double cx = 24 + (n % SPOTS_GX) * 40 + dx + (n % 3) * 0.3;
+        const double cy = 24 + (n / SPOTS_GX) * 40 + dy + (n % 7) * 0.2;
+        const double sigma = 1.5 + (n % 4) * 0.8;
+        const double amp = top * (0.4 + 0.1 * (n % 6));
+        for (int y = (int)(cy - 4*sigma); y <= (int)(cy + 4*sigma); y++)
+            for (int x = (int)(cx - 4*sigma); x <= (int)(cx + 4*sigma); x++)
+                v[y*w + x] += (int)(amp * exp(-(sqr(x - cx) + sqr(y - cy)) / (2 * sqr(sigma))));
+    }
+    // U shapes open to the top and bottom, and a comb with teeth joined at the bottom
+    const int y0 = 24 + SPOTS_GY * 40;
+    for (int y = y0; y < y0 + 30; y++) {
+        for (int x = 20; x < 50; x++)
+            if (y >= y0 + 25 || x < 24 || x >= 46) v[y*w + x] += top/2;
+        for (int x = 70; x < 100; x++)
+            if (y < y0 + 5 || x < 74 || x >= 96) v[y*w + x] += top/2;
+    }
+    for (int y = y0; y < y0 + 30; y++)
+        for (int x = 130; x < 190; x++)
+            if (y >= y0 + 27 || x % 6 < 2) v[y*w + x] += top/2;
+    for (int i = 0; i < w*h; i++) {
+        const int p = clamp_int(v[i], 0, top);
+        if (bpp > 8) ((uint16_t*)buf)[i] = p; else buf[i] = p;
+    }
+    free(v);
+}
+
+// Components of pixels above `th` found by flood fill, in raster order of their first pixels
+static int naive_spots(const CgnBeamCalc *c, int x1, int y1, int x2, int y2, int th, int min_area,
+    CgnBeamResult *res, int max_res, double *bkgnd)
+{
+    const int w = c->w;
+    #define NAIVE_PIXEL(i) (c->bpp > 8 ? ((const uint16_t*)c->buf)[i] : c->buf[i])
+    uint8_t *seen = (uint8_t*)calloc(w*c->h, 1);
+    int *stack = (int*)malloc(sizeof(int)*w*c->h);
+    if (!seen || !stack) {
+        perror("Unable to allocate buffers");
+        exit(EXIT_FAILURE);
+    }
+    double bsum = 0, bcount = 0;
+    for (int y = y1; y < y2; y++)
+        for (int x = x1; x < x2; x++)
+            if (NAIVE_PIXEL(y*w + x) <= th)
+                bsum += NAIVE_PIXEL(y*w + x), bcount++;
+    *bkgnd = bcount > 0 ? bsum / bcount : 0;
+    int count = 0;
+    for (int y = y1; y < y2; y++) {
+        for (int x = x1; x < x2; x++) {
+            if (seen[y*w + x] || NAIVE_PIXEL(y*w + x) <= th)
+                continue;
+            double n = 0, sx = 0, sy = 0, sxx = 0, syy = 0, sxy = 0;
+            double p = 0, px = 0, py = 0, pxx = 0, pyy = 0, pxy = 0;
+            int bx1 = x, bx2 = x + 1, by1 = y, by2 = y + 1;
+            int top = 0;
+            stack[top++] = y*w + x;
+            seen[y*w + x] = 1;
+            while (top > 0) {
+                const int i = stack[--top];
+                const int xi = i % w, yi = i / w;
+                const double v = NAIVE_PIXEL(i);
+                n++, sx += xi, sy += yi, sxx += xi*xi, syy += yi*yi, sxy += xi*yi;
+                p += v, px += v*xi, py += v*yi, pxx += v*xi*xi, pyy += v*yi*yi, pxy += v*xi*yi;
+                if (xi < bx1) bx1 = xi;
+                if (xi >= bx2) bx2 = xi + 1;
+                if (yi >= by2) by2 = yi + 1;
+                for (int yy = yi - 1; yy <= yi + 1; yy++)
+                    for (int xx = xi - 1; xx <= xi + 1; xx++)
+                        if (xx >= x1 && xx < x2 && yy >= y1 && yy < y2
+                                && !seen[yy*w + xx] && NAIVE_PIXEL(yy*w + xx) > th) {
+                            seen[yy*w + xx] = 1;
+                            stack[top++] = yy*w + xx;
+                        }
+            }
+            if (n < min_area || count == max_res)
+                continue;
+            const double b = *bkgnd;
+            CgnBeamResult *r = res + count++;
+            memset(r, 0, sizeof(CgnBeamResult));
+            r->x1 = bx1, r->x2 = bx2, r->y1 = by1, r->y2 = by2;
+            r->p = p - b*n;
+            r->xc = (px - b*sx) / r->p;
+            r->yc = (py - b*sy) / r->p;
+            r->xx = (pxx - b*sxx) / r->p - r->xc*r->xc;
+            r->yy = (pyy - b*syy) / r->p - r->yc*r->yc;
+            r->xy = (pxy - b*sxy) / r->p - r->xc*r->yc;
+        }
+    }
+    #undef NAIVE_PIXEL
+    free(seen);
+    free(stack);
+    return count;
+}
+
+// Spots must be the same as found by flood fill with all instruction sets, inside of an area too,
+// and keep their slots when they move between frames
+static int check_spots(int bpp) {
+    const int w = 640, h = 520, max_labels = 4096, max_spots = 512;
+    const int pixel_size = bpp > 8 ? 2 : 1;
+    uint8_t *buf = (uint8_t*)malloc(w*h*pixel_size);
+    int32_t *parent = (int32_t*)malloc(sizeof(int32_t)*(max_labels+1));
+    CgnSpotMoments *moments = (CgnSpotMoments*)malloc(sizeof(CgnSpotMoments)*(max_labels+1));
+    int32_t *runs = (int32_t*)malloc(sizeof(int32_t)*cgn_spots_runs_size(w));
+    CgnBeamResult *spots = (CgnBeamResult*)malloc(sizeof(CgnBeamResult)*max_spots);
+    CgnBeamResult *spots0 = (CgnBeamResult*)malloc(sizeof(CgnBeamResult)*max_spots);
+    CgnBeamResult *naive = (CgnBeamResult*)malloc(sizeof(CgnBeamResult)*max_spots);
+    int *slot_of_spot = (int*)malloc(sizeof(int)*max_spots);
+    int *spot_of_slot = (int*)malloc(sizeof(int)*max_spots);
+    if (!buf || !parent || !moments || !runs || !spots || !spots0 || !naive || !slot_of_spot || !spot_of_slot) {
+        perror("Unable to allocate buffers");
+        exit(EXIT_FAILURE);
+    }
+    render_spots(buf, w, h, bpp, 0, 0, -1);
+    CgnBeamCalc c = { .w = w, .h = h, .bpp = bpp, .buf = buf };
+    const int areas[2][4] = { { 0, 0, 0, 0 }, { 61, 33, 517, 290 } };
+    const int simd = cgn_get_simd();
+    int ok = 1;
+    for (int a = 0; a < 2; a++) {
+        const int x1 = areas[a][0], y1 = areas[a][1];
+        const int x2 = areas[a][2] ? areas[a][2] : w, y2 = areas[a][3] ? areas[a][3] : h;
+        int count0 = 0;
+        for (int level = CGN_SIMD_NONE; level <= simd; level++) {
+            cgn_set_simd(level);
+            CgnSpots s = {
+                .x1 = areas[a][0], .y1 = areas[a][1], .x2 = areas[a][2], .y2 = areas[a][3],
+                .level = 0.3, .min_area = 3, .subtract = 1,
+                .max_labels = max_labels, .parent = parent, .moments = moments, .runs = runs,
+                .max_spots = max_spots, .spots = spots,
+            };
+            // The second call takes the threshold from the first one
+            cgn_find_spots(&c, &s);
+            const int th1 = s.th;
+            const int count = cgn_find_spots(&c, &s);
+            double bkgnd;
+            const int naive_count = naive_spots(&c, x1, y1, x2, y2, s.th, s.min_area, naive, max_spots, &bkgnd);
+            double max_err = 0;
+            int boxes = 1;
+            for (int i = 0; i < count && i < naive_count; i++) {
+                const CgnBeamResult *r = spots + i, *q = naive + i;
+                max_err = fmax(max_err, fabs(r->xc - q->xc));
+                max_err = fmax(max_err, fabs(r->yc - q->yc));
+                max_err = fmax(max_err, fabs(r->xx - q->xx));
+                max_err = fmax(max_err, fabs(r->yy - q->yy));
+                max_err = fmax(max_err, fabs(r->xy - q->xy));
+                boxes = boxes && r->x1 == q->x1 && r->x2 == q->x2 && r->y1 == q->y1 && r->y2 == q->y2;
+            }
+            int ok_level = count == naive_count && !s.overflow && boxes && max_err < 1e-6
+                && fabs(s.bkgnd - bkgnd) < 1e-9;
+            if (level == CGN_SIMD_NONE) {
+                memcpy(spots0, spots, sizeof(CgnBeamResult)*count);
+                count0 = count;
+            } else {
+                ok_level = ok_level && count == count0 && memcmp(spots, spots0, sizeof(CgnBeamResult)*count) == 0;
+            }
+            printf("%d bit, area %d, %s: th=%d/%d, bkgnd=%.2f, spots=%d, naive=%d, max error=%.1e%s\n",
+                bpp, a, cgn_simd_name(level), th1, s.th, s.bkgnd, count, naive_count, max_err, boxes ? "" : ", boxes differ");
+            if (!ok_level)
+                ok = 0;
+        }
+    }
+    cgn_set_simd(simd);
+
+    // The frame with moved spots and without one of them, every component should get the slot it had
+    // in the first frame, the U shapes and comb stay in place
+    CgnSpots s = {
+        .level = 0.3, .min_area = 3, .subtract = 1,
+        .max_labels = max_labels, .parent = parent, .moments = moments, .runs = runs,
+        .max_spots = max_spots, .spots = spots0,
+    };
+    const int slot_count = cgn_find_spots(&c, &s);
+    const double dx = 1.3, dy = -0.7;
+    render_spots(buf, w, h, bpp, dx, dy, 17);
+    s.spots = spots;
+    const int count = cgn_find_spots(&c, &s);
+    cgn_match_spots(spots0, slot_count, spots, count, slot_of_spot, spot_of_slot);
+    int matched = 0, lost = 0, wrong = 0;
+    for (int i = 0; i < count; i++) {
+        int expected = -1;
+        for (int j = 0; j < slot_count; j++)
+            for (int moved = 0; moved < 2; moved++)
+                if (fabs(spots0[j].xc + moved*dx - spots[i].xc) < 0.5 && fabs(spots0[j].yc + moved*dy - spots[i].yc) < 0.5)
+                    expected = j;
+        if (slot_of_spot[i] == expected) matched++; else wrong++;
+    }
+    for (int j = 0; j < slot_count; j++)
+        if (spot_of_slot[j] < 0) lost++;
+    printf("%d bit, moved: slots=%d, spots=%d, matched=%d, wrong=%d, lost slots=%d\n",
+        bpp, slot_count, count, matched, wrong, lost);
+    if (count != slot_count - 1 || wrong || lost != 1)
+        ok = 0;
+
+    // Out of labels, the rest of components is merged into the unlabeled background
+    s.max_labels = 16;
+    const int overflow_count = cgn_find_spots(&c, &s);
+    printf("%d bit, 16 labels: spots=%d, overflow=%d\n", bpp, overflow_count, s.overflow);
+    if (!s.overflow || overflow_count > 16)
+        ok = 0;
+
+    if (!ok) {
+        printf("FAILED\n");
+    }
+    free(buf);
+    free(parent);
+    free(moments);
+    free(runs);
+    free(spots);
+    free(spots0);
+    free(naive);
+    free(slot_of_spot);
+    free(spot_of_slot);
+    return !ok;
+}
+
 int main() {
+    int failed = 0;
+    const int simd = cgn_init_simd();
+    printf("SIMD: %s\n", cgn_simd_name(simd));
+    printf("Threads: %d\n\n", cgn_get_threads());
+
     int w, h, offset8;
     uint8_t *buf8 = read_pgm(FILENAME_8, &w, &h, &offset8);
     if (!buf8) {
@@ -150,15 +1317,24 @@ int main() {
         c.w = w;
         c.h = h;
 
+        CgnBeamResult r0;
+
         c.bpp = 8;
         c.buf = buf8+offset8;
         MEASURE("naive_8", cgn_calc_beam_naive(&c, &r));
+        r0 = r;
+        MEASURE("naive_1_8", cgn_calc_beam_naive_1(&c, &r));
+        CHECK_DIFF(r0, r, 1e-6);
 
         c.bpp = 16;
         c.buf = buf16+offset16;
         MEASURE("naive_16", cgn_calc_beam_naive(&c, &r));
+        r0 = r;
+        MEASURE("naive_1_16", cgn_calc_beam_naive_1(&c, &r));
+        CHECK_DIFF(r0, r, 1e-6);
 
         CgnBeamBkgnd b;
+        memset(&b, 0, sizeof(CgnBeamBkgnd));
         //b.max_iter = 25;
         b.max_iter = 0;
         //b.precision = 0.001;
@@ -179,13 +1355,438 @@ int main() {
         MEASURE("bkgnd_8", cgn_calc_beam_bkgnd(&c, &b, &r));
         printf("mean=%.2f, sdev=%.2f, min=%.2f, max=%.2f, iters=%d\n", b.mean, b.sdev, b.min, b.max, b.iters);
 
+        r0 = r;
+        b.calc_beam_v = 1;
+        MEASURE("bkgnd_1_8", cgn_calc_beam_bkgnd(&c, &b, &r));
+        CHECK_DIFF(r0, r, 1e-6);
+        b.calc_beam_v = 0;
+
         c.bpp = 16;
         c.buf = buf16+offset16;
         MEASURE("bkgnd_16", cgn_calc_beam_bkgnd(&c, &b, &r));
         printf("mean=%.2f, sdev=%.2f, min=%.2f, max=%.2f, iters=%d\n", b.mean, b.sdev, b.min, b.max, b.iters);
+        r0 = r;
+        b.calc_beam_v = 1;
+        MEASURE("bkgnd_1_16", cgn_calc_beam_bkgnd(&c, &b, &r));
+        CHECK_DIFF(r0, r, 1e-6);
+        b.calc_beam_v = 0;
+
+        // Single precision `subtracted`
+        float *subtracted_f32 = (float*)malloc(sizeof(float)*w*h);
+        if (!subtracted_f32) {
+            perror("Unable to allocate floats");
+            exit(EXIT_FAILURE);
+        }
+        c.bpp = 8;
+        c.buf = buf8+offset8;
+        b.calc_beam_v = 1;
+        MEASURE("bkgnd_1_8", cgn_calc_beam_bkgnd(&c, &b, &r));
+        r0 = r;
+        b.subtracted_f32 = subtracted_f32;
+        MEASURE("bkgnd_1_8 (f32)", cgn_calc_beam_bkgnd(&c, &b, &r));
+        PRINT_DIFF(r0, r);
+        b.subtracted_f32 = NULL;
+        c.bpp = 16;
+        c.buf = buf16+offset16;
+        MEASURE("bkgnd_1_16", cgn_calc_beam_bkgnd(&c, &b, &r));
+        r0 = r;
+        b.subtracted_f32 = subtracted_f32;
+        MEASURE("bkgnd_1_16 (f32)", cgn_calc_beam_bkgnd(&c, &b, &r));
+        PRINT_DIFF(r0, r);
+        b.subtracted_f32 = NULL;
+        b.calc_beam_v = 0;
+        free(subtracted_f32);
+
+        // Background subtracted on the fly, without writing `subtracted`
+        c.bpp = 8;
+        c.buf = buf8+offset8;
+        b.calc_beam_v = 1;
+        MEASURE("bkgnd_1_8", cgn_calc_beam_bkgnd(&c, &b, &r));
+        r0 = r;
+        b.subtract_bkgnd_v = 2;
+        MEASURE("bkgnd_1_8 (fused)", cgn_calc_beam_bkgnd(&c, &b, &r));
+        printf("mean=%.2f, sdev=%.2f, min=%.2f, max=%.2f, iters=%d\n", b.mean, b.sdev, b.min, b.max, b.iters);
+        CHECK_DIFF(r0, r, 0);
+        c.bpp = 16;
+        c.buf = buf16+offset16;
+        b.subtract_bkgnd_v = 0;
+        MEASURE("bkgnd_1_16", cgn_calc_beam_bkgnd(&c, &b, &r));
+        r0 = r;
+        b.subtract_bkgnd_v = 2;
+        MEASURE("bkgnd_1_16 (fused)", cgn_calc_beam_bkgnd(&c, &b, &r));
+        printf("mean=%.2f, sdev=%.2f, min=%.2f, max=%.2f, iters=%d\n", b.mean, b.sdev, b.min, b.max, b.iters);
+        CHECK_DIFF(r0, r, 0);
+
+        // Initial position from the decimated frame and from the previous result,
+        // iterations stop when the width changes less than `precision` of it,
+        // so results started from another position only agree within that
+        uint16_t *decimated = (uint16_t*)malloc(sizeof(uint16_t)*cgn_decimated_size(w, h, 2));
+        if (!decimated) {
+            perror("Unable to allocate decimated buffer");
+            exit(EXIT_FAILURE);
+        }
+        b.decimated = decimated;
+        b.max_iter = 25;
+        b.precision = 0.001;
+        for (int k = 2; k <= 8; k *= 2) {
+            b.decimate = k;
+            c.bpp = 8;
+            c.buf = buf8+offset8;
+            cgn_calc_beam_bkgnd(&c, &b, &r0);
+            printf("\ndecimate=%d", k);
+            MEASURE("bkgnd_1_8 (fused, seeded)", cgn_calc_beam_bkgnd(&c, &b, &r));
+            b.decimate = 0;
+            cgn_calc_beam_bkgnd(&c, &b, &r0);
+            CHECK_DIFF(r0, r, b.precision * fmin(r0.dx, r0.dy));
+            b.decimate = k;
+            c.bpp = 16;
+            c.buf = buf16+offset16;
+            MEASURE("bkgnd_1_16 (fused, seeded)", cgn_calc_beam_bkgnd(&c, &b, &r));
+            b.decimate = 0;
+            cgn_calc_beam_bkgnd(&c, &b, &r0);
+            CHECK_DIFF(r0, r, b.precision * fmin(r0.dx, r0.dy));
+        }
+
+        // Iterations started from the previous result
+        CgnBeamResult rt;
+        for (int bpp = 8; bpp <= 16; bpp += 8) {
+            c.bpp = bpp;
+            c.buf = bpp == 8 ? buf8+offset8 : buf16+offset16;
+            cgn_calc_beam_bkgnd(&c, &b, &r0);
+            b.track = &r;
+            if (bpp == 8)
+                MEASURE("bkgnd_1_8 (fused, tracked)", cgn_calc_beam_bkgnd(&c, &b, &r))
+            else
+                MEASURE("bkgnd_1_16 (fused, tracked)", cgn_calc_beam_bkgnd(&c, &b, &r))
+            printf("iters=%d\n", b.iters);
+            CHECK_DIFF(r0, r, b.precision * fmin(r0.dx, r0.dy));
+            // Previous beam is too far, should fall back to the full aperture
+            rt = r0;
+            rt.xc += r0.dx;
+            b.track = &rt;
+            cgn_calc_beam_bkgnd(&c, &b, &r);
+            printf("jump ");
+            CHECK_DIFF(r0, r, 0);
+            b.track = NULL;
+        }
+        b.decimated = NULL;
+        b.decimate = 0;
+        b.max_iter = 0;
+        b.precision = 0.05;
+        free(decimated);
+        b.subtract_bkgnd_v = 0;
+        b.calc_beam_v = 0;
+
+        // Every instruction set supported by the CPU against scalar kernels
+        b.calc_beam_v = 1;
+        for (int v = 0; v <= 1; v++) {
+            b.subtract_bkgnd_v = v;
+            for (int bpp = 8; bpp <= 16; bpp += 8) {
+                c.bpp = bpp;
+                c.buf = bpp == 8 ? buf8+offset8 : buf16+offset16;
+                cgn_set_simd(CGN_SIMD_NONE);
+                cgn_calc_beam_bkgnd(&c, &b, &r0);
+                for (int level = CGN_SIMD_SSE42; level <= simd; level++) {
+                    cgn_set_simd(level);
+                    printf("\nsubtract_bkgnd_v=%d, %s", v, cgn_simd_name(level));
+                    if (bpp == 8)
+                        MEASURE("bkgnd_1_8", cgn_calc_beam_bkgnd(&c, &b, &r))
+                    else
+                        MEASURE("bkgnd_1_16", cgn_calc_beam_bkgnd(&c, &b, &r))
+                    CHECK_DIFF(r0, r, 1e-6);
+                }
+            }
+        }
+        cgn_set_simd(simd);
+        b.subtract_bkgnd_v = 0;
+        b.calc_beam_v = 0;
+
+        b.max_iter = 25;
+        b.precision = 0.001;
+        printf("\nmax_iter=%d, precision=%.3f\n", b.max_iter, b.precision);
+        c.bpp = 8;
+        c.buf = buf8+offset8;
+        b.calc_beam_v = 1;
+        MEASURE("bkgnd_1_8", cgn_calc_beam_bkgnd(&c, &b, &r));
+        printf("iters=%d\n", b.iters);
+        r0 = r;
+        double *sat = (double*)malloc(sizeof(double)*cgn_sat_size(w, h));
+        if (!sat) {
+            perror("Unable to allocate summed-area tables");
+            exit(EXIT_FAILURE);
+        }
+        b.sat = sat;
+        b.calc_beam_v = 2;
+        MEASURE("bkgnd_2_8", cgn_calc_beam_bkgnd(&c, &b, &r));
+        printf("iters=%d\n", b.iters);
+        PRINT_DIFF(r0, r);
+        b.subtract_bkgnd_v = 2;
+        MEASURE("bkgnd_2_8 (fused)", cgn_calc_beam_bkgnd(&c, &b, &r));
+        PRINT_DIFF(r0, r);
+        b.subtract_bkgnd_v = 0;
+        c.bpp = 16;
+        c.buf = buf16+offset16;
+        b.calc_beam_v = 1;
+        MEASURE("bkgnd_1_16", cgn_calc_beam_bkgnd(&c, &b, &r));
+        r0 = r;
+        b.calc_beam_v = 2;
+        MEASURE("bkgnd_2_16", cgn_calc_beam_bkgnd(&c, &b, &r));
+        PRINT_DIFF(r0, r);
+        b.subtract_bkgnd_v = 2;
+        MEASURE("bkgnd_2_16 (fused)", cgn_calc_beam_bkgnd(&c, &b, &r));
+        PRINT_DIFF(r0, r);
+        b.subtract_bkgnd_v = 0;
+        b.calc_beam_v = 0;
+        b.sat = NULL;
+        free(sat);
+
+        // Packed 10 and 12-bit frames should cost about the same as 8-bit ones
+        uint8_t *packed = (uint8_t*)malloc(w*h*2);
+        uint16_t *unpacked = (uint16_t*)malloc(sizeof(uint16_t)*w*h);
+        if (!packed || !unpacked) {
+            perror("Unable to allocate packed buffers");
+            exit(EXIT_FAILURE);
+        }
+        b.subtract_bkgnd_v = 2;
+        b.calc_beam_v = 1;
+        c.bpp = 8;
+        c.buf = buf8+offset8;
+        MEASURE("stats, bkgnd_1_8 (fused)", calc_frame(&c, &b, &r));
+        for (int bpp = 10; bpp <= 12; bpp += 2) {
+            pack_frame((const uint16_t*)(buf16+offset16), w, h, w, bpp, packed, unpacked);
+            c.bpp = bpp;
+            c.buf = (uint8_t*)unpacked;
+            printf("\nbpp=%d", bpp);
+            MEASURE("unpack, stats, bkgnd_1_16 (fused)", calc_packed_frame(packed, &c, &b, &r));
+            r0 = r;
+            MEASURE("unpack with stats, bkgnd_1_16 (fused)", calc_packed_frame_1(packed, &c, NULL, &b, &r));
+            PRINT_DIFF(r0, r);
+            // A quarter of the frame around the beam
+            b.ax1 = w*3/8, b.ax2 = w*3/8 + w/2;
+            b.ay1 = h*2/8, b.ay2 = h*2/8 + h/2;
+            r.x1 = b.ax1, r.x2 = b.ax2;
+            r.y1 = b.ay1, r.y2 = b.ay2;
+            calc_packed_frame(packed, &c, &b, &r0);
+            MEASURE("unpack aperture with stats, bkgnd_1_16 (fused)", calc_packed_frame_1(packed, &c, NULL, &b, &r));
+            PRINT_DIFF(r0, r);
+            b.ax1 = 0, b.ax2 = w;
+            b.ay1 = 0, b.ay2 = h;
+            r.x1 = 0, r.x2 = w;
+            r.y1 = 0, r.y2 = h;
+        }
+
+        // Calibration costs about the same as reading the frame once more
+        uint16_t *dark = (uint16_t*)malloc(sizeof(uint16_t)*w*h);
+        float *gain = (float*)malloc(sizeof(float)*w*h);
+        uint8_t *calibrated = (uint8_t*)malloc(w*h);
+        if (!dark || !gain || !calibrated) {
+            perror("Unable to allocate calibration buffers");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < w*h; i++) {
+            dark[i] = dark_pixel(i, 0);
+            gain[i] = 1.0 / flat_response(i);
+        }
+        CgnCalib cal = { .dark = dark, .offset = 19 };
+        c.bpp = 8;
+        c.buf = calibrated;
+        printf("\n");
+        MEASURE("calib dark, stats, bkgnd_1_8 (fused)", calc_calib_frame(buf8+offset8, &c, &cal, &b, &r));
+        cal.gain = gain;
+        MEASURE("calib dark and gain, stats, bkgnd_1_8 (fused)", calc_calib_frame(buf8+offset8, &c, &cal, &b, &r));
+        for (int bpp = 10; bpp <= 12; bpp += 2) {
+            pack_frame((const uint16_t*)(buf16+offset16), w, h, w, bpp, packed, unpacked);
+            c.bpp = bpp;
+            c.buf = (uint8_t*)unpacked;
+            printf("\nbpp=%d", bpp);
+            cal.gain = NULL;
+            MEASURE("unpack with calib dark and stats, bkgnd_1_16 (fused)", calc_packed_frame_1(packed, &c, &cal, &b, &r));
+            cal.gain = gain;
+            MEASURE("unpack with calib dark and gain and stats, bkgnd_1_16 (fused)", calc_packed_frame_1(packed, &c, &cal, &b, &r));
+        }
+
+        // Patching defects costs by their number, not by the frame size
+        int32_t *defect_idx = (int32_t*)malloc(sizeof(int32_t)*(w*h/7919 + 1));
+        CgnDefects defects = { .idx = defect_idx };
+        for (int i = 0; i < w*h; i++)
+            if (defect_kind(i) == 1)
+                defect_idx[defects.count++] = i;
+        c.bpp = 8;
+        c.buf = calibrated;
+        memcpy(calibrated, buf8+offset8, w*h);
+        printf("\ndefects=%d", defects.count);
+        MEASURE("fix_defects_8", cgn_fix_defects(&c, &defects));
+        c.bpp = 12;
+        c.buf = (uint8_t*)unpacked;
+        MEASURE("unpack with defects and stats, bkgnd_1_16 (fused)", calc_packed_frame_defects(packed, &c, &defects, &b, &r));
+        free(defect_idx);
+
+        // Stacking costs the same for any number of frames
+        const int stack_frames = 16;
+        uint8_t *stack_ring = (uint8_t*)malloc(w*h*2*stack_frames);
+        uint32_t *stack_sum = (uint32_t*)malloc(sizeof(uint32_t)*w*h);
+        if (!stack_ring || !stack_sum) {
+            perror("Unable to allocate stack buffers");
+            exit(EXIT_FAILURE);
+        }
+        CgnStack stack = { .frames = stack_frames, .ring = stack_ring, .sum = stack_sum };
+        c.bpp = 8;
+        c.buf = calibrated;
+        memcpy(calibrated, buf8+offset8, w*h);
+        cgn_stack_reset(&stack, &c);
+        printf("\nstack frames=%d", stack_frames);
+        MEASURE("stack_add_8", cgn_stack_add(&stack, &c));
+        MEASURE("stack_average_8", cgn_stack_average(&stack, &c));
+        c.bpp = 16;
+        c.buf = (uint8_t*)unpacked;
+        memcpy(unpacked, buf16+offset16, w*h*2);
+        cgn_stack_reset(&stack, &c);
+        MEASURE("stack_add_16", cgn_stack_add(&stack, &c));
+        MEASURE("stack_average_16", cgn_stack_average(&stack, &c));
+
+        // Binned frames are small enough to fit into the stack ring
+        uint16_t *binned = (uint16_t*)stack_ring;
+        CgnBeamCalc bin_src = { .w = w, .h = h, .bpp = 8, .buf = buf8+offset8 };
+        for (int k = 2; k <= CGN_MAX_BINNING; k *= 2) {
+            CgnBeamCalc bin_dst = { .w = w/k, .h = h/k, .bpp = cgn_binned_bpp(8, k), .buf = (uint8_t*)binned };
+            printf("\nbinning=%dx%d", k, k);
+            bin_src.bpp = 8;
+            bin_src.buf = buf8+offset8;
+            MEASURE("bin_8", cgn_bin_frame(&bin_src, &bin_dst, k));
+            bin_src.bpp = 16;
+            bin_src.buf = buf16+offset16;
+            bin_dst.bpp = cgn_binned_bpp(16, k);
+            MEASURE("bin_16", cgn_bin_frame(&bin_src, &bin_dst, k));
+        }
+        free(stack_ring);
+        free(stack_sum);
+
+        b.subtract_bkgnd_v = 0;
+        b.calc_beam_v = 0;
+        free(packed);
+        free(unpacked);
+        free(dark);
+        free(gain);
+        free(calibrated);
+
+        // Histograms of all pixels and of every 4th pixel of every 4th row
+        uint32_t *hist_data = (uint32_t*)malloc(sizeof(uint32_t)*cgn_histogram_size(16, cgn_get_threads()));
+        if (!hist_data) {
+            perror("Unable to allocate histogram");
+            exit(EXIT_FAILURE);
+        }
+        CgnHistogram hist = { .step = 1, .parts = cgn_get_threads(), .data = hist_data };
+        c.bpp = 8;
+        c.buf = buf8+offset8;
+        MEASURE("histogram_8", cgn_calc_histogram(&c, &hist));
+        hist.step = 4;
+        MEASURE("histogram_8 (step 4)", cgn_calc_histogram(&c, &hist));
+        MEASURE("brightness_1_8", cgn_calc_brightness_1(&c));
+        MEASURE("overexposure_8", cgn_calc_overexposure(&c, 0.8));
+        c.bpp = 16;
+        c.buf = buf16+offset16;
+        hist.step = 1;
+        MEASURE("histogram_16", cgn_calc_histogram(&c, &hist));
+        hist.step = 4;
+        MEASURE("histogram_16 (step 4)", cgn_calc_histogram(&c, &hist));
+        free(hist_data);
+
+        // Spot grid in the full size frame, the threshold is from the previous frame as in the camera loop
+        const int max_labels = 65536, max_spots = 1024;
+        uint8_t *spots_frame = (uint8_t*)malloc(w*h*2);
+        int32_t *spots_parent = (int32_t*)malloc(sizeof(int32_t)*(max_labels+1));
+        CgnSpotMoments *spots_moments = (CgnSpotMoments*)malloc(sizeof(CgnSpotMoments)*(max_labels+1));
+        int32_t *spots_runs = (int32_t*)malloc(sizeof(int32_t)*cgn_spots_runs_size(w));
+        CgnBeamResult *spots_res = (CgnBeamResult*)malloc(sizeof(CgnBeamResult)*max_spots);
+        if (!spots_frame || !spots_parent || !spots_moments || !spots_runs || !spots_res) {
+            perror("Unable to allocate spot buffers");
+            exit(EXIT_FAILURE);
+        }
+        CgnSpots spots = {
+            .level = 0.3, .min_area = 3, .subtract = 1,
+            .max_labels = max_labels, .parent = spots_parent, .moments = spots_moments, .runs = spots_runs,
+            .max_spots = max_spots, .spots = spots_res,
+        };
+        CgnBeamCalc spots_c = { .w = w, .h = h, .bpp = 8, .buf = spots_frame };
+        render_spots(spots_frame, w, h, 8, 0, 0, -1);
+        cgn_find_spots(&spots_c, &spots);
+        MEASURE("find_spots_8", cgn_find_spots(&spots_c, &spots));
+        printf("spots=%d\n", spots.count);
+        spots_c.bpp = 16;
+        render_spots(spots_frame, w, h, 16, 0, 0, -1);
+        spots.max = 0;
+        cgn_find_spots(&spots_c, &spots);
+        MEASURE("find_spots_16", cgn_find_spots(&spots_c, &spots));
+        printf("spots=%d\n", spots.count);
+        free(spots_frame);
+        free(spots_parent);
+        free(spots_moments);
+        free(spots_runs);
+        free(spots_res);
+
+        printf("\nPhysical cores: %d\n", cgn_physical_cores());
+        c.bpp = 8;
+        c.buf = buf8+offset8;
+        cgn_set_threads(1);
+        MEASURE("bkgnd_8 (1 thread)", cgn_calc_beam_bkgnd(&c, &b, &r));
+        r0 = r;
+        for (int n = 2; n <= 16; n *= 2) {
+            printf("\nthreads=%d", cgn_set_threads(n));
+            MEASURE("", cgn_calc_beam_bkgnd(&c, &b, &r));
+            PRINT_DIFF(r0, r);
+        }
+        cgn_set_threads(0);
     }
     free(buf8);
     free(buf16);
     free(subtracted);
-    return EXIT_SUCCESS;
+
+    printf("\n*** Single precision subtracted buffers\n\n");
+    failed |= check_f32(FILENAME_8, 8);
+    failed |= check_f32(FILENAME_16, 16);
+    failed |= check_f32("../../beams/dot_8b.pgm", 8);
+    failed |= check_f32("../../beams/dot_8b_ast.pgm", 8);
+    failed |= check_f32("../../beams/empty_gray.pgm", 8);
+    failed |= check_f32("../../beams/empty_noise.pgm", 8);
+    failed |= check_f32("../../beams/empty_white.pgm", 8);
+    failed |= check_f32("../../beams/empty_zero.pgm", 8);
+
+    printf("\n*** Thread count independence of integer frames\n\n");
+    failed |= check_threads(FILENAME_8, 8);
+    failed |= check_threads(FILENAME_16, 16);
+
+    printf("\n*** Parallel apertures\n\n");
+    failed |= check_multi(FILENAME_8, 8);
+    failed |= check_multi(FILENAME_16, 16);
+
+    printf("\n*** Packed 10 and 12-bit frames\n\n");
+    failed |= check_packed(FILENAME_16);
+
+    printf("\n*** Histograms\n\n");
+    failed |= check_histogram(FILENAME_8, 8);
+    failed |= check_histogram(FILENAME_16, 16);
+
+    printf("\n*** Dark frame and flat field calibration\n\n");
+    failed |= check_calib(FILENAME_8, 8);
+    failed |= check_calib(FILENAME_16, 16);
+
+    printf("\n*** Defect pixels\n\n");
+    failed |= check_defects(FILENAME_8, 8);
+    failed |= check_defects(FILENAME_16, 16);
+    failed |= check_defects_clipped(4);
+    failed |= check_defects_clipped(16);
+
+    printf("\n*** Averaging of frames\n\n");
+    failed |= check_stack(FILENAME_8, 8);
+    failed |= check_stack(FILENAME_16, 16);
+
+    printf("\n*** Software binning\n\n");
+    failed |= check_binning(FILENAME_8, 8);
+    failed |= check_binning(FILENAME_16, 16);
+
+    printf("\n*** Spot array\n\n");
+    failed |= check_spots(8);
+    failed |= check_spots(12);
+    printf("%s\n", failed ? "FAILED" : "OK");
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -2,6 +2,8 @@
 
 #include "app/HelpSystem.h"
 
+#include "beam_calc.h"
+
 #include "dialogs/OriConfigDlg.h"
 #include "helpers/OriDialogs.h"
 #include "tools/OriSettings.h"
@@ -81,6 +83,10 @@ void AppSettings::load()
     LOAD(roundHardConfigFps, Bool, true);
     LOAD(roundHardConfigExp, Bool, true);
     LOAD(overexposedPixelsPercent, Double, 0.1);
+    LOAD(calcThreads, Int, 0);
+    LOAD(calcSinglePrecision, Bool, false);
+    LOAD(plotDelayMin, Int, 40);
+    LOAD(plotDelayMax, Int, 1000);
 
     s.beginGroup("Table");
     LOAD(copyResultsSeparator, Char, ',');
@@ -130,6 +136,10 @@ void AppSettings::save()
     SAVE(roundHardConfigFps);
     SAVE(roundHardConfigExp);
     SAVE(overexposedPixelsPercent);
+    SAVE(calcThreads);
+    SAVE(calcSinglePrecision);
+    SAVE(plotDelayMin);
+    SAVE(plotDelayMax);
 
     s.beginGroup("Table");
     SAVE(copyResultsSeparator);
@@ -188,6 +198,7 @@ bool AppSettings::edit()
     bool old_tableShowDY = tableShowDY;
     bool old_tableShowPhi = tableShowPhi;
     bool old_tableShowEps = tableShowEps;
+    bool old_calcSinglePrecision = calcSinglePrecision;
     opts.items = {
         new ConfigItemSection(cfgTable, tr("Copy results")),
         new ConfigItemRadio(cfgTable, tr("Value separator"), seps.values(), &sepIdx),
@@ -243,6 +254,16 @@ bool AppSettings::edit()
         new ConfigItemSection(cfgOpts, tr("Tweaks")),
         new ConfigItemBool(cfgOpts, tr("Camera control: Round frame rate"), &roundHardConfigFps),
         new ConfigItemBool(cfgOpts, tr("Camera control: Round exposure"), &roundHardConfigExp),
+        (new ConfigItemInt(cfgOpts, tr("Calculation threads"), &calcThreads))
+            ->withMinMax(0, 64)
+            ->withHint(tr("0 - number of physical cores (%1)").arg(cgn_physical_cores())),
+        (new ConfigItemBool(cfgOpts, tr("Single precision image buffers"), &calcSinglePrecision))
+            ->withHint(tr("Halves memory used for background subtracted images, results differ less than 0.01 px")),
+        (new ConfigItemInt(cfgOpts, tr("Min plot update interval (ms)"), &plotDelayMin))
+            ->withMinMax(10, 5000),
+        (new ConfigItemInt(cfgOpts, tr("Max plot update interval (ms)"), &plotDelayMax))
+            ->withMinMax(10, 5000)
+            ->withHint(tr("The plot is updated as often as the time of drawing allows, within these limits")),
         
         (new ConfigItemInt(cfgCrosshair, tr("Radius"), &crosshairRadius))->withMinMax(0, 20),
         (new ConfigItemInt(cfgCrosshair, tr("Extent"), &crosshairExtent))->withMinMax(0, 20),
@@ -255,13 +276,15 @@ bool AppSettings::edit()
     {
         copyResultsSeparator = seps.keys().at(sepIdx);
         save();
+        cgn_set_threads(calcThreads);
         bool affectsCamera =
             old_tableShowXC != tableShowXC ||
             old_tableShowYC != tableShowYC ||
             old_tableShowDX != tableShowDX ||
             old_tableShowDY != tableShowDY ||
             old_tableShowPhi != tableShowPhi ||
-            old_tableShowEps != tableShowEps;
+            old_tableShowEps != tableShowEps ||
+            old_calcSinglePrecision != calcSinglePrecision;
         notify(&IAppSettingsListener::settingsChanged, affectsCamera);
         return true;
     }
@@ -46,6 +46,10 @@ public:
     bool roundHardConfigFps = true;
     bool roundHardConfigExp = true;
     double overexposedPixelsPercent = 0.1;
+    int calcThreads = 0;
+    bool calcSinglePrecision = false;
+    int plotDelayMin = 40;
+    int plotDelayMax = 1000;
     QChar copyResultsSeparator = ',';
     bool copyResultsJustified = true;
     QMap<QChar, QString> resultsSeparators() const;
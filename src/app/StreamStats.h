@@ -0,0 +1,120 @@
+#ifndef STREAM_STATS_H
+#define STREAM_STATS_H
+
+#include <QVector>
+#include <QtMath>
+
+/**
+ * Mean and standard deviation of several fields over a stream of samples.
+ *
+ * With a window size, the statistics are taken over the last samples only,
+ * they are kept in a ring allocated once in init, and the oldest one is removed
+ * when a new one comes. Without a window, all samples since the last clear are taken.
+ *
+ * Samples are added and removed with Welford updates, so each costs O(fields)
+ * regardless of the window size. Rounding errors of removals can accumulate
+ * over long streams, so sums are recalculated from the ring once per its turn.
+ */
+class StreamStats
+{
+public:
+    /// Allocates the ring for `window` samples of `fields` values each, 0 means no window
+    void init(int fields, int window = 0)
+    {
+        _fields = fields;
+        _window = qMax(window, 0);
+        _ring = QVector<double>(_fields * _window);
+        _mean = QVector<double>(_fields);
+        _m2 = QVector<double>(_fields);
+        clear();
+    }
+
+    void clear()
+    {
+        _count = 0;
+        _head = 0;
+        _mean.fill(0);
+        _m2.fill(0);
+    }
+
+    int fields() const { return _fields; }
+    int count() const { return _count; }
+    bool isEmpty() const { return _count == 0; }
+
+    void add(const double *v)
+    {
+        if (_window > 0) {
+            double *slot = _ring.data() + _head * _fields;
+            if (_count == _window) {
+                for (int i = 0; i < _fields; i++)
+                    remove(i, slot[i]);
+                _count--;
+            }
+            memcpy(slot, v, sizeof(double) * _fields);
+            _head = (_head + 1) % _window;
+        }
+        _count++;
+        for (int i = 0; i < _fields; i++) {
+            const double d = v[i] - _mean[i];
+            _mean[i] += d / _count;
+            _m2[i] += d * (v[i] - _mean[i]);
+        }
+        if (_window > 0 && _head == 0 && _count == _window)
+            recalc();
+    }
+
+    double mean(int field) const { return _mean.at(field); }
+
+    /// Population standard deviation
+    double sdev(int field) const { return _count > 0 ? qSqrt(qMax(_m2.at(field), 0.0) / _count) : 0; }
+
+    /// The sample added last, only available with a window
+    const double* last() const
+    {
+        return _window > 0 && _count > 0 ? _ring.constData() + ((_head + _window - 1) % _window) * _fields : nullptr;
+    }
+
+private:
+    int _fields = 0;
+    int _window = 0;
+    int _count = 0;
+    /// Where the next sample goes, it's the oldest sample when the ring is full
+    int _head = 0;
+    QVector<double> _ring;
+    QVector<double> _mean;
+    /// Sums of squared differences from the mean
+    QVector<double> _m2;
+
+    /// Removes the value from the field stats, _count should still include it
+    inline void remove(int i, double v)
+    {
+        if (_count == 1) {
+            _mean[i] = 0;
+            _m2[i] = 0;
+            return;
+        }
+        const double d = v - _mean[i];
+        _mean[i] -= d / (_count - 1);
+        _m2[i] -= d * (v - _mean[i]);
+    }
+
+    void recalc()
+    {
+        _mean.fill(0);
+        _m2.fill(0);
+        const double *v = _ring.constData();
+        for (int j = 0; j < _count; j++, v += _fields)
+            for (int i = 0; i < _fields; i++)
+                _mean[i] += v[i];
+        for (int i = 0; i < _fields; i++)
+            _mean[i] /= _count;
+        v = _ring.constData();
+        for (int j = 0; j < _count; j++, v += _fields)
+            for (int i = 0; i < _fields; i++) {
+                const double d = v[i] - _mean[i];
+                _m2[i] += d * d;
+            }
+    }
+};
+
+#endif // STREAM_STATS_H
@@ -12,9 +12,13 @@
 #include <QApplication>
 #include <QComboBox>
 #include <QCheckBox>
+#include <QDir>
+#include <QFileInfo>
 #include <QLabel>
 #include <QRadioButton>
+#include <QSettings>
 #include <QSpinBox>
+#include <QStandardPaths>
 
 using namespace Ori::Dlg;
 using namespace Ori::Layouts;
@@ -104,6 +108,12 @@ bool Camera::editConfig(int page)
     int roiPixelBottom = qRound(double(height()) * _config.roi.bottom);
     bool roiOn = _config.roiMode == ROI_SINGLE;
     bool oldRoiOn = roiOn;
+    bool binning1 = _config.binning != 2 && _config.binning != 4;
+    bool binning2 = _config.binning == 2;
+    bool binning4 = _config.binning == 4;
+    bool queueOldest = _config.queue.policy == DROP_OLDEST;
+    bool queueNewest = _config.queue.policy == DROP_NEWEST;
+    bool queueBlock = _config.queue.policy == DROP_NONE;
     opts.items = {
         new ConfigItemBool(cfgPlot, qApp->tr("Normalize data"), &_config.plot.normalize),
         new ConfigItemSpace(cfgPlot, 12),
@@ -144,6 +154,20 @@ bool Camera::editConfig(int page)
         << (new ConfigItemInt(cfgCentr, qApp->tr("Max Iterations"), &_config.bgnd.iters))
             ->withMinMax(0, 50)
         << new ConfigItemReal(cfgCentr, qApp->tr("Precision"), &_config.bgnd.precision)
+        << (new ConfigItemBool(cfgCentr, qApp->tr("Use summed-area tables"), &_config.bgnd.sat))
+            ->withHint(qApp->tr("Makes iterations almost free but requires "
+                "about 48 bytes of memory per pixel. Useful for many iterations."), false)
+        << (new ConfigItemInt(cfgCentr, qApp->tr("Coarse search decimation"), &_config.bgnd.decimate))
+            ->withMinMax(0, 16)
+            ->withHint(qApp->tr("The beam is first searched in the frame reduced "
+                "by this factor (e.g. 4 or 8), then only the mask area is calculated "
+                "at full resolution. Speeds up small beams on large sensors. "
+                "0 or 1 turns it off. Not used with multiple regions or summed-area tables."), false)
+        << (new ConfigItemBool(cfgCentr, qApp->tr("Start from previous frame"), &_config.bgnd.track))
+            ->withHint(qApp->tr("Iterations start from the beam position found in the previous frame "
+                "instead of the whole region. The whole region is calculated again "
+                "when the beam has moved or changed its size noticeably. "
+                "Not used with summed-area tables."), false)
 
         << (new ConfigItemBool(cfgRoi, qApp->tr("Use region"), &roiOn))
             ->withHint(qApp->tr(
@@ -159,6 +183,61 @@ bool Camera::editConfig(int page)
         << (new ConfigItemInt(cfgRoi, qApp->tr("Bottom"), &roiPixelBottom))
             ->withMinMax(0, height())
     ;
+    if (canMavg()) {
+        opts.items
+            << (new ConfigItemBool(cfgCentr, qApp->tr("Average images"), &_config.stack.on))
+                ->withHint(qApp->tr("Images of the last frames are averaged before the calculation. "
+                    "Reduces noise of weak beams but keeps all these frames in memory."), false)
+            << (new ConfigItemInt(cfgCentr, qApp->tr("Over number of frames"), &_config.stack.frames))
+                ->withMinMax(Stacking::minFrames, Stacking::maxFrames)
+            << (new ConfigItemInt(cfgCentr, qApp->tr("Calculate every Nth frame"), &_config.stack.every))
+                ->withMinMax(1, Stacking::maxFrames)
+        ;
+    }
+    opts.items
+        << new ConfigItemSpace(cfgCentr, 12)
+        << (new ConfigItemBool(cfgCentr, qApp->tr("Find array of spots"), &_config.spots.on))
+            ->withHint(qApp->tr("Each connected area of pixels above the threshold is measured "
+                "as a separate beam, spots keep their numbers from frame to frame. "
+                "A single region limits the search area, multiple regions are not used."), false)
+        << (new ConfigItemReal(cfgCentr, qApp->tr("Threshold above background (0-1)"), &_config.spots.level))
+        << (new ConfigItemInt(cfgCentr, qApp->tr("Min spot area (px)"), &_config.spots.minArea))
+            ->withMinMax(1, 10000)
+        << (new ConfigItemInt(cfgCentr, qApp->tr("Max number of spots"), &_config.spots.maxCount))
+            ->withMinMax(1, SpotArray::maxSpots)
+            ->withHint(qApp->tr("Only first %1 spots are saved in measurements").arg(SpotArray::maxSaved), false)
+        << new ConfigItemSpace(cfgCentr, 12)
+        << (new ConfigItemSection(cfgCentr, qApp->tr("Software binning")))
+            ->withHint(qApp->tr("Reselect camera to apply"))
+        << (new ConfigItemBool(cfgCentr, qApp->tr("No binning"), &binning1))
+            ->withRadioGroup("binning")
+        << (new ConfigItemBool(cfgCentr, qApp->tr("2 × 2"), &binning2))
+            ->withRadioGroup("binning")
+        << (new ConfigItemBool(cfgCentr, qApp->tr("4 × 4"), &binning4))
+            ->withRadioGroup("binning")
+            ->withHint(qApp->tr("Blocks of pixels are summed after acquisition, "
+                "results are still shown in sensor pixels. "
+                "For very large sensors and cameras without hardware binning."), false)
+    ;
+    if (canMavg()) {
+        opts.items
+            << new ConfigItemSpace(cfgCentr, 12)
+            << (new ConfigItemSection(cfgCentr, qApp->tr("Frame queue")))
+                ->withHint(qApp->tr("Reselect camera to apply"))
+            << (new ConfigItemInt(cfgCentr, qApp->tr("Queued frames"), &_config.queue.slots))
+                ->withMinMax(FrameQueue::minSlots, FrameQueue::maxSlots)
+                ->withHint(qApp->tr("Frames wait here while previous ones are calculated, "
+                    "so acquisition doesn't stall on slow frames"), false)
+            << (new ConfigItemBool(cfgCentr, qApp->tr("Drop oldest frames"), &queueOldest))
+                ->withRadioGroup("queue")
+            << (new ConfigItemBool(cfgCentr, qApp->tr("Drop newest frames"), &queueNewest))
+                ->withRadioGroup("queue")
+            << (new ConfigItemBool(cfgCentr, qApp->tr("Wait for calculation"), &queueBlock))
+                ->withRadioGroup("queue")
+                ->withHint(qApp->tr("No frames are dropped while the calculation keeps up on average, "
+                    "but the camera can drop frames itself when acquisition waits"), false)
+        ;
+    }
     if (hasStability()) {
         opts.items
             << (new ConfigItemInt(cfgStabil, qApp->tr("Timeline display window (min)"), &_config.stabil.displayMins))
@@ -176,6 +255,8 @@ bool Camera::editConfig(int page)
         _config.plot.fullRange = scaleFullRange;
         _config.plot.rescale = rescalePlot;
         _config.plot.customScale.on = useCustomScale;
+        _config.binning = binning4 ? 4 : binning2 ? 2 : 1;
+        _config.queue.policy = queueBlock ? DROP_NONE : queueNewest ? DROP_NEWEST : DROP_OLDEST;
         _config.bgnd.corner = cornerFraction / 100.0;
         _config.roi.left = double(roiPixelLeft)/double(width());
         _config.roi.right = double(roiPixelRight)/double(width());
@@ -274,11 +355,16 @@ bool Camera::isRoiValid() const
 
 PixelScale Camera::pixelScale() const
 {
-    if (!_config.plot.rescale)
-        return {};
-    if (_config.plot.customScale.on)
-        return _config.plot.customScale;
-    return sensorScale();
+    PixelScale scale;
+    if (_config.plot.rescale)
+        scale = _config.plot.customScale.on ? _config.plot.customScale : sensorScale();
+    if (_binning > 1) {
+        // Binned pixels are shown in sensor units
+        if (!scale.on)
+            scale = { .on = true, .factor = 1, .unit = "px" };
+        scale.factor *= _binning;
+    }
+    return scale;
 }
 
 bool Camera::setupPowerMeter()
@@ -326,8 +412,12 @@ bool Camera::setupPowerMeter()
 TableRowsSpec Camera::tableRows() const
 {
     TableRowsSpec rows;
-    rows.showSdev = _config.mavg.on;
-    if (_config.roiMode == ROI_NONE || _config.roiMode == ROI_SINGLE) {
+    rows.showSdev = _config.mavg.on && !_config.spots.on;
+    if (_config.spots.on) {
+        const int count = qMin(_config.spots.maxCount, SpotArray::maxTableRows);
+        for (int i = 0; i < count; i++)
+            rows.results << qApp->tr("Spot #%1").arg(i+1);
+    } else if (_config.roiMode == ROI_NONE || _config.roiMode == ROI_SINGLE) {
         rows.results << qApp->tr("Centroid");
     } else {
         for (int i = 0; i < _config.rois.size(); i++) {
@@ -340,6 +430,63 @@ TableRowsSpec Camera::tableRows() const
     return rows;
 }
 
+bool Camera::setupCalibration()
+{
+    auto cbDark = new QCheckBox(qApp->tr("Subtract dark frame"));
+    auto cbFlat = new QCheckBox(qApp->tr("Apply flat field"));
+    auto cbDefects = new QCheckBox(qApp->tr("Fix defect pixels"));
+    auto seFrames = Ori::Gui::spinBox(Calibration::minFrames, Calibration::maxFrames);
+    auto rbKeep = new QRadioButton(qApp->tr("Keep current masters"));
+    auto rbDark = new QRadioButton(qApp->tr("Capture dark frame and defect pixels (sensor covered)"));
+    auto rbFlat = new QRadioButton(qApp->tr("Capture flat field (sensor uniformly lit)"));
+
+    cbDark->setChecked(_config.calib.dark);
+    cbFlat->setChecked(_config.calib.flat);
+    cbDefects->setChecked(_config.calib.defects);
+    seFrames->setValue(_config.calib.frames);
+    rbKeep->setChecked(true);
+    rbDark->setEnabled(isCapturing());
+    rbFlat->setEnabled(isCapturing());
+
+    auto w = LayoutV({
+        cbDark,
+        cbFlat,
+        cbDefects,
+        SpaceV(1),
+        qApp->tr("Masters are averaged over frames:"),
+        seFrames,
+        SpaceV(1),
+        rbKeep,
+        rbDark,
+        rbFlat,
+    }).setMargin(0).makeWidgetAuto();
+    bool ok = Dialog(w)
+        .withContentToButtonsSpacingFactor(3)
+        .windowModal()
+        .exec();
+    if (ok) {
+        _config.calib.dark = cbDark->isChecked();
+        _config.calib.flat = cbFlat->isChecked();
+        _config.calib.defects = cbDefects->isChecked();
+        _config.calib.frames = std::clamp(seFrames->value(), Calibration::minFrames, Calibration::maxFrames);
+        saveConfig();
+        toggleCalibration(rbDark->isChecked() ? CALIB_DARK : rbFlat->isChecked() ? CALIB_FLAT : CALIB_NONE);
+    }
+    return ok;
+}
+
+QString Camera::calibFile(CalibMaster master) const
+{
+    Ori::Settings s;
+    // Native settings (e.g. the registry) have no directory to put files into
+    QString dir = s.settings()->format() == QSettings::IniFormat
+        ? QFileInfo(s.settings()->fileName()).absolutePath()
+        : QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation);
+    QDir().mkpath(dir);
+    return QDir(dir).filePath(_configGroup +
+        (master == CALIB_DARK ? ".dark" : master == CALIB_FLAT ? ".flat" : ".defects"));
+}
+
 bool Camera::editRoisSize()
 {
     auto scale = pixelScale();
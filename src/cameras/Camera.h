@@ -49,6 +49,12 @@ public:
     virtual void raisePowerWarning() {}
     bool setupPowerMeter();
 
+    virtual bool canCalibrate() const { return false; }
+    virtual void toggleCalibration(CalibMaster capture) {}
+    bool setupCalibration();
+    /// File of the master frame stored next to the camera config
+    QString calibFile(CalibMaster master) const;
+
     virtual QString customId() const { return {}; }
 
     /// Data rows to be show in the Result table
@@ -77,6 +83,8 @@ public:
     bool editRoisSize();
 
     PixelScale pixelScale() const;
+    /// Software binning factor of the current frames, they are smaller than the sensor by this factor
+    int binning() const { return _binning; }
     QString resolutionStr() const;
     QString formatBrightness(double v) const;
 
@@ -89,6 +97,7 @@ protected:
     StabilityIntf *_stabil;
     QString _configGroup;
     CameraConfig _config;
+    int _binning = 1;
 
     Camera(PlotIntf *plot, TableIntf *table, StabilityIntf *stabil, const char* configGroup);
 
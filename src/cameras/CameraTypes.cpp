@@ -20,6 +20,20 @@ QString formatSecs(int secs) {
 int PowerMeter::minAvgFrames = 1;
 int PowerMeter::maxAvgFrames = 10;
 
+int Calibration::minFrames = 1;
+int Calibration::maxFrames = 256;
+
+int Stacking::minFrames = 2;
+int Stacking::maxFrames = 32;
+
+int FrameQueue::minSlots = 2;
+int FrameQueue::maxSlots = 16;
+
+int SpotArray::maxSpots = 1024;
+int SpotArray::maxLabels = 65536;
+int SpotArray::maxTableRows = 8;
+int SpotArray::maxSaved = 64;
+
 //------------------------------------------------------------------------------
 //                               CameraConfig
 //------------------------------------------------------------------------------
@@ -43,6 +57,14 @@ void CameraConfig::load(QSettings *s)
     LOAD(bgnd.corner, Double, 0.035);
     LOAD(bgnd.noise, Double, 3);
     LOAD(bgnd.mask, Double, 3);
+    LOAD(bgnd.sat, Bool, false);
+    LOAD(bgnd.decimate, Int, 0);
+    LOAD(bgnd.track, Bool, false);
+
+    LOAD(calib.dark, Bool, false);
+    LOAD(calib.flat, Bool, false);
+    LOAD(calib.defects, Bool, false);
+    LOAD(calib.frames, Int, 16);
 
     LOAD(roi.left, Double, 0.25);
     LOAD(roi.top, Double, 0.25);
@@ -74,6 +96,20 @@ void CameraConfig::load(QSettings *s)
 
     LOAD(mavg.on, Bool, false);
     LOAD(mavg.frames, Int, 5);
+
+    LOAD(stack.on, Bool, false);
+    LOAD(stack.frames, Int, 8);
+    LOAD(stack.every, Int, 1);
+
+    LOAD(spots.on, Bool, false);
+    LOAD(spots.level, Double, 0.25);
+    LOAD(spots.minArea, Int, 4);
+    LOAD(spots.maxCount, Int, 64);
+
+    LOAD(queue.slots, Int, 4);
+    queue.policy = FrameDropPolicy(s->value("queue.policy", DROP_OLDEST).toInt());
+
+    LOAD(binning, Int, 1);
     
     LOAD(stabil.displayMins, Int, 60);
     LOAD(stabil.heatmapCells, Int, 10);
@@ -100,6 +136,16 @@ void CameraConfig::save(QSettings *s, bool compact) const
         SAVE(bgnd.corner);
         SAVE(bgnd.noise);
         SAVE(bgnd.mask);
+        SAVE(bgnd.sat);
+        SAVE(bgnd.decimate);
+        SAVE(bgnd.track);
+    }
+
+    SAVE(calib.dark);
+    SAVE(calib.flat);
+    SAVE(calib.defects);
+    if (!compact or calib.dark or calib.flat) {
+        SAVE(calib.frames);
     }
 
     SAVE(roiMode);
@@ -136,6 +182,24 @@ void CameraConfig::save(QSettings *s, bool compact) const
     if (!compact or mavg.on) {
         SAVE(mavg.frames);
     }
+
+    SAVE(stack.on);
+    if (!compact or stack.on) {
+        SAVE(stack.frames);
+        SAVE(stack.every);
+    }
+
+    SAVE(spots.on);
+    if (!compact or spots.on) {
+        SAVE(spots.level);
+        SAVE(spots.minArea);
+        SAVE(spots.maxCount);
+    }
+
+    SAVE(queue.slots);
+    SAVE(queue.policy);
+
+    SAVE(binning);
     
     if (!compact) {
         SAVE(stabil.displayMins);
@@ -73,6 +73,22 @@ struct Background
     double corner = 0.035;
     double noise = 3;
     double mask = 3;
+    bool sat = false;
+    int decimate = 0;
+    bool track = false;
+};
+
+enum CalibMaster { CALIB_NONE, CALIB_DARK, CALIB_FLAT, CALIB_DEFECTS };
+
+struct Calibration
+{
+    bool dark = false;
+    bool flat = false;
+    bool defects = false;
+    int frames = 16;
+
+    static int minFrames;
+    static int maxFrames;
 };
 
 struct PlotOptions
@@ -109,6 +125,41 @@ struct Averaging
     int frames = 5;
 };
 
+struct Stacking
+{
+    bool on = false;
+    int frames = 8;
+    int every = 1;
+
+    static int minFrames;
+    static int maxFrames;
+};
+
+enum FrameDropPolicy { DROP_OLDEST, DROP_NEWEST, DROP_NONE };
+
+/// Frames waiting for the calculation, see FrameRing
+struct FrameQueue
+{
+    int slots = 4;
+    FrameDropPolicy policy = DROP_OLDEST;
+
+    static int minSlots;
+    static int maxSlots;
+};
+
+struct SpotArray
+{
+    bool on = false;
+    double level = 0.25;
+    int minArea = 4;
+    int maxCount = 64;
+
+    static int maxSpots;
+    static int maxLabels;
+    static int maxTableRows;
+    static int maxSaved;
+};
+
 struct Stability
 {
     int displayMins = 60;
@@ -130,13 +181,18 @@ struct CameraConfig
 {
     PlotOptions plot;
     Background bgnd;
+    Calibration calib;
     RoiRect roi;
     RoiRects rois;
     RoiMode roiMode = ROI_NONE;
     FrameSize mroiSize = { 0.1, 0.1 };
     PowerMeter power;
     Averaging mavg;
+    Stacking stack;
     Stability stabil;
+    SpotArray spots;
+    FrameQueue queue;
+    int binning = 1;
 
     void load(QSettings *s);
     void save(QSettings *s, bool compact=false) const;
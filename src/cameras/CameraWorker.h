@@ -1,8 +1,11 @@
 #ifndef CAMERA_WORKER
 #define CAMERA_WORKER
 
+#include "app/AppSettings.h"
+#include "app/StreamStats.h"
 #include "cameras/Camera.h"
 #include "cameras/CameraTypes.h"
+#include "cameras/FrameRing.h"
 #include "cameras/MeasureSaver.h"
 #include "widgets/PlotIntf.h"
 #include "widgets/StabilityIntf.h"
@@ -12,18 +15,32 @@
 
 #include <QApplication>
 #include <QDebug>
+#include <QFile>
 #include <QMutex>
-#include <QQueue>
 #include <QThread>
 
-#define PLOT_FRAME_DELAY_MS 200
 #define STAT_DELAY_MS 1000
+#define CALC_WAIT_MS 100
+#define EXP_WARNING_LEVEL 0.8
+#define DEFECT_NOISE_LEVEL 6
 #define MEASURE_BUF_SIZE 1000
 #define MEASURE_BUF_COUNT 2
-#define SQR(x) ((x)*(x))
+#define FRAME_POOL_SIZE 4
 
 enum MeasureDataCol { COL_BRIGHTNESS, COL_POWER, COL_DEBUG_1, COL_DEBUG_2 };
 
+/// Header of calibration master files, it's followed by w*h pixels of the master:
+/// uint16_t values of the dark frame or float gains of the flat field.
+/// Defect map is followed by `offset` int32 indices of defect pixels instead.
+struct CalibFileHeader
+{
+    char magic[4];
+    qint32 w;
+    qint32 h;
+    qint32 bpp;
+    qint32 offset;
+};
+
 class CameraWorker
 {
 public:
@@ -42,6 +59,8 @@ public:
     QElapsedTimer timer;
     /// Current frame time from the start of capturing @a captureStart
     qint64 tm;
+    /// Time of the frame being acquired, the acquisition thread uses it instead of @a tm
+    qint64 acqTm = 0;
     qint64 prevFrame = 0;
     qint64 prevReady = 0;
     qint64 prevStat = 0;
@@ -61,13 +80,22 @@ public:
     double powerScale = 0;
     RoiRect roi;
     QList<RoiRect> rois;
-    double *graph;
     QVector<double> subtracted;
+    QVector<float> subtractedF32;
+    QVector<double> sat;
+    QVector<uint16_t> decimated;
+    /// Background states and instant results of each ROI in multi-ROI mode,
+    /// ROIs are calculated in parallel by cgn_calc_beam_bkgnd_multi
+    QVector<CgnBeamBkgnd> roiBkgnds;
+    QVector<CgnBeamResult> roiResults;
     /// Beam estimation results for each ROI, they are updated every frame.
     /// If the averaging is enabled, then results contain averaged values.
     QList<CgnBeamResult> results;
-    QList<QQueue<CgnBeamResult>> mavgs;
+    enum MavgField { MAVG_XC, MAVG_YC, MAVG_DX, MAVG_DY, MAVG_PHI, MAVG_P, MAVG_FIELDS };
+    QList<StreamStats> mavgs;
     QList<CgnBeamResult> sdevs;
+    /// Instant results that went into the averages last
+    QList<CgnBeamResult> mavgLast;
 
     MeasureSaver *saver = nullptr;
     QMutex saverMutex;
@@ -80,10 +108,66 @@ public:
     qint64 measureStart = -1;
     qint64 measureDuration = -1;
     qint64 saveImgInterval = 0;
+    /// Copies of frames sent to the saver and raw image requests
+    FramePool framePool;
     QObject *rawImgRequest = nullptr;
     QObject *brightRequest = nullptr;
     QObject *expWarningRequest = nullptr;
     double brightness = 0;
+    /// Dark frame and flat field masters mapped from their files, see loadCalib
+    CgnCalib calib;
+    bool useCalib = false;
+    QFile darkFile;
+    QFile flatFile;
+    /// Defect pixels found in the dark frame series
+    CgnDefects defects;
+    bool useDefects = false;
+    QFile defectsFile;
+    /// Calibrated 8-bit frame, packed frames are calibrated in place while unpacking
+    QVector<uint8_t> calibrated;
+    /// Master being captured and the sum of its frames
+    CalibMaster calibCapture = CALIB_NONE;
+    int calibFrames = 0;
+    /// The current frame goes into the master, it's taken once per frame, see takeCalibState
+    bool calibFrame = false;
+    int calibTotal = 0;
+    QVector<uint32_t> calibSum;
+    QVector<uint64_t> calibSumSq;
+    /// Running sum of the last frames when images are averaged, see stackFrame
+    CgnStack stack;
+    QVector<uint8_t> stackRing;
+    QVector<uint32_t> stackSum;
+    bool doStack = false;
+    int stackEvery = 1;
+    int stackSkipped = 0;
+    bool skipFrame = false;
+    /// The frame is shown, it's decided once before the frame is taken, see displayDue
+    bool displayFrame = false;
+    /// Frame as it comes from the sensor when it's binned in software into `c`, see initBinning
+    CgnBeamCalc sensor;
+    QVector<uint16_t> binnedBuf;
+    int binning = 1;
+    /// Spot array mode, spots are kept in slots so that each spot has the same index in `results`
+    /// from frame to frame, a slot holds the last known result of its spot, see calcSpots
+    bool doSpots = false;
+    int spotsMax = 0;
+    CgnSpots spots;
+    QVector<int32_t> spotsParent;
+    QVector<CgnSpotMoments> spotsMoments;
+    QVector<int32_t> spotsRuns;
+    QVector<CgnBeamResult> spotsFound;
+    QVector<CgnBeamResult> spotSlots;
+    QVector<int> slotOfSpot;
+    QVector<int> spotOfSlot;
+    /// Statistics of the current frame collected by unpackFrame
+    CgnFrameStats frameStats;
+    bool hasFrameStats = false;
+    /// Histogram of the current 8-bit frame counted for the exposure warning, see countFrame
+    CgnHistogram hist;
+    QVector<uint32_t> histData;
+    bool hasHist = false;
+    /// Only the aperture of the current frame is unpacked when it's false, see needFullFrame
+    bool fullFrame = true;
     bool showBrightness = false;
     bool saveBrightness = false;
     bool showPower = false;
@@ -96,6 +180,15 @@ public:
     bool doMavg = false;
     int mavgFrames = 0;
 
+    /// Frames are handed from the acquisition thread to the calculation thread through the ring,
+    /// so the acquisition doesn't wait while the previous frame is calculated, see startCalc
+    FrameRing ring;
+    std::unique_ptr<QThread> calcThread;
+    /// Makes the frame from a ring slot the current frame, it's called in the calculation thread
+    std::function<void(uint8_t *buf)> takeFrame;
+    /// Called in the calculation thread when results have been shown
+    std::function<void()> frameShown;
+
     QMap<QString, QVariant> stats;
     std::function<QMap<int, CamTableData>()> tableData;
 
@@ -111,6 +204,36 @@ public:
         measurs = measurBufs[0];
     }
 
+    ~CameraWorker()
+    {
+        stopCalc();
+    }
+
+    /// Makes `c` the binned frame when software binning is configured, the camera should call it
+    /// after it has set up `c` and before initGraph, the acquired frame goes into `sensor` then
+    void initBinning()
+    {
+        binning = camera->config().binning;
+        if ((binning != 2 && binning != 4) || c.w < binning || c.h < binning) {
+            binning = 1;
+            return;
+        }
+        sensor = c;
+        c.w = sensor.w / binning;
+        c.h = sensor.h / binning;
+        c.bpp = cgn_binned_bpp(sensor.bpp, binning);
+        binnedBuf = QVector<uint16_t>(c.w*c.h);
+        c.buf = (uint8_t*)binnedBuf.data();
+        qDebug().nospace() << logId << " Software binning " << binning << "x" << binning
+            << ": " << c.w << "x" << c.h << "x" << c.bpp << "bit";
+    }
+
+    /// The frame that cameras acquire into, calibration masters are made for it
+    inline CgnBeamCalc& acquired()
+    {
+        return binning > 1 ? sensor : c;
+    }
+
     void configure()
     {
         reconfig = false;
@@ -125,49 +248,414 @@ public:
         g.nT = cfg.bgnd.noise;
         g.mask_diam = cfg.bgnd.mask;
         subtract = cfg.bgnd.on;
-        if (subtract) {
-            subtracted = QVector<double>(c.w*c.h);
-            g.subtracted = subtracted.data();
+        // Spots are searched over the single region or the whole frame
+        doSpots = cfg.spots.on;
+        multiRoi = cfg.roiMode == ROI_MULTI && !doSpots;
+        useRoi = doSpots ? cfg.roiMode == ROI_SINGLE : cfg.roiMode != ROI_NONE;
+        roi = cfg.roi;
+        rois = cfg.rois;
+        // A single aperture is calculated directly from the raw frame,
+        // the subtracted image is only produced in showResults when it's displayed
+        g.subtract_bkgnd_v = multiRoi ? 1 : (subtract ? 2 : 0);
+        subtracted.clear();
+        subtractedF32.clear();
+        if (subtract && multiRoi) {
+            if (AppSettings::instance().calcSinglePrecision) {
+                subtractedF32 = QVector<float>(c.w*c.h);
+                g.subtracted_f32 = subtractedF32.data();
+            } else {
+                subtracted = QVector<double>(c.w*c.h);
+                g.subtracted = subtracted.data();
+            }
+        }
+        if (subtract && cfg.bgnd.sat) {
+            sat = QVector<double>(multiRoi ? roisSatSize() : cgn_sat_size(c.w, c.h));
+            g.sat = sat.data();
+        } else {
+            sat.clear();
+        }
+        if (subtract && !multiRoi && cfg.bgnd.decimate > 1) {
+            decimated = QVector<uint16_t>(cgn_decimated_size(c.w, c.h, cfg.bgnd.decimate));
+            g.decimate = cfg.bgnd.decimate;
+            g.decimated = decimated.data();
+        } else {
+            decimated.clear();
         }
+        if (subtract && !multiRoi && !doSpots && cfg.bgnd.track)
+            g.track = &r;
         normalize = cfg.plot.normalize;
         fullRange = cfg.plot.fullRange;
-        multiRoi = cfg.roiMode == ROI_MULTI;
-        useRoi = cfg.roiMode != ROI_NONE;
-        roi = cfg.roi;
-        rois = cfg.rois;
         results.resize(multiRoi ? rois.size() : 1);
-        g.subtract_bkgnd_v = multiRoi ? 1 : 0;
+        g.calc_beam_v = g.sat ? 2 : 1;
 
-        doMavg = cfg.mavg.on;
+        roiBkgnds.clear();
+        roiResults.clear();
+        if (multiRoi) {
+            // ROIs share the subtracted buffer, each ROI only writes its own area,
+            // but summed-area tables are separate, each ROI gets its own part of `sat`
+            double *roiSat = g.sat;
+            for (const auto &rect : std::as_const(rois)) {
+                CgnBeamBkgnd b = g;
+                setAperture(rect, b);
+                if (roiSat) {
+                    b.sat = roiSat;
+                    roiSat += cgn_sat_size(b.ax2 - b.ax1, b.ay2 - b.ay1);
+                }
+                roiBkgnds << b;
+            }
+            roiResults.resize(rois.size());
+            if (subtract && cfg.bgnd.track)
+                for (int i = 0; i < roiBkgnds.size(); i++)
+                    roiBkgnds[i].track = &roiResults.at(i);
+        }
+
+        configureSpots(cfg.spots);
+
+        loadCalib(cfg.calib);
+
+        // The library takes fewer parts when the number of threads is reduced later
+        memset(&hist, 0, sizeof(CgnHistogram));
+        if (acquired().bpp <= 8) {
+            hist.parts = cgn_get_threads();
+            histData = QVector<uint32_t>(cgn_histogram_size(8, hist.parts));
+            hist.data = histData.data();
+        } else {
+            histData.clear();
+        }
+        hasHist = false;
+
+        doStack = cfg.stack.on;
+        if (doStack) {
+            stack.frames = std::clamp(cfg.stack.frames, Stacking::minFrames, Stacking::maxFrames);
+            stackRing = QVector<uint8_t>(c.w*c.h*(c.bpp > 8 ? 2 : 1)*stack.frames);
+            stackSum = QVector<uint32_t>(c.w*c.h);
+            stack.ring = stackRing.data();
+            stack.sum = stackSum.data();
+            cgn_stack_reset(&stack, &c);
+            stackEvery = qMax(cfg.stack.every, 1);
+            stackSkipped = 0;
+        } else {
+            stackRing.clear();
+            stackSum.clear();
+        }
+        skipFrame = false;
+
+        doMavg = cfg.mavg.on && !doSpots;
         mavgFrames = cfg.mavg.frames;
         if (doMavg) {
             mavgs.resize(multiRoi ? rois.size() : 1);
-            sdevs.resize(multiRoi ? rois.size() : 1);
+            for (auto &s : mavgs)
+                s.init(MAVG_FIELDS, mavgFrames);
+            sdevs.resize(mavgs.size());
+            mavgLast = QList<CgnBeamResult>(mavgs.size(), CgnBeamResult { .nan = true });
         } else {
             mavgs.clear();
             sdevs.clear();
+            mavgLast.clear();
         }
     }
 
-    void setRoi(const RoiRect &roi)
+    void configureSpots(const SpotArray &cfg)
+    {
+        spotSlots.clear();
+        if (!doSpots) {
+            spotsParent.clear();
+            spotsMoments.clear();
+            spotsRuns.clear();
+            spotsFound.clear();
+            slotOfSpot.clear();
+            spotOfSlot.clear();
+            return;
+        }
+        spotsMax = std::clamp(cfg.maxCount, 1, SpotArray::maxSpots);
+        // More spots than slots can be found when there is noise or new spots
+        const int maxFound = SpotArray::maxSpots;
+        spotsParent = QVector<int32_t>(SpotArray::maxLabels+1);
+        spotsMoments = QVector<CgnSpotMoments>(SpotArray::maxLabels+1);
+        spotsRuns = QVector<int32_t>(cgn_spots_runs_size(c.w));
+        spotsFound = QVector<CgnBeamResult>(maxFound);
+        slotOfSpot = QVector<int>(maxFound);
+        spotOfSlot = QVector<int>(spotsMax);
+        memset(&spots, 0, sizeof(CgnSpots));
+        spots.level = cfg.level;
+        spots.min_area = cfg.minArea;
+        spots.subtract = subtract;
+        spots.max_labels = SpotArray::maxLabels;
+        spots.parent = spotsParent.data();
+        spots.moments = spotsMoments.data();
+        spots.runs = spotsRuns.data();
+        spots.max_spots = maxFound;
+        spots.spots = spotsFound.data();
+        results.clear();
+    }
+
+    void setAperture(const RoiRect &roi, CgnBeamBkgnd &b) const
     {
         if (useRoi && roi.isValid()) {
-            g.ax1 = qRound(roi.left * double(c.w));
-            g.ay1 = qRound(roi.top * double(c.h));
-            g.ax2 = qRound(roi.right * double(c.w));
-            g.ay2 = qRound(roi.bottom * double(c.h));
+            b.ax1 = qRound(roi.left * double(c.w));
+            b.ay1 = qRound(roi.top * double(c.h));
+            b.ax2 = qRound(roi.right * double(c.w));
+            b.ay2 = qRound(roi.bottom * double(c.h));
         } else {
-            g.ax1 = 0;
-            g.ay1 = 0;
-            g.ax2 = c.w;
-            g.ay2 = c.h;
+            b.ax1 = 0;
+            b.ay1 = 0;
+            b.ax2 = c.w;
+            b.ay2 = c.h;
         }
+    }
+
+    int roisSatSize() const
+    {
+        int sz = 0;
+        CgnBeamBkgnd b;
+        for (const auto &rect : std::as_const(rois)) {
+            setAperture(rect, b);
+            sz += cgn_sat_size(b.ax2 - b.ax1, b.ay2 - b.ay1);
+        }
+        return sz;
+    }
+
+    void setRoi(const RoiRect &roi)
+    {
+        setAperture(roi, g);
         r.x1 = g.ax1;
         r.y1 = g.ay1;
         r.x2 = g.ax2;
         r.y2 = g.ay2;
     }
 
+    static const char* calibMagic(CalibMaster master)
+    {
+        return master == CALIB_DARK ? "BIDK" : master == CALIB_FLAT ? "BIFL" : "BIDF";
+    }
+
+    /// Maps the master file when it matches the current frame format,
+    /// returns pixels of the master, or null when there is no suitable file
+    const uchar* mapCalibFile(QFile &file, CalibMaster master, int pixelSize, int *offset)
+    {
+        file.setFileName(camera->calibFile(master));
+        if (!file.exists()) {
+            qWarning() << logId << "Calibration master not found" << file.fileName();
+            return nullptr;
+        }
+        if (!file.open(QIODevice::ReadOnly)) {
+            qWarning() << logId << "Unable to open calibration master" << file.fileName() << file.errorString();
+            return nullptr;
+        }
+        const uchar *data = file.size() >= qint64(sizeof(CalibFileHeader)) ? file.map(0, file.size()) : nullptr;
+        auto hdr = (const CalibFileHeader*)data;
+        const auto &a = acquired();
+        const qint64 count = !hdr ? 0 : master == CALIB_DEFECTS ? hdr->offset : qint64(a.w) * qint64(a.h);
+        if (!hdr || memcmp(hdr->magic, calibMagic(master), 4) != 0 || hdr->w != a.w || hdr->h != a.h || hdr->bpp != a.bpp
+                || count < 0 || file.size() != qint64(sizeof(CalibFileHeader)) + count * pixelSize) {
+            qWarning() << logId << "Calibration master doesn't match the current frame format" << file.fileName();
+            if (data)
+                file.unmap((uchar*)data);
+            file.close();
+            return nullptr;
+        }
+        if (offset)
+            *offset = hdr->offset;
+        return data + sizeof(CalibFileHeader);
+    }
+
+    /// Mappings stay valid after the file is closed, so they are released explicitly
+    template <typename T>
+    void unmapCalibFile(QFile &file, const T *&data)
+    {
+        if (data)
+            file.unmap((uchar*)data - sizeof(CalibFileHeader));
+        data = nullptr;
+        file.close();
+    }
+
+    void loadCalib(const Calibration &cfg)
+    {
+        unmapCalibFile(darkFile, calib.dark);
+        unmapCalibFile(flatFile, calib.gain);
+        unmapCalibFile(defectsFile, defects.idx);
+        memset(&calib, 0, sizeof(CgnCalib));
+        if (cfg.dark)
+            calib.dark = (const uint16_t*)mapCalibFile(darkFile, CALIB_DARK, sizeof(uint16_t), &calib.offset);
+        if (cfg.flat)
+            calib.gain = (const float*)mapCalibFile(flatFile, CALIB_FLAT, sizeof(float), nullptr);
+        if (cfg.defects)
+            defects.idx = (const int32_t*)mapCalibFile(defectsFile, CALIB_DEFECTS, sizeof(int32_t), &defects.count);
+        if (!defects.idx)
+            defects.count = 0;
+        useCalib = calib.dark || calib.gain;
+        useDefects = defects.count > 0;
+        if ((useCalib || useDefects) && acquired().bpp <= 8)
+            calibrated = QVector<uint8_t>(acquired().w*acquired().h);
+        else calibrated.clear();
+    }
+
+    /// Makes the master from the sum of captured frames and writes its file,
+    /// the flat field is made with the currently used dark frame
+    void saveCalib()
+    {
+        // Masters are mapped from the same files, the flat field is made with the mapped dark frame
+        if (calibCapture == CALIB_DARK) {
+            unmapCalibFile(darkFile, calib.dark);
+            unmapCalibFile(defectsFile, defects.idx);
+        } else {
+            unmapCalibFile(flatFile, calib.gain);
+        }
+        writeCalib();
+        if (calibCapture == CALIB_DARK)
+            writeDefects();
+        loadCalib(camera->config().calib);
+    }
+
+    void writeCalib()
+    {
+        const auto &a = acquired();
+        const int sz = a.w*a.h;
+        const int pixelSize = calibCapture == CALIB_DARK ? sizeof(uint16_t) : sizeof(float);
+        QByteArray data(sizeof(CalibFileHeader) + qint64(sz) * pixelSize, 0);
+        auto hdr = (CalibFileHeader*)data.data();
+        memcpy(hdr->magic, calibMagic(calibCapture), 4);
+        hdr->w = a.w;
+        hdr->h = a.h;
+        hdr->bpp = a.bpp;
+        auto pixels = data.data() + sizeof(CalibFileHeader);
+        if (calibCapture == CALIB_DARK)
+            hdr->offset = cgn_calib_make_dark(calibSum.constData(), calibTotal, sz, (uint16_t*)pixels);
+        else
+            cgn_calib_make_gain(calibSum.constData(), calibTotal, sz, calib.dark, (float*)pixels);
+        writeCalibFile(calibCapture, data);
+    }
+
+    /// Finds defect pixels in the captured dark frame series and writes their sorted indices
+    void writeDefects()
+    {
+        const auto &a = acquired();
+        const int sz = a.w*a.h;
+        QVector<uint32_t> hist(CGN_DEFECT_BINS);
+        const int count = cgn_find_defects(calibSum.constData(), calibSumSq.constData(), calibTotal, sz, a.bpp,
+            DEFECT_NOISE_LEVEL, hist.data(), nullptr, 0);
+        QByteArray data(sizeof(CalibFileHeader) + qint64(count) * sizeof(int32_t), 0);
+        auto hdr = (CalibFileHeader*)data.data();
+        memcpy(hdr->magic, calibMagic(CALIB_DEFECTS), 4);
+        hdr->w = a.w;
+        hdr->h = a.h;
+        hdr->bpp = a.bpp;
+        hdr->offset = count;
+        cgn_find_defects(calibSum.constData(), calibSumSq.constData(), calibTotal, sz, a.bpp,
+            DEFECT_NOISE_LEVEL, hist.data(), (int32_t*)(data.data() + sizeof(CalibFileHeader)), count);
+        writeCalibFile(CALIB_DEFECTS, data);
+        qDebug() << logId << "Defect pixels found:" << count;
+    }
+
+    void writeCalibFile(CalibMaster master, const QByteArray &data)
+    {
+        QFile file(camera->calibFile(master));
+        if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size())
+            qCritical() << logId << "Unable to write calibration master" << file.fileName() << file.errorString();
+        else
+            qDebug() << logId << "Calibration master saved" << file.fileName() << "| frames =" << calibTotal;
+    }
+
+    /// Frames that are displayed, saved, or requested by other components are unpacked completely,
+    /// for other ones in single ROI mode it's enough to unpack the aperture
+    inline bool needFullFrame() const
+    {
+        return rawView || multiRoi || !useRoi || calibFrame || doStack || binning > 1
+            || displayFrame
+            || rawImgRequest || brightRequest || expWarningRequest
+            || (saver && (saveBrightness || (saveImgInterval > 0 and
+                (prevSaveImg == 0 or tm - prevSaveImg >= saveImgInterval))));
+    }
+
+    /// Unpacks Mono10g40 or Mono12g24 frame into acquired() applying calibration masters, the frame brightness,
+    /// overexposure, and background of the aperture are calculated in the same pass.
+    /// Defect pixels are patched after unpacking, the brightness is taken before that.
+    /// Masters are not applied while capturing new ones.
+    inline void unpackFrame(const uint8_t *src)
+    {
+        takeCalibState();
+        frameStats.overexposure_th = EXP_WARNING_LEVEL;
+        frameStats.calib = useCalib && !calibFrame ? &calib : nullptr;
+        frameStats.defects = useDefects && !calibFrame ? &defects : nullptr;
+        frameStats.bkgnd = nullptr;
+        frameStats.x1 = frameStats.x2 = 0;
+        frameStats.y1 = frameStats.y2 = 0;
+        if (!rawView && !multiRoi) {
+            setRoi(roi);
+            // Corners are calculated over the averaged or binned image
+            if (subtract && !doStack && binning == 1 && !doSpots)
+                frameStats.bkgnd = &g;
+            if (!needFullFrame()) {
+                frameStats.x1 = g.ax1, frameStats.x2 = g.ax2;
+                frameStats.y1 = g.ay1, frameStats.y2 = g.ay2;
+            }
+        }
+        cgn_convert_packed_to_u16(src, &acquired(), &frameStats);
+        hasFrameStats = frameStats.full;
+        fullFrame = frameStats.full;
+    }
+
+    /// The capture can be toggled from the GUI meanwhile, so the frame is checked once
+    inline void takeCalibState()
+    {
+        saverMutex.lock();
+        calibFrame = calibFrames > 0;
+        saverMutex.unlock();
+    }
+
+    /// The same as unpackFrame for 8-bit frames, calibrated frames are written into own buffer
+    inline void calibrateFrame(uint8_t *src)
+    {
+        takeCalibState();
+        auto &a = acquired();
+        if ((useCalib || useDefects) && !calibFrame) {
+            a.buf = calibrated.data();
+            cgn_calibrate(src, &a, &calib);
+            if (useDefects)
+                cgn_fix_defects(&a, &defects);
+        } else {
+            a.buf = src;
+        }
+        hasHist = false;
+        saverMutex.lock();
+        const bool count = expWarningRequest && !saver;
+        saverMutex.unlock();
+        if (count)
+            countFrame();
+    }
+
+    /// Counts the histogram of 8-bit frame for the exposure warning, background of the aperture
+    /// is calculated in the same pass, like unpackFrame does for packed frames
+    inline void countFrame()
+    {
+        hist.bkgnd = nullptr;
+        if (!rawView && !multiRoi) {
+            setRoi(roi);
+            // Not for stacked or binned frames, see unpackFrame
+            if (subtract && !doStack && binning == 1 && !doSpots)
+                hist.bkgnd = &g;
+        }
+        cgn_calc_histogram(&acquired(), &hist);
+        hasHist = true;
+    }
+
+    /// Adds the frame to the stack and replaces it in place with the average of the last frames
+    /// on every stackEvery-th frame, returns false for frames that are only added
+    inline bool stackFrame()
+    {
+        cgn_stack_add(&stack, &c);
+        if (++stackSkipped < stackEvery)
+            return false;
+        stackSkipped = 0;
+        cgn_stack_average(&stack, &c);
+        return true;
+    }
+
+    inline double frameBrightness()
+    {
+        return hasFrameStats ? frameStats.brightness : cgn_calc_brightness_1(&c);
+    }
+
     void reconfigure()
     {
         cfgMutex.lock();
@@ -187,7 +675,7 @@ public:
 
     inline void markAcqTime()
     {
-        avgAcqTime = avgAcqTime*0.9 + (timer.elapsed() - tm)*0.1;
+        avgAcqTime = avgAcqTime*0.9 + (timer.elapsed() - acqTm)*0.1;
     }
 
     inline void markCalcTime()
@@ -197,75 +685,106 @@ public:
 
     inline void calcMavg(int roiIndex)
     {
+        StreamStats &s = mavgs[roiIndex];
+        const double v[MAVG_FIELDS] = { r.xc, r.yc, r.dx, r.dy, r.phi, r.p };
+        s.add(v);
+        mavgLast[roiIndex] = r;
+
         CgnBeamResult avg;
         memset(&avg, 0, sizeof(avg));
-        QQueue<CgnBeamResult> &q = mavgs[roiIndex];
-        q.enqueue(r);
-        if (q.size() > mavgFrames) {
-            const CgnBeamResult first = q.dequeue();
-            const CgnBeamResult &last = r;
-            const CgnBeamResult &prev = results.at(roiIndex);
-            const double c = q.size();
-            avg.xc = prev.xc + (last.xc - first.xc) / c;
-            avg.yc = prev.yc + (last.yc - first.yc) / c;
-            avg.dx = prev.dx + (last.dx - first.dx) / c;
-            avg.dy = prev.dy + (last.dy - first.dy) / c;
-            avg.phi = prev.phi + (last.phi - first.phi) / c;
-            avg.p = prev.p + (last.p - first.p) / c;
-        } else {
-            for (const auto &r : q) {
-                avg.xc += r.xc;
-                avg.yc += r.yc;
-                avg.dx += r.dx;
-                avg.dy += r.dy;
-                avg.phi += r.phi;
-                avg.p += r.p;
-            }
-            const double c = q.size();
-            avg.xc /= c;
-            avg.yc /= c;
-            avg.dx /= c;
-            avg.dy /= c;
-            avg.phi /= c;
-            avg.p /= c;
-        }
+        avg.xc = s.mean(MAVG_XC);
+        avg.yc = s.mean(MAVG_YC);
+        avg.dx = s.mean(MAVG_DX);
+        avg.dy = s.mean(MAVG_DY);
+        avg.phi = s.mean(MAVG_PHI);
+        avg.p = s.mean(MAVG_P);
         results[roiIndex] = avg;
 
         CgnBeamResult sdev;
         memset(&sdev, 0, sizeof(sdev));
-        for (const auto &r : q) {
-            sdev.xc += SQR(r.xc - avg.xc);
-            sdev.yc += SQR(r.yc - avg.yc);
-            sdev.dx += SQR(r.dx - avg.dx);
-            sdev.dy += SQR(r.dy - avg.dy);
-            sdev.phi += SQR(r.phi - avg.phi);
-            sdev.p += SQR(r.p - avg.p);
-        }
-        const double c = q.size();
-        sdev.xc = qSqrt(sdev.xc / c);
-        sdev.yc = qSqrt(sdev.yc / c);
-        sdev.dx = qSqrt(sdev.dx / c);
-        sdev.dy = qSqrt(sdev.dy / c);
-        sdev.phi = qSqrt(sdev.phi / c);
-        sdev.p = qSqrt(sdev.p / c);
+        sdev.xc = s.sdev(MAVG_XC);
+        sdev.yc = s.sdev(MAVG_YC);
+        sdev.dx = s.sdev(MAVG_DX);
+        sdev.dy = s.sdev(MAVG_DY);
+        sdev.phi = s.sdev(MAVG_PHI);
+        sdev.p = s.sdev(MAVG_P);
         sdevs[roiIndex] = sdev;
     }
 
+    /// Finds spots and puts them into `results` by their slots, a new spot takes the next free slot,
+    /// slots of spots that are not found in the frame get NaN results. The first slot goes into `r`.
+    inline void calcSpots()
+    {
+        setRoi(roi);
+        spots.x1 = g.ax1, spots.y1 = g.ay1;
+        spots.x2 = g.ax2, spots.y2 = g.ay2;
+        const int count = cgn_find_spots(&c, &spots);
+        cgn_match_spots(spotSlots.constData(), spotSlots.size(), spotsFound.constData(), count,
+            slotOfSpot.data(), spotOfSlot.data());
+        for (int j = 0; j < spotSlots.size(); j++) {
+            const int i = spotOfSlot.at(j);
+            if (i >= 0) {
+                spotSlots[j] = spotsFound.at(i);
+                results[j] = spotsFound.at(i);
+            } else {
+                results[j] = CgnBeamResult { .nan = true };
+            }
+        }
+        for (int i = 0; i < count && spotSlots.size() < spotsMax; i++) {
+            if (slotOfSpot.at(i) < 0 && !spotsFound.at(i).nan) {
+                spotSlots << spotsFound.at(i);
+                results << spotsFound.at(i);
+            }
+        }
+        if (results.isEmpty()) {
+            memset(&r, 0, sizeof(CgnBeamResult));
+            r.nan = true;
+        } else {
+            r = results.first();
+        }
+        if (showPower) {
+            // Total power of all spots in the frame
+            for (int i = 0; i < count; i++)
+                if (!spotsFound.at(i).nan)
+                    power += spotsFound.at(i).p;
+        }
+        cgn_spots_display_bkgnd(&spots, &g);
+    }
+
     inline void calcResult()
     {
+        if (binning > 1)
+            cgn_bin_frame(&sensor, &c, binning);
+
+        // Masters are captured from raw frames, so stacking is paused meanwhile
+        skipFrame = doStack && !calibFrame && !stackFrame();
+        if (skipFrame)
+            return;
+
         power = 0;
         powerSdev = 0;
 
         if (!rawView) {
-            if (multiRoi) {
+            if (doSpots) {
+                calcSpots();
+            } else if (multiRoi) {
                 if (subtract) {
+                    // Only pixels inside ROIs are written into `subtracted`,
+                    // the rest of the frame is only taken in showResults when it's displayed
                     g.min = 1e10;
                     g.max = -1e10;
-                    cgn_copy_to_f64(&c, g.subtracted, nullptr);
+                    for (auto &b : roiBkgnds) {
+                        b.min = 1e10;
+                        b.max = -1e10;
+                    }
                 }
+                cgn_calc_beam_bkgnd_multi(&c, roiBkgnds.data(), roiResults.data(), roiBkgnds.size());
                 for (int i = 0; i < rois.size(); i++) {
-                    setRoi(rois.at(i));
-                    cgn_calc_beam_bkgnd(&c, &g, &r);
+                    r = roiResults.at(i);
+                    if (subtract) {
+                        g.min = qMin(g.min, roiBkgnds.at(i).min);
+                        g.max = qMax(g.max, roiBkgnds.at(i).max);
+                    }
                     if (doMavg) {
                         calcMavg(i);
                     } else {
@@ -299,6 +818,16 @@ public:
         }
 
         saverMutex.lock();
+        // The capture could be toggled after the frame was taken
+        if (calibFrame && calibFrames > 0) {
+            cgn_accumulate(&acquired(), calibSum.data(), calibSumSq.isEmpty() ? nullptr : calibSumSq.data());
+            if (--calibFrames == 0) {
+                saveCalib();
+                calibCapture = CALIB_NONE;
+                calibSum.clear();
+                calibSumSq.clear();
+            }
+        }
         if (calibratePowerFrames > 0) {
             qDebug() << logId << "calibrate power"
                  << "| step =" << calibratePowerFrames
@@ -314,37 +843,45 @@ public:
                     << "| scale =" << powerScale;
             }
         }
-        if (rawImgRequest) {
+        // Requests are served on the next completely unpacked frame,
+        // or on a later one when all pooled buffers are still held by consumers
+        FrameBuf frameCopy;
+        if (rawImgRequest && fullFrame && copyFrame(frameCopy)) {
             auto e = new ImageEvent;
             e->time = 0;
-            e->buf = QByteArray((const char*)c.buf, c.w*c.h*(c.bpp > 8 ? 2 : 1));
+            e->buf = frameCopy;
             QCoreApplication::postEvent(rawImgRequest, e);
             rawImgRequest = nullptr;
         }
-        if (brightRequest) {
+        if (brightRequest && fullFrame) {
             auto e = new BrightEvent;
-            e->level = cgn_calc_brightness_1(&c);
+            e->level = frameBrightness();
             QCoreApplication::postEvent(brightRequest, e);
             brightRequest = nullptr;
         }
-        if (expWarningRequest && !saver) {
+        if (expWarningRequest && !saver && fullFrame) {
             auto e = new ExpWarningEvent;
-            e->overexposed = cgn_calc_overexposure(&c, 0.8);
+            e->overexposed = hasFrameStats ? frameStats.overexposed
+                : hasHist ? cgn_histogram_overexposure(&hist, EXP_WARNING_LEVEL)
+                : cgn_calc_overexposure(&c, EXP_WARNING_LEVEL);
             QCoreApplication::postEvent(expWarningRequest, e);
             expWarningRequest = nullptr;
         }
         if (!rawView && saver) {
-            if (saveImgInterval > 0 and (prevSaveImg == 0 or tm - prevSaveImg >= saveImgInterval)) {
+            if (saveImgInterval > 0 and fullFrame and (prevSaveImg == 0 or tm - prevSaveImg >= saveImgInterval)
+                    and copyFrame(frameCopy)) {
                 prevSaveImg = tm;
                 auto e = new ImageEvent;
                 e->time = frameTimeAbs();
-                e->buf = QByteArray((const char*)c.buf, c.w*c.h*(c.bpp > 8 ? 2 : 1));
+                e->buf = frameCopy;
                 QCoreApplication::postEvent(saver, e);
             }
             measurs->time = frameTimeAbs();
-            if (multiRoi) {
-                for (int i = 0; i < results.size(); i++) {
-                    const auto &r = results.at(i);
+            if (multiRoi || doSpots) {
+                // Slots of spots are saved up to SpotArray::maxSaved, including not used yet
+                const int count = doSpots ? qMin(spotsMax, SpotArray::maxSaved) : results.size();
+                for (int i = 0; i < count; i++) {
+                    const auto &r = i < results.size() ? results.at(i) : CgnBeamResult { .nan = true };
                     measurs->cols[MULTIRES_IDX_NAN(i)] = r.nan ? 1 : 0;
                     measurs->cols[MULTIRES_IDX_DX(i)] = r.dx;
                     measurs->cols[MULTIRES_IDX_DY(i)] = r.dy;
@@ -361,7 +898,7 @@ public:
                 measurs->phi = r.phi;
             }
             if (saveBrightness)
-                measurs->cols[COL_BRIGHTNESS] = cgn_calc_brightness_1(&c);
+                measurs->cols[COL_BRIGHTNESS] = frameBrightness();
             if (showPower && calibratePowerFrames == 0)
                 measurs->cols[COL_POWER] = power * powerScale;
             measurIdx++;
@@ -378,12 +915,24 @@ public:
         saverMutex.unlock();
     }
 
+    /// Copies the current frame into a pooled buffer once per frame, so all consumers share the same copy
+    inline bool copyFrame(FrameBuf &b)
+    {
+        if (b.isNull()) {
+            b = framePool.take();
+            if (!b.isNull())
+                memcpy(b.data(), c.buf, b.size());
+        }
+        return !b.isNull();
+    }
+
     inline void sendMeasure(bool last, bool finished)
     {
         auto e = new MeasureEvent;
         e->num = measurBufIdx;
         e->count = measurIdx;
         e->results = measurBufs[measurBufIdx % MEASURE_BUF_COUNT];
+        stats[QStringLiteral("framesQueueDropped")] = ring.dropped();
         e->stats = stats;
         e->last = last;
         e->finished = finished;
@@ -392,50 +941,48 @@ public:
         measurIdx = 0;
     }
 
+    /// Frames are shown not more often than the GUI manages to draw them,
+    /// and not while the previous one is still waiting to be shown
+    inline bool displayDue() const
+    {
+        return tm - prevReady >= plot->displayDelay() && !plot->displayPending();
+    }
+
     inline bool showResults()
     {
-        if (tm - prevReady < PLOT_FRAME_DELAY_MS)
+        if (skipFrame || !displayFrame)
             return false;
         prevReady = tm;
+        plot->beginDisplay();
         const double rangeTop = (1 << c.bpp) - 1;
 
         if (showBrightness)
-            brightness = cgn_calc_brightness_1(&c);
+            brightness = frameBrightness();
+
+        // The plot shows the previous published frame while this one is copied
+        double *graph = plot->backGraph();
 
         if (rawView)
         {
             cgn_copy_to_f64(&c, graph, &g.max);
-            plot->invalidateGraph();
-            plot->setResult({}, 0, rangeTop);
+            plot->publishGraph({}, 0, rangeTop);
             table->setResult({}, {}, tableData());
             stabil->setResult(frameTimeAbs(), {});
             return true;
         }
 
         double minZ, maxZ;
-        cgn_ext_copy_to_f64(&c, &g, graph, normalize, fullRange, &minZ, &maxZ);
-        plot->invalidateGraph();
-        plot->setResult(results, minZ, maxZ);
+        if (multiRoi && subtract)
+            cgn_ext_copy_apertures_to_f64(&c, &g, roiBkgnds.constData(), roiBkgnds.size(), graph, normalize, fullRange, &minZ, &maxZ);
+        else
+            cgn_ext_copy_to_f64(&c, &g, graph, normalize, fullRange, &minZ, &maxZ);
+        plot->publishGraph(results, minZ, maxZ);
 
         table->setResult(results, sdevs, tableData());
         
         // Stability plotter accepts the latest instant results (not averaged)
         if (doMavg) {
-            QList<CgnBeamResult> res;
-            if (multiRoi) {
-                for (int i = 0; i < rois.size(); i++) {
-                    const QQueue<CgnBeamResult> &q = mavgs.at(i);
-                    if (q.isEmpty())
-                        res << CgnBeamResult { .nan = true };
-                    else res << q.last();
-                }
-            } else {
-                const QQueue<CgnBeamResult> &q = mavgs.at(0);
-                if (q.isEmpty())
-                    res << CgnBeamResult { .nan = true };
-                else res << q.last();
-            }
-            stabil->setResult(frameTimeAbs(), res);
+            stabil->setResult(frameTimeAbs(), mavgLast);
         } else {
             stabil->setResult(frameTimeAbs(), results);
         }
@@ -448,6 +995,64 @@ public:
         qDebug() << logId << "Started" << QThread::currentThreadId();
         captureStart = QDateTime::currentMSecsSinceEpoch();
         timer.start();
+        startCalc();
+    }
+
+    /// Starts the calculation thread taking frames from the ring,
+    /// slots are big enough for unpacked frames as they come from the sensor
+    void startCalc()
+    {
+        stopCalc();
+        const auto &cfg = camera->config().queue;
+        const auto &a = acquired();
+        ring.init(std::clamp(cfg.slots, FrameQueue::minSlots, FrameQueue::maxSlots),
+            a.w*a.h*(a.bpp > 8 ? 2 : 1), cfg.policy);
+        framePool.init(FRAME_POOL_SIZE, c.w*c.h*(c.bpp > 8 ? 2 : 1));
+        calcThread.reset(QThread::create([this]{ calcLoop(); }));
+        calcThread->start();
+    }
+
+    /// Stops the calculation thread, frames left in the ring are not calculated
+    void stopCalc()
+    {
+        if (!calcThread)
+            return;
+        calcThread->requestInterruption();
+        ring.wake();
+        calcThread->wait();
+        calcThread.reset();
+        qDebug() << logId << "Calculation stopped | queue dropped =" << ring.dropped();
+    }
+
+    void calcLoop()
+    {
+        qDebug() << logId << "Calculation started" << QThread::currentThreadId();
+        while (!QThread::currentThread()->isInterruptionRequested()) {
+            if (auto buf = ring.beginRead(CALC_WAIT_MS); buf) {
+                tm = timer.elapsed();
+                // The GUI changes the display state meanwhile, but the frame
+                // must be unpacked completely when it's going to be shown
+                displayFrame = displayDue();
+                takeFrame(buf);
+                calcResult();
+                markCalcTime();
+                if (showResults())
+                    frameShown();
+                ring.endRead();
+            }
+            checkReconfig();
+        }
+    }
+
+    /// Returns the ring slot for the next frame, or nullptr when the frame is dropped
+    inline uint8_t* beginFrame()
+    {
+        return ring.beginWrite();
+    }
+
+    inline void endFrame()
+    {
+        ring.endWrite();
     }
     
     inline qint64 frameTimeAbs()
@@ -521,6 +1126,24 @@ public:
         }
         saverMutex.unlock();
     }
+
+    void toggleCalibration(CalibMaster capture)
+    {
+        saverMutex.lock();
+        calibCapture = capture;
+        calibFrames = capture == CALIB_NONE ? 0 :
+            std::clamp(camera->config().calib.frames, Calibration::minFrames, Calibration::maxFrames);
+        calibTotal = calibFrames;
+        const int sz = acquired().w*acquired().h;
+        if (calibFrames > 0)
+            calibSum = QVector<uint32_t>(sz, 0);
+        else calibSum.clear();
+        // Temporal variance of the dark series is needed to find stuck pixels
+        if (capture == CALIB_DARK)
+            calibSumSq = QVector<uint64_t>(sz, 0);
+        else calibSumSq.clear();
+        saverMutex.unlock();
+    }
 };
 
 #endif // CAMERA_WORKER
@@ -0,0 +1,135 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <QByteArray>
+
+#include <atomic>
+#include <memory>
+
+struct FramePoolData
+{
+    int count;
+    int size;
+    /// Distance between buffers, rounded up so each buffer starts aligned
+    qint64 stride;
+    uint8_t *mem;
+    std::unique_ptr<std::atomic<int>[]> refs;
+    /// The pool itself and every handle, the memory is freed when the last of them is gone,
+    /// so handles posted in events can outlive the worker that has made them
+    std::atomic<int> users;
+
+    FramePoolData(int count, int size) : count(count), size(size), refs(new std::atomic<int>[count]), users(1)
+    {
+        stride = (qint64(size) + ALIGN - 1) / ALIGN * ALIGN;
+        mem = (uint8_t*)qMallocAligned(count * stride, ALIGN);
+        for (int i = 0; i < count; i++)
+            refs[i].store(0);
+    }
+
+    ~FramePoolData()
+    {
+        qFreeAligned(mem);
+    }
+
+    void release()
+    {
+        if (users.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete this;
+    }
+
+    enum { ALIGN = 64 };
+};
+
+/// Reference counted handle to a frame buffer of FramePool.
+/// Copies share the same buffer, it goes back to the pool when the last copy is destroyed.
+class FrameBuf
+{
+public:
+    FrameBuf() {}
+    FrameBuf(const FrameBuf &b) : _pool(b._pool), _slot(b._slot) { ref(); }
+    FrameBuf(FrameBuf &&b) noexcept : _pool(b._pool), _slot(b._slot) { b._pool = nullptr; }
+    ~FrameBuf() { unref(); }
+
+    FrameBuf& operator =(FrameBuf b) noexcept
+    {
+        std::swap(_pool, b._pool);
+        std::swap(_slot, b._slot);
+        return *this;
+    }
+
+    bool isNull() const { return !_pool; }
+    int size() const { return _pool ? _pool->size : 0; }
+    uint8_t* data() const { return _pool ? _pool->mem + _slot * _pool->stride : nullptr; }
+
+    /// Wraps the buffer without copying, the result is only valid while the handle is alive
+    QByteArray bytes() const { return QByteArray::fromRawData((const char*)data(), size()); }
+
+private:
+    friend class FramePool;
+    FramePoolData *_pool = nullptr;
+    int _slot = 0;
+
+    void ref()
+    {
+        if (!_pool) return;
+        _pool->users.fetch_add(1, std::memory_order_relaxed);
+        _pool->refs[_slot].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void unref()
+    {
+        if (!_pool) return;
+        _pool->refs[_slot].fetch_sub(1, std::memory_order_release);
+        _pool->release();
+        _pool = nullptr;
+    }
+};
+
+/// Preallocated aligned frame buffers shared between the camera worker and consumers of frames
+/// (measurement saver, raw image export) without copying them on each request.
+/// Buffers are allocated once in init, so taking them while capturing doesn't touch the heap.
+class FramePool
+{
+public:
+    FramePool() {}
+    FramePool(const FramePool&) = delete;
+    FramePool& operator =(const FramePool&) = delete;
+    ~FramePool() { reset(); }
+
+    void init(int count, int frameSize)
+    {
+        reset();
+        _data = new FramePoolData(count, frameSize);
+    }
+
+    void reset()
+    {
+        if (_data) {
+            _data->release();
+            _data = nullptr;
+        }
+    }
+
+    /// Returns a buffer not used by anyone, or a null handle when all of them are still in use
+    FrameBuf take()
+    {
+        FrameBuf b;
+        if (!_data)
+            return b;
+        for (int i = 0; i < _data->count; i++) {
+            int free = 0;
+            if (_data->refs[i].compare_exchange_strong(free, 1, std::memory_order_acquire)) {
+                _data->users.fetch_add(1, std::memory_order_relaxed);
+                b._pool = _data;
+                b._slot = i;
+                break;
+            }
+        }
+        return b;
+    }
+
+private:
+    FramePoolData *_data = nullptr;
+};
+
+#endif // FRAME_POOL_H
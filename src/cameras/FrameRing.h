@@ -0,0 +1,154 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include "cameras/CameraTypes.h"
+
+#include <QSemaphore>
+#include <QVector>
+
+#include <atomic>
+#include <memory>
+
+/// Bounded ring of frame slots handing frames from the acquisition thread to the calculation thread.
+/// Slots change their states by atomic exchanges only, so the writer doesn't wait for the reader
+/// unless the DROP_NONE policy is used. Frames are read in the order they have been written.
+/// Semaphores are only used to sleep while there is nothing to read or no slot to write.
+///
+/// A slot state is kept together with the number of the frame in the slot in one word,
+/// so a slot that has been overwritten and written again can't be taken by a stale exchange.
+class FrameRing
+{
+public:
+    void init(int slots, int frameSize, FrameDropPolicy policy)
+    {
+        _count = qMax(slots, 2);
+        _frameSize = frameSize;
+        _policy = policy;
+        _data = QVector<uint8_t>(qint64(_count) * frameSize);
+        _slots.reset(new std::atomic<quint64>[_count]);
+        for (int i = 0; i < _count; i++)
+            _slots[i].store(FREE);
+        _seq.store(0);
+        _dropped.store(0);
+        _written.acquire(_written.available());
+        _freed.acquire(_freed.available());
+    }
+
+    int frameSize() const { return _frameSize; }
+
+    /// Frames that were overwritten or not accepted because the calculation was behind
+    int dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+    /// Returns the buffer for the next frame, or nullptr when the frame should be dropped.
+    /// When all slots are full, the oldest frame is overwritten (DROP_OLDEST), the new one is dropped
+    /// (DROP_NEWEST), or the writer waits for the reader up to BLOCK_TIMEOUT_MS (DROP_NONE).
+    uint8_t* beginWrite()
+    {
+        for (int wait = 0; ; wait += WAIT_STEP_MS) {
+            if (takeSlot(FREE))
+                break;
+            if (_policy == DROP_OLDEST && takeSlot(READY)) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+            if (_policy == DROP_NEWEST || wait >= BLOCK_TIMEOUT_MS) {
+                _dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            if (_policy == DROP_NONE)
+                _freed.tryAcquire(1, WAIT_STEP_MS);
+        }
+        return _data.data() + qint64(_w) * _frameSize;
+    }
+
+    /// Makes the frame written after beginWrite available for reading
+    void endWrite()
+    {
+        const quint64 seq = _seq.load(std::memory_order_relaxed) + 1;
+        _slots[_w].store(seq << 2 | READY, std::memory_order_release);
+        _seq.store(seq, std::memory_order_release);
+        _written.release();
+    }
+
+    /// Returns the oldest written frame, waits for it up to `timeoutMs`, returns nullptr on timeout
+    uint8_t* beginRead(int timeoutMs)
+    {
+        while (true) {
+            const quint64 seq = _seq.load(std::memory_order_acquire);
+            quint64 word;
+            const int oldest = findOldest(READY, &word, std::memory_order_acquire);
+            if (oldest < 0) {
+                if (!_written.tryAcquire(1, timeoutMs))
+                    return nullptr;
+                continue;
+            }
+            // An older frame could be written into a slot that has already been scanned,
+            // and the slot could be overwritten with a newer frame after it has been found
+            if (_seq.load(std::memory_order_acquire) != seq
+                    || !_slots[oldest].compare_exchange_strong(word, (word & ~STATE_MASK) | READING, std::memory_order_acquire))
+                continue;
+            _r = oldest;
+            _written.tryAcquire();
+            return _data.data() + qint64(_r) * _frameSize;
+        }
+    }
+
+    /// Returns the slot taken by beginRead to the writer
+    void endRead()
+    {
+        _slots[_r].store(FREE, std::memory_order_release);
+        if (_policy == DROP_NONE)
+            _freed.release();
+    }
+
+    /// Wakes up the reader waiting in beginRead
+    void wake()
+    {
+        _written.release();
+    }
+
+private:
+    enum SlotState { FREE, WRITING, READY, READING, STATE_MASK = 3 };
+    enum { WAIT_STEP_MS = 10, BLOCK_TIMEOUT_MS = 1000 };
+
+    int _count = 0;
+    int _frameSize = 0;
+    FrameDropPolicy _policy = DROP_OLDEST;
+    QVector<uint8_t> _data;
+    /// Number of the frame in the slot shifted by 2 bits, and the slot state in the low bits
+    std::unique_ptr<std::atomic<quint64>[]> _slots;
+    /// Number of the last written frame
+    std::atomic<quint64> _seq { 0 };
+    std::atomic<int> _dropped { 0 };
+    QSemaphore _written;
+    QSemaphore _freed;
+    int _w = 0;
+    int _r = 0;
+
+    /// Returns the slot in the given state holding the oldest frame and its word, or -1
+    int findOldest(SlotState state, quint64 *word, std::memory_order order) const
+    {
+        int slot = -1;
+        for (int i = 0; i < _count; i++) {
+            const quint64 w = _slots[i].load(order);
+            if ((w & STATE_MASK) == state && (slot < 0 || w < *word))
+                slot = i, *word = w;
+        }
+        return slot;
+    }
+
+    /// Takes the slot in the given state for writing, the one with the oldest frame when there are several
+    bool takeSlot(SlotState state)
+    {
+        quint64 word;
+        const int slot = findOldest(state, &word, std::memory_order_relaxed);
+        if (slot < 0 || !_slots[slot].compare_exchange_strong(word, (word & ~STATE_MASK) | WRITING, std::memory_order_acquire))
+            return false;
+        _w = slot;
+        if (_policy == DROP_NONE)
+            _freed.tryAcquire();
+        return true;
+    }
+};
+
+#endif // FRAME_RING_H
@@ -17,7 +17,7 @@
 //#define FAKE_CAM_ID 100
 
 enum CamDataRow { ROW_RENDER_TIME, ROW_CALC_TIME,
-    ROW_FRAME_ERR, ROW_FRAME_UNDERRUN, ROW_FRAME_DROPPED, ROW_FRAME_INCOMPLETE,
+    ROW_FRAME_ERR, ROW_FRAME_UNDERRUN, ROW_FRAME_DROPPED, ROW_FRAME_INCOMPLETE, ROW_QUEUE_DROPPED,
     ROW_BRIGHTNESS, ROW_POWER };
 
 static QString makeDisplayName(const peak_camera_descriptor &cam, const QString &suffix = QString())
@@ -74,6 +74,7 @@ public:
                 { ROW_FRAME_DROPPED, {framesDropped, CamTableData::COUNT, framesDropped > 0} },
                 { ROW_FRAME_UNDERRUN, {framesUnderrun, CamTableData::COUNT, framesUnderrun > 0} },
                 { ROW_FRAME_INCOMPLETE, {framesIncomplete, CamTableData::COUNT, framesIncomplete > 0} },
+                { ROW_QUEUE_DROPPED, {ring.dropped(), CamTableData::COUNT, ring.dropped() > 0} },
             };
             if (showBrightness)
                 data[ROW_BRIGHTNESS] = {brightness, CamTableData::VALUE3};
@@ -89,6 +90,13 @@ public:
                 };
             return data;
         };
+        takeFrame = [this](uint8_t *buf){
+            if (acquired().bpp > 8)
+                unpackFrame(buf);
+            else
+                calibrateFrame(buf);
+        };
+        frameShown = [this]{ emit cam->ready(); };
     }
 
     QString initResolution()
@@ -363,10 +371,13 @@ public:
         if (auto err = initResolution(); !err.isEmpty()) return err;
         if (auto err = getImageSize(); !err.isEmpty()) return err;
         if (auto err = initPixelFormat(); !err.isEmpty()) return err;
+        initBinning();
+        cam->_width = c.w;
+        cam->_height = c.h;
+        cam->_binning = binning;
         if (auto err = showCurrProps(); !err.isEmpty()) return err;
 
         plot->initGraph(c.w, c.h);
-        graph = plot->rawGraph();
 
         configure();
 
@@ -405,12 +416,12 @@ public:
     {
         startCapture();
         while (true) {
-            tm = timer.elapsed();
+            acqTm = timer.elapsed();
             avgFrameCount++;
-            avgFrameTime += tm - prevFrame;
-            prevFrame = tm;
+            avgFrameTime += acqTm - prevFrame;
+            prevFrame = acqTm;
 
-            tm = timer.elapsed();
+            acqTm = timer.elapsed();
             res = IDS.peak_Acquisition_WaitForFrame(hCam, FRAME_TIMEOUT, &frame);
             if (PEAK_SUCCESS(res))
                 res = IDS.peak_Frame_Buffer_Get(frame, &buf);
@@ -423,18 +434,12 @@ public:
             markAcqTime();
 
             if (res == PEAK_STATUS_SUCCESS) {
-                tm = timer.elapsed();
-                if (c.bpp == 12)
-                    cgn_convert_12g24_to_u16(c.buf, buf.memoryAddress, buf.memorySize);
-                else if (c.bpp == 10)
-                    cgn_convert_10g40_to_u16(c.buf, buf.memoryAddress, buf.memorySize);
-                else
-                    c.buf = buf.memoryAddress;
-                calcResult();
-                markCalcTime();
-
-                if (showResults())
-                    emit cam->ready();
+                // The frame is copied so the driver buffer is returned
+                // without waiting for the calculation of previous frames
+                if (auto slot = beginFrame(); slot) {
+                    memcpy(slot, buf.memoryAddress, qMin(buf.memorySize, size_t(ring.frameSize())));
+                    endFrame();
+                }
 
                 res = IDS.peak_Frame_Release(hCam, frame);
                 if (PEAK_ERROR(res)) {
@@ -445,13 +450,15 @@ public:
                 }
             } else {
                 framesErr++;
+                saverMutex.lock();
                 stats[QStringLiteral("frameErrors")] = framesErr;
                 QString errKey = QStringLiteral("frameError_") + QString::number(res, 16);
                 stats[errKey] = stats[errKey].toInt() + 1;
+                saverMutex.unlock();
             }
 
-            if (tm - prevStat >= STAT_DELAY_MS) {
-                prevStat = tm;
+            if (acqTm - prevStat >= STAT_DELAY_MS) {
+                prevStat = acqTm;
 
                 peak_acquisition_info info;
                 memset(&info, 0, sizeof(info));
@@ -460,9 +467,11 @@ public:
                     framesDropped = info.numDropped;
                     framesUnderrun = info.numUnderrun;
                     framesIncomplete = info.numIncomplete;
+                    saverMutex.lock();
                     stats[QStringLiteral("framesDropped")] = framesDropped;
                     stats[QStringLiteral("framesUnderrun")] = framesUnderrun;
                     stats[QStringLiteral("framesIncomplete")] = framesIncomplete;
+                    saverMutex.unlock();
                 }
 
                 double hardFps;
@@ -494,7 +503,6 @@ public:
                     qDebug() << LOG_ID << "Interrupted by user";
                     return;
                 }
-                checkReconfig();
             }
         }
     }
@@ -586,7 +594,8 @@ IdsCamera::~IdsCamera()
 
 int IdsCamera::bpp() const
 {
-    return _cfg->bpp;
+    // Software binning extends the pixel format
+    return _peak ? _peak->c.bpp : _cfg->bpp;
 }
 
 PixelScale IdsCamera::sensorScale() const
@@ -603,7 +612,8 @@ TableRowsSpec IdsCamera::tableRows() const
         << qMakePair(ROW_FRAME_ERR, qApp->tr("Errors"))
         << qMakePair(ROW_FRAME_DROPPED, qApp->tr("Dropped"))
         << qMakePair(ROW_FRAME_UNDERRUN, qApp->tr("Underrun"))
-        << qMakePair(ROW_FRAME_INCOMPLETE, qApp->tr("Incomplete"));
+        << qMakePair(ROW_FRAME_INCOMPLETE, qApp->tr("Incomplete"))
+        << qMakePair(ROW_QUEUE_DROPPED, qApp->tr("Queue dropped"));
     if (_cfg->showBrightness)
         rows.aux << qMakePair(ROW_BRIGHTNESS, qApp->tr("Brightness"));
     if (_config.power.on)
@@ -646,8 +656,10 @@ void IdsCamera::stopMeasure()
 
 void IdsCamera::run()
 {
-    if (_peak)
+    if (_peak) {
         _peak->run();
+        _peak->stopCalc();
+    }
 }
 
 void IdsCamera::camConfigChanged()
@@ -758,6 +770,12 @@ void IdsCamera::togglePowerMeter()
         _peak->togglePowerMeter();
 }
 
+void IdsCamera::toggleCalibration(CalibMaster capture)
+{
+    if (_peak)
+        _peak->toggleCalibration(capture);
+}
+
 void IdsCamera::raisePowerWarning()
 {
     if (_peak)
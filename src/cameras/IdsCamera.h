@@ -47,6 +47,9 @@ public:
     void togglePowerMeter() override;
     void raisePowerWarning() override;
 
+    bool canCalibrate() const override { return true; }
+    void toggleCalibration(CalibMaster capture) override;
+
     void requestExpWarning();
 
     bool canMavg() const override { return true; }
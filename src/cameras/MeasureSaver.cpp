@@ -294,14 +294,6 @@ QString MeasureSaver::start(const MeasureConfig &cfg, Camera *cam)
     _intervalBeg = -1;
     _intervalLen = _config.intervalSecs * 1000;
     _intervalIdx = 0;
-    _avg_xc = 0, _avg_yc = 0;
-    _avg_dx = 0, _avg_dy = 0;
-    _avg_phi = 0;
-    _avg_cnt = 0;
-    _auxAvgVals = {};
-    _auxAvgCnt = 0;
-    _multires_avg.clear();
-    _multires_avg_cnt.clear();
     _scale = cam->pixelScale().scaleFactor();
     _prevFrameTime = 0;
 
@@ -319,6 +311,14 @@ QString MeasureSaver::start(const MeasureConfig &cfg, Camera *cam)
         journal.write("error", res);
         return res;
     }
+
+    // Column sets are known after the results file is prepared
+    _avg.init(AVG_FIELDS);
+    _multiresAvg = QVector<StreamStats>(_multires_cnt);
+    for (auto &s : _multiresAvg)
+        s.init(AVG_FIELDS);
+    _auxAvg.init(_auxCols.size());
+    _auxVals = QVector<double>(_auxCols.size());
     
 #ifdef SAVE_CHECK_FILE
     QFile checkFile(_config.fileName + ".check");
@@ -387,6 +387,8 @@ QString MeasureSaver::saveIniFile(Camera *cam)
     s.beginGroup("Camera");
     s.setValue("name", cam->name());
     s.setValue("resolution", cam->resolutionStr());
+    if (cam->binning() > 1)
+        s.setValue("softwareBinning", cam->binning());
     s.setValue("sensorScale.on", sensorScale.on);
     if (sensorScale.on) {
         s.setValue("sensorScale.factor", sensorScale.factor);
@@ -437,11 +439,19 @@ QString MeasureSaver::prepareCsvFile(Camera *cam)
     QTextStream out(&headerLine);
     out << "Index"
         << SEP << "Timestamp";
-    if (camConfig.roiMode == ROI_MULTI) {
-        _multires_cnt = camConfig.rois.size();
+    if (camConfig.spots.on || camConfig.roiMode == ROI_MULTI) {
+        // The worker saves slots of spots up to SpotArray::maxSaved, see CameraWorker::calcResult
+        _multires_cnt = camConfig.spots.on
+            ? std::clamp(camConfig.spots.maxCount, 1, SpotArray::maxSaved)
+            : camConfig.rois.size();
         for (int i = 0; i < _multires_cnt; i++) {
-            const auto &roi = camConfig.rois.at(i);
-            QString colSuffix = roi.label.isEmpty() ? QString("#%1").arg(i) : roi.label;
+            QString colSuffix;
+            if (camConfig.spots.on) {
+                colSuffix = QString("Spot #%1").arg(i);
+            } else {
+                const auto &roi = camConfig.rois.at(i);
+                colSuffix = roi.label.isEmpty() ? QString("#%1").arg(i) : roi.label;
+            }
             out
                 << SEP << "Center X (" << colSuffix << ')'
                 << SEP << "Center Y (" << colSuffix << ')'
@@ -577,28 +587,26 @@ void MeasureSaver::processMeasure(MeasureEvent *e)
                 for (int j = 0; j < _multires_cnt; j++) {
                     const bool nan = r.cols[MULTIRES_IDX_NAN(j)] == 1;
                     if (!nan) {
-                        _multires_avg[MULTIRES_IDX_XC(j)] += r.cols[MULTIRES_IDX_XC(j)];
-                        _multires_avg[MULTIRES_IDX_YC(j)] += r.cols[MULTIRES_IDX_YC(j)];
-                        _multires_avg[MULTIRES_IDX_DX(j)] += r.cols[MULTIRES_IDX_DX(j)];
-                        _multires_avg[MULTIRES_IDX_DY(j)] += r.cols[MULTIRES_IDX_DY(j)];
-                        _multires_avg[MULTIRES_IDX_PHI(j)] += r.cols[MULTIRES_IDX_PHI(j)];
-                        _multires_avg_cnt[j]++;
+                        const double v[AVG_FIELDS] = {
+                            r.cols[MULTIRES_IDX_XC(j)],
+                            r.cols[MULTIRES_IDX_YC(j)],
+                            r.cols[MULTIRES_IDX_DX(j)],
+                            r.cols[MULTIRES_IDX_DY(j)],
+                            r.cols[MULTIRES_IDX_PHI(j)],
+                        };
+                        _multiresAvg[j].add(v);
                     }
                 }
             } else {
                 if (!r.nan) {
-                    _avg_xc += r.xc;
-                    _avg_yc += r.yc;
-                    _avg_dx += r.dx;
-                    _avg_dy += r.dy;
-                    _avg_phi += r.phi;
-                    _avg_cnt++;
+                    const double v[AVG_FIELDS] = { r.xc, r.yc, r.dx, r.dy, r.phi };
+                    _avg.add(v);
                 }
             }
             if (!_auxCols.empty()) {
-                for (const auto &id : std::as_const(_auxCols))
-                    _auxAvgVals[id] += r.cols.value(id);
-                _auxAvgCnt++;
+                for (int j = 0; j < _auxCols.size(); j++)
+                    _auxVals[j] = r.cols.value(_auxCols.at(j));
+                _auxAvg.add(_auxVals.constData());
             }
             _prevFrameTime = r.time;
 
@@ -660,51 +668,39 @@ void MeasureSaver::processMeasure(MeasureEvent *e)
 
 void MeasureSaver::calcIntervalAverage(QTextStream &out, const Measurement &r)
 {
-    if (!_auxCols.empty())
-        for (const auto &id : std::as_const(_auxCols))
-            if (id < MULTIRES_IDX)
-                _auxAvgVals[id] /= _auxAvgCnt;
+    QMap<int, double> auxAvgVals;
+    for (int j = 0; j < _auxCols.size(); j++)
+        auxAvgVals[_auxCols.at(j)] = _auxAvg.mean(j);
 
     OUT_TIME(_prevFrameTime);
 
     if (_multires_cnt) {
-        for (int j = 0; j < _multires_cnt; j++) {
-            const int avg_cnt = _multires_avg_cnt[j];
-            const double avg_xc = _multires_avg[MULTIRES_IDX_XC(j)];
-            const double avg_yc = _multires_avg[MULTIRES_IDX_YC(j)];
-            const double avg_dx = _multires_avg[MULTIRES_IDX_DX(j)];
-            const double avg_dy = _multires_avg[MULTIRES_IDX_DY(j)];
-            const double avg_phi = _multires_avg[MULTIRES_IDX_PHI(j)];
-            OUT_ROW(avg_cnt == 0,
-                    avg_xc / avg_cnt,
-                    avg_yc / avg_cnt,
-                    avg_dx / avg_cnt,
-                    avg_dy / avg_cnt,
-                    avg_phi / avg_cnt
+        for (auto &avg : _multiresAvg) {
+            OUT_ROW(avg.isEmpty(),
+                    avg.mean(AVG_XC),
+                    avg.mean(AVG_YC),
+                    avg.mean(AVG_DX),
+                    avg.mean(AVG_DY),
+                    avg.mean(AVG_PHI)
                     );
+            avg.clear();
         }
-        _multires_avg.clear();
-        _multires_avg_cnt.clear();
     } else {
-        OUT_ROW(_avg_cnt == 0,
-                _avg_xc / _avg_cnt,
-                _avg_yc / _avg_cnt,
-                _avg_dx / _avg_cnt,
-                _avg_dy / _avg_cnt,
-                _avg_phi / _avg_cnt
+        OUT_ROW(_avg.isEmpty(),
+                _avg.mean(AVG_XC),
+                _avg.mean(AVG_YC),
+                _avg.mean(AVG_DX),
+                _avg.mean(AVG_DY),
+                _avg.mean(AVG_PHI)
                 );
-        _avg_xc = 0, _avg_yc = 0;
-        _avg_dx = 0, _avg_dy = 0;
-        _avg_phi = 0;
-        _avg_cnt = 0;
+        _avg.clear();
     }
 
-    OUT_AUX(_auxAvgVals);
+    OUT_AUX(auxAvgVals);
 
     _intervalIdx++;
     _intervalBeg = r.time;
-    _auxAvgVals = {};
-    _auxAvgCnt = 0;
+    _auxAvg.clear();
 }
 
 void MeasureSaver::stopFail(const QString &error)
@@ -739,7 +735,7 @@ void MeasureSaver::saveImage(ImageEvent *e)
 {
     QString time = formatTime(e->time, QStringLiteral("yyyy-MM-ddThh-mm-ss-zzz"));
     QString path = _imgDir + '/' + time + ".pgm";
-    QString err = ImageUtils::savePgm(path, e->buf, _width, _height, _bpp);
+    QString err = ImageUtils::savePgm(path, e->buf.bytes(), _width, _height, _bpp);
     if (!err.isEmpty()) {
         qWarning() << LOG_ID << "Failed to save image" << path << err;
         _errors.insert(e->time, "Failed to save image " + path + ": " + err);
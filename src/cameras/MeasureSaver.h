@@ -1,6 +1,9 @@
 #ifndef MEASURE_SAVER_H
 #define MEASURE_SAVER_H
 
+#include "app/StreamStats.h"
+#include "cameras/FramePool.h"
+
 #include <QDateTime>
 #include <QEvent>
 #include <QMap>
@@ -93,7 +96,8 @@ public:
     ImageEvent() : QEvent(QEvent::User) {}
 
     qint64 time;
-    QByteArray buf;
+    /// The frame is shared with other consumers, don't modify it
+    FrameBuf buf;
 };
 
 class MeasureSaver : public QObject
@@ -130,16 +134,16 @@ private:
     qint64 _intervalBeg;
     qint64 _intervalLen;
     int _intervalIdx;
-    double _avg_xc, _avg_yc, _avg_dx, _avg_dy, _avg_phi;
-    double _avg_cnt;
-    QMap<int, double> _multires_avg;
-    QMap<int, int> _multires_avg_cnt;
+    /// Averages of the current interval
+    enum AvgField { AVG_XC, AVG_YC, AVG_DX, AVG_DY, AVG_PHI, AVG_FIELDS };
+    StreamStats _avg;
+    QVector<StreamStats> _multiresAvg;
     int _multires_cnt = 0;
     int _savedImgCount = 0;
     qint64 _elapsedSecs = 0;
     QList<int> _auxCols;
-    QMap<int, double> _auxAvgVals;
-    double _auxAvgCnt;
+    StreamStats _auxAvg;
+    QVector<double> _auxVals;
     qint64 _prevFrameTime;
     std::unique_ptr<CsvFile> _csvFile;
     std::unique_ptr<QLockFile> _lockFile;
@@ -1,5 +1,6 @@
 #include "StillImageCamera.h"
 
+#include "app/AppSettings.h"
 #include "plot/PlotExport.h"
 #include "widgets/PlotIntf.h"
 #include "widgets/StabilityIntf.h"
@@ -183,6 +184,25 @@ void StillImageCamera::startCapture()
         c.buf = (uint8_t*)buf;
     }
 
+    // The binned frame replaces the loaded one for the calculation and the display
+    QVector<uint16_t> binned;
+    _binning = _config.binning;
+    if ((_binning == 2 || _binning == 4) && c.w >= _binning && c.h >= _binning) {
+        CgnBeamCalc b = c;
+        b.w = c.w / _binning;
+        b.h = c.h / _binning;
+        b.bpp = cgn_binned_bpp(c.bpp, _binning);
+        binned = QVector<uint16_t>(b.w*b.h);
+        b.buf = (uint8_t*)binned.data();
+        cgn_bin_frame(&c, &b, _binning);
+        c = b;
+        _width = c.w;
+        _height = c.h;
+        _bpp = c.bpp;
+    } else {
+        _binning = 1;
+    }
+
     _plot->initGraph(c.w, c.h);
     double *graph = _plot->rawGraph();
 
@@ -209,21 +229,28 @@ void StillImageCamera::startCapture()
     g.corner_fraction = _config.bgnd.corner;
     g.nT = _config.bgnd.noise;
     g.mask_diam = _config.bgnd.mask;
+    g.calc_beam_v = 1;
 
-    auto roiMode = _config.roiMode;
+    // Spots are searched over the single region or the whole frame
+    const bool spots = _config.spots.on;
+    auto roiMode = spots && _config.roiMode == ROI_MULTI ? ROI_NONE : _config.roiMode;
 
-    auto setRoi = [&c, &g, &r, roiMode](const RoiRect &roi){
+    auto setAperture = [&c, roiMode](const RoiRect &roi, CgnBeamBkgnd &b){
         if (roiMode != ROI_NONE && roi.isValid()) {
-            g.ax1 = qRound(roi.left * double(c.w));
-            g.ay1 = qRound(roi.top * double(c.h));
-            g.ax2 = qRound(roi.right * double(c.w));
-            g.ay2 = qRound(roi.bottom * double(c.h));
+            b.ax1 = qRound(roi.left * double(c.w));
+            b.ay1 = qRound(roi.top * double(c.h));
+            b.ax2 = qRound(roi.right * double(c.w));
+            b.ay2 = qRound(roi.bottom * double(c.h));
         } else {
-            g.ax1 = 0;
-            g.ay1 = 0;
-            g.ax2 = c.w;
-            g.ay2 = c.h;
+            b.ax1 = 0;
+            b.ay1 = 0;
+            b.ax2 = c.w;
+            b.ay2 = c.h;
         }
+    };
+
+    auto setRoi = [&g, &r, &setAperture](const RoiRect &roi){
+        setAperture(roi, g);
         r.x1 = g.ax1;
         r.y1 = g.ay1;
         r.x2 = g.ax2;
@@ -231,25 +258,100 @@ void StillImageCamera::startCapture()
     };
 
     bool subtract = _config.bgnd.on;
+    g.subtract_bkgnd_v = roiMode == ROI_MULTI ? 1 : (subtract ? 2 : 0);
     QVector<double> subtracted;
-    if (subtract) {
-        subtracted = QVector<double>(c.w*c.h);
-        g.subtracted = subtracted.data();
+    QVector<float> subtractedF32;
+    if (subtract && g.subtract_bkgnd_v == 1) {
+        if (AppSettings::instance().calcSinglePrecision) {
+            subtractedF32 = QVector<float>(c.w*c.h);
+            g.subtracted_f32 = subtractedF32.data();
+        } else {
+            subtracted = QVector<double>(c.w*c.h);
+            g.subtracted = subtracted.data();
+        }
+    }
+    // Per-ROI states for cgn_calc_beam_bkgnd_multi
+    QVector<CgnBeamBkgnd> roiBkgnds;
+    if (roiMode == ROI_MULTI) {
+        for (const auto &roi : std::as_const(_config.rois)) {
+            CgnBeamBkgnd b = g;
+            setAperture(roi, b);
+            roiBkgnds << b;
+        }
+    }
+    QVector<double> sat;
+    if (subtract && _config.bgnd.sat) {
+        int satSize = 0;
+        if (roiMode == ROI_MULTI) {
+            for (const auto &b : std::as_const(roiBkgnds))
+                satSize += cgn_sat_size(b.ax2 - b.ax1, b.ay2 - b.ay1);
+        } else {
+            satSize = cgn_sat_size(c.w, c.h);
+        }
+        sat = QVector<double>(satSize);
+        g.sat = sat.data();
+        g.calc_beam_v = 2;
+        double *roiSat = g.sat;
+        for (auto &b : roiBkgnds) {
+            b.sat = roiSat;
+            b.calc_beam_v = 2;
+            roiSat += cgn_sat_size(b.ax2 - b.ax1, b.ay2 - b.ay1);
+        }
+    }
+
+    QVector<uint16_t> decimated;
+    if (subtract && roiMode != ROI_MULTI && _config.bgnd.decimate > 1) {
+        decimated = QVector<uint16_t>(cgn_decimated_size(c.w, c.h, _config.bgnd.decimate));
+        g.decimate = _config.bgnd.decimate;
+        g.decimated = decimated.data();
     }
 
     timer.restart();
-    if (_config.roiMode == ROI_MULTI)
+    if (spots)
+    {
+        QVector<int32_t> parent(SpotArray::maxLabels+1);
+        QVector<CgnSpotMoments> moments(SpotArray::maxLabels+1);
+        QVector<int32_t> runs(cgn_spots_runs_size(c.w));
+        QVector<CgnBeamResult> found(std::clamp(_config.spots.maxCount, 1, SpotArray::maxSpots));
+        setRoi(_config.roi);
+        CgnSpots s;
+        memset(&s, 0, sizeof(CgnSpots));
+        s.x1 = g.ax1, s.y1 = g.ay1;
+        s.x2 = g.ax2, s.y2 = g.ay2;
+        s.level = _config.spots.level;
+        s.min_area = _config.spots.minArea;
+        s.subtract = subtract;
+        s.max_labels = SpotArray::maxLabels;
+        s.parent = parent.data();
+        s.moments = moments.data();
+        s.runs = runs.data();
+        s.max_spots = found.size();
+        s.spots = found.data();
+        const int count = cgn_find_spots(&c, &s);
+        for (int i = 0; i < count; i++)
+            results << found.at(i);
+        if (s.overflow)
+            qWarning() << LOG_ID << "Not all spots fit into buffers";
+        cgn_spots_display_bkgnd(&s, &g);
+    }
+    else if (roiMode == ROI_MULTI)
     {
         if (subtract) {
             g.min = 1e10;
             g.max = -1e10;
-            g.subtract_bkgnd_v = 1;
-            cgn_copy_to_f64(&c, g.subtracted, nullptr);
+            for (auto &b : roiBkgnds) {
+                b.min = 1e10;
+                b.max = -1e10;
+            }
         }
-        for (const auto &roi : std::as_const(_config.rois)) {
-            setRoi(roi);
-            cgn_calc_beam_bkgnd(&c, &g, &r);
-            results << r;
+        QVector<CgnBeamResult> roiResults(roiBkgnds.size());
+        cgn_calc_beam_bkgnd_multi(&c, roiBkgnds.data(), roiResults.data(), roiBkgnds.size());
+        for (int i = 0; i < roiBkgnds.size(); i++) {
+            if (subtract) {
+                g.min = qMin(g.min, roiBkgnds.at(i).min);
+                g.max = qMax(g.max, roiBkgnds.at(i).max);
+            }
+            results << roiResults.at(i);
         }
     }
     else
@@ -261,7 +363,11 @@ void StillImageCamera::startCapture()
     auto calcTime = timer.elapsed();
 
     double minZ, maxZ;
-    cgn_ext_copy_to_f64(&c, &g, graph, _config.plot.normalize, _config.plot.fullRange, &minZ, &maxZ);
+    if (roiMode == ROI_MULTI && subtract)
+        cgn_ext_copy_apertures_to_f64(&c, &g, roiBkgnds.constData(), roiBkgnds.size(), graph,
+            _config.plot.normalize, _config.plot.fullRange, &minZ, &maxZ);
+    else
+        cgn_ext_copy_to_f64(&c, &g, graph, _config.plot.normalize, _config.plot.fullRange, &minZ, &maxZ);
     _plot->invalidateGraph();
     _plot->setResult(results, minZ, maxZ);
 
@@ -12,7 +12,7 @@
 #define CAMERA_HARD_FPS 30
 //#define LOG_FRAME_TIME
 
-enum CamDataRow { ROW_RENDER_TIME, ROW_CALC_TIME, ROW_POWER };
+enum CamDataRow { ROW_RENDER_TIME, ROW_CALC_TIME, ROW_QUEUE_DROPPED, ROW_POWER };
 
 class BeamRenderer : public CameraWorker
 {
@@ -53,13 +53,14 @@ public:
         yc_offset = RandomOffset(b.yc, b.yc-20, b.yc+20);
         phi_offset = RandomOffset(b.phi, b.phi-12, b.phi+12);
 
+        initBinning();
         plot->initGraph(c.w, c.h);
-        graph = plot->rawGraph();
 
         tableData = [this]{
             QMap<int, CamTableData> data = {
                 { ROW_RENDER_TIME, {avgAcqTime} },
                 { ROW_CALC_TIME, {avgCalcTime} },
+                { ROW_QUEUE_DROPPED, {ring.dropped(), CamTableData::COUNT, ring.dropped() > 0} },
             };
             if (showPower)
                 data[ROW_POWER] = {
@@ -73,14 +74,16 @@ public:
                 };
             return data;
         };
+        takeFrame = [this](uint8_t *buf){ acquired().buf = buf; };
+        frameShown = [this]{ emit cam->ready(); };
 
         configure();
     }
 
     inline bool waitFrame()
     {
-        tm = timer.elapsed();
-        if (tm - prevFrame < CAMERA_FRAME_DELAY_MS) {
+        acqTm = timer.elapsed();
+        if (acqTm - prevFrame < CAMERA_FRAME_DELAY_MS) {
             // Sleep gives a bad precision because OS decides how long the thread should sleep.
             // When we disable sleep, its possible to get an exact number of FPS,
             // e.g. 40 FPS when CAMERA_FRAME_DELAY_MS=25, but at cost of increased CPU usage.
@@ -89,8 +92,8 @@ public:
             return true;
         }
         avgFrameCount++;
-        avgFrameTime += tm - prevFrame;
-        prevFrame = tm;
+        avgFrameTime += acqTm - prevFrame;
+        prevFrame = acqTm;
         return false;
     }
 
@@ -99,8 +102,12 @@ public:
         while (true) {
             if (waitFrame()) continue;
 
-            tm = timer.elapsed();
-            cgn_render_beam_tilted(&b);
+            acqTm = timer.elapsed();
+            if (auto slot = beginFrame(); slot) {
+                b.buf = slot;
+                cgn_render_beam_tilted(&b);
+                endFrame();
+            }
             markAcqTime();
 
             b.dx = dx_offset.next();
@@ -109,15 +116,8 @@ public:
             b.yc = yc_offset.next();
             b.phi = phi_offset.next();
 
-            tm = timer.elapsed();
-            calcResult();
-            markCalcTime();
-
-            if (showResults())
-                emit cam->ready();
-
-            if (tm - prevStat >= STAT_DELAY_MS) {
-                prevStat = tm;
+            if (acqTm - prevStat >= STAT_DELAY_MS) {
+                prevStat = acqTm;
 
                 double ft = avgFrameTime / avgFrameCount;
                 avgFrameTime = 0;
@@ -139,7 +139,6 @@ public:
                     qDebug() << LOG_ID << "Interrupted by user";
                     return;
                 }
-                checkReconfig();
             }
         }
     }
@@ -152,18 +151,24 @@ VirtualDemoCamera::VirtualDemoCamera(PlotIntf *plot, TableIntf *table, Stability
 
     _render.reset(new BeamRenderer(plot, table, stabil, this, this));
     _render->togglePowerMeter();
+    _binning = _render->binning;
 
     connect(parent, SIGNAL(camConfigChanged()), this, SLOT(camConfigChanged()));
 }
 
 int VirtualDemoCamera::width() const
 {
-    return CAMERA_WIDTH;
+    return _render->c.w;
 }
 
 int VirtualDemoCamera::height() const
 {
-    return CAMERA_HEIGHT;
+    return _render->c.h;
+}
+
+int VirtualDemoCamera::bpp() const
+{
+    return _render->c.bpp;
 }
 
 TableRowsSpec VirtualDemoCamera::tableRows() const
@@ -171,7 +176,8 @@ TableRowsSpec VirtualDemoCamera::tableRows() const
     auto rows = Camera::tableRows();
     rows.aux
         << qMakePair(ROW_RENDER_TIME, qApp->tr("Render time"))
-        << qMakePair(ROW_CALC_TIME, qApp->tr("Calc time"));
+        << qMakePair(ROW_CALC_TIME, qApp->tr("Calc time"))
+        << qMakePair(ROW_QUEUE_DROPPED, qApp->tr("Queue dropped"));
     if (_config.power.on)
         rows.aux << qMakePair(ROW_POWER, qApp->tr("Power"));
     return rows;
@@ -203,6 +209,7 @@ void VirtualDemoCamera::stopMeasure()
 void VirtualDemoCamera::run()
 {
     _render->run();
+    _render->stopCalc();
 }
 
 void VirtualDemoCamera::camConfigChanged()
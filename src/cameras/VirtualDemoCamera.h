@@ -18,7 +18,7 @@ public:
     QString name() const override { return "Demo (render)"; }
     int width() const override;
     int height() const override;
-    int bpp() const override { return 8; }
+    int bpp() const override;
     PixelScale sensorScale() const override { return { .on=true, .factor=2.5, .unit="um" }; }
     TableRowsSpec tableRows() const override;
     QList<QPair<int, QString>> measurCols() const override;
@@ -14,7 +14,7 @@
 #define CAMERA_HARD_FPS 30
 //#define LOG_FRAME_TIME
 
-enum CamDataRow { ROW_RENDER_TIME, ROW_CALC_TIME, ROW_POWER };
+enum CamDataRow { ROW_RENDER_TIME, ROW_CALC_TIME, ROW_QUEUE_DROPPED, ROW_POWER };
 
 class ImageCameraWorker : public CameraWorker
 {
@@ -35,6 +35,7 @@ public:
             QMap<int, CamTableData> data = {
                 { ROW_RENDER_TIME, {avgAcqTime} },
                 { ROW_CALC_TIME, {avgCalcTime} },
+                { ROW_QUEUE_DROPPED, {ring.dropped(), CamTableData::COUNT, ring.dropped() > 0} },
             };
             if (showPower)
                 data[ROW_POWER] = {
@@ -48,6 +49,8 @@ public:
                 };
             return data;
         };
+        takeFrame = [this](uint8_t *buf){ acquired().buf = buf; };
+        frameShown = [this]{ emit cam->ready(); };
     }
 
     QString init()
@@ -76,8 +79,8 @@ public:
         if (centerX < 0 or centerX > c.w) centerX = c.w/2.0;
         if (centerY < 0 or centerY > c.h) centerY = c.h/2.0;
 
+        initBinning();
         plot->initGraph(c.w, c.h);
-        graph = plot->rawGraph();
 
         configure();
         togglePowerMeter();
@@ -87,8 +90,8 @@ public:
 
     inline bool waitFrame()
     {
-        tm = timer.elapsed();
-        if (tm - prevFrame < CAMERA_FRAME_DELAY_MS) {
+        acqTm = timer.elapsed();
+        if (acqTm - prevFrame < CAMERA_FRAME_DELAY_MS) {
             // Sleep gives a bad precision because OS decides how long the thread should sleep.
             // When we disable sleep, its possible to get an exact number of FPS,
             // e.g. 40 FPS when CAMERA_FRAME_DELAY_MS=25, but at cost of increased CPU usage.
@@ -97,8 +100,8 @@ public:
             return true;
         }
         avgFrameCount++;
-        avgFrameTime += tm - prevFrame;
-        prevFrame = tm;
+        avgFrameTime += acqTm - prevFrame;
+        prevFrame = acqTm;
         return false;
     }
 
@@ -111,10 +114,6 @@ public:
         jitterX.next();
         jitterY.next();
         jitterA.next();
-
-        // declare explicitly as const to avoid deep copy
-        const uchar* buf = jitterImg.bits();
-        c.buf = (uint8_t*)buf;
     }
 
     void run() {
@@ -122,19 +121,18 @@ public:
         while (true) {
             if (waitFrame()) continue;
 
-            tm = timer.elapsed();
+            acqTm = timer.elapsed();
             makeJitterImg();
+            if (auto slot = beginFrame(); slot) {
+                // declare explicitly as const to avoid deep copy
+                const QImage &img = jitterImg;
+                memcpy(slot, img.bits(), qMin(qsizetype(ring.frameSize()), img.sizeInBytes()));
+                endFrame();
+            }
             markAcqTime();
 
-            tm = timer.elapsed();
-            calcResult();
-            markCalcTime();
-
-            if (showResults())
-                emit cam->ready();
-
-            if (tm - prevStat >= STAT_DELAY_MS) {
-                prevStat = tm;
+            if (acqTm - prevStat >= STAT_DELAY_MS) {
+                prevStat = acqTm;
 
                 double ft = avgFrameTime / avgFrameCount;
                 avgFrameTime = 0;
@@ -156,7 +154,6 @@ public:
                     qDebug() << LOG_ID << "Interrupted by user";
                     return;
                 }
-                checkReconfig();
             }
         }
     }
@@ -176,23 +173,24 @@ VirtualImageCamera::VirtualImageCamera(PlotIntf *plot, TableIntf *table, Stabili
         return;
     }
     _render.reset(render);
+    _binning = render->binning;
 
     connect(parent, SIGNAL(camConfigChanged()), this, SLOT(camConfigChanged()));
 }
 
 int VirtualImageCamera::width() const
 {
-    return _render ? _render->image.width() : 0;
+    return _render ? _render->c.w : 0;
 }
 
 int VirtualImageCamera::height() const
 {
-    return _render ? _render->image.height() : 0;
+    return _render ? _render->c.h : 0;
 }
 
 int VirtualImageCamera::bpp() const
 {
-    return _render ? _render->image.depth() : 0;
+    return _render ? _render->c.bpp : 0;
 }
 
 TableRowsSpec VirtualImageCamera::tableRows() const
@@ -200,7 +198,8 @@ TableRowsSpec VirtualImageCamera::tableRows() const
     auto rows = Camera::tableRows();
     rows.aux
         << qMakePair(ROW_RENDER_TIME, qApp->tr("Render time"))
-        << qMakePair(ROW_CALC_TIME, qApp->tr("Calc time"));
+        << qMakePair(ROW_CALC_TIME, qApp->tr("Calc time"))
+        << qMakePair(ROW_QUEUE_DROPPED, qApp->tr("Queue dropped"));
     if (_config.power.on)
         rows.aux << qMakePair(ROW_POWER, qApp->tr("Power"));
     return rows;
@@ -233,8 +232,10 @@ void VirtualImageCamera::stopMeasure()
 
 void VirtualImageCamera::run()
 {
-    if (_render)
+    if (_render) {
         _render->run();
+        _render->stopCalc();
+    }
 }
 
 void VirtualImageCamera::camConfigChanged()
@@ -6,8 +6,11 @@
 #include "tools/OriDebug.h"
 #include "tools/OriHelpWindow.h"
 
+#include "beam_calc.h"
+
 #include <QApplication>
 #include <QCommandLineParser>
+#include <QDebug>
 #include <QMessageBox>
 
 #ifndef Q_OS_WIN
@@ -65,6 +68,12 @@ int main(int argc, char *argv[])
     // to be able to apply custom colors.
     app.setStyleSheet(Ori::Theme::makeStyleSheet(Ori::Theme::loadRawStyleSheet()));
 
+    // Select calculation kernels for the current CPU
+    // once before any camera starts
+    int simd = cgn_init_simd();
+    int threads = cgn_set_threads(AppSettings::instance().calcThreads);
+    qDebug() << "SIMD:" << cgn_simd_name(simd) << "threads:" << threads;
+
     PlotWindow w;
     w.show();
 
@@ -28,6 +28,33 @@ void BeamColorMap::setGradient(const QCPColorGradient &gradient)
 BeamColorMapData::BeamColorMapData(int w, int h)
     : QCPColorMapData(w, h, QCPRange(0, w), QCPRange(0, h))
 {
+    _buffers[0] = mData;
+    for (int i = 1; i < BUFFER_COUNT; i++) {
+        _buffers[i] = new double[w*h];
+        memset(_buffers[i], 0, sizeof(double)*w*h);
+    }
+}
+
+BeamColorMapData::~BeamColorMapData()
+{
+    // The shown buffer is deleted by the base class
+    for (int i = 0; i < BUFFER_COUNT; i++)
+        if (_buffers[i] != mData)
+            delete[] _buffers[i];
+}
+
+int BeamColorMapData::shownBuffer() const
+{
+    for (int i = 0; i < BUFFER_COUNT; i++)
+        if (_buffers[i] == mData)
+            return i;
+    return 0;
+}
+
+void BeamColorMapData::showBuffer(int index)
+{
+    mData = _buffers[index];
+    mDataModified = true;
 }
 
 //------------------------------------------------------------------------------
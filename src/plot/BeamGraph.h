@@ -22,9 +22,19 @@ class BeamColorMapData : public QCPColorMapData
 {
 public:
     BeamColorMapData(int w, int h);
+    ~BeamColorMapData();
 
     inline double* rawData() { return mData; }
     inline void invalidate() { mDataModified = true; }
+
+    /// Buffers of the same size as the data, one of them is shown at a time, see PlotIntf
+    enum { BUFFER_COUNT = 3 };
+    inline double* buffer(int index) { return _buffers[index]; }
+    int shownBuffer() const;
+    void showBuffer(int index);
+
+private:
+    double* _buffers[BUFFER_COUNT];
 };
 
 //------------------------------------------------------------------------------
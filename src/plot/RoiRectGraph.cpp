@@ -457,8 +457,9 @@ void RoiRectsGraph::draw(QCPPainter *painter)
 
 void RoiRectsGraph::drawGoodness(int index, double beamXc, double beamYc)
 {
-    // This is visible on ROI_MULTI mode, and all list sizes should must match
-    if (!visible()) return;
+    // This is visible on ROI_MULTI mode, and all list sizes should must match,
+    // but there can be more results than regions in the spot array mode
+    if (!visible() || index >= _unitRois.size()) return;
 
     const auto &roi = _unitRois.at(index);
     const double roiXc = (roi.left + roi.right) / 2.0;
@@ -1,5 +1,6 @@
 #include "PlotIntf.h"
 
+#include "app/AppSettings.h"
 #include "plot/BeamGraph.h"
 #include "plot/RoiRectGraph.h"
 
@@ -8,6 +9,8 @@
 PlotIntf::PlotIntf(QObject *eventsTarget, QCustomPlot *plot, QCPColorMap *colorMap, QCPColorScale *colorScale, BeamInfoText *beamInfo, RoiRectsGraph *rois)
     : _eventsTarget(eventsTarget), _plot(plot), _colorMap(colorMap), _colorScale(colorScale), _beamInfo(beamInfo), _rois(rois)
 {
+    _displayTimer.start();
+    _displayDelay = AppSettings::instance().plotDelayMin;
 }
 
 void PlotIntf::initGraph(int w, int h)
@@ -21,6 +24,12 @@ void PlotIntf::initGraph(int w, int h)
     } else {
         _beamData = static_cast<BeamColorMapData*>(d);
     }
+    // Called before a camera thread is started, so the buffers can be rearranged here
+    _front = _beamData->shownBuffer();
+    _back = (_front + 1) % BeamColorMapData::BUFFER_COUNT;
+    _middle.store((_front + 2) % BeamColorMapData::BUFFER_COUNT);
+    // A frame announced by the previous camera could be never shown
+    _displayPending = false;
 }
 
 double* PlotIntf::rawGraph() const
@@ -33,6 +42,53 @@ void PlotIntf::invalidateGraph() const
     _beamData->invalidate();
 }
 
+double* PlotIntf::backGraph() const
+{
+    return _beamData->buffer(_back);
+}
+
+void PlotIntf::publishGraph(const QList<CgnBeamResult>& r, double min, double max)
+{
+    auto &f = _frames[_back];
+    f.results = r;
+    f.min = min;
+    f.max = max;
+    _back = _middle.exchange(_back | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+}
+
+void PlotIntf::beginDisplay()
+{
+    _displayStart.store(_displayTimer.elapsed(), std::memory_order_relaxed);
+    _displayPending.store(true, std::memory_order_release);
+}
+
+void PlotIntf::endDisplay()
+{
+    if (!_displayPending.load(std::memory_order_acquire))
+        return;
+    // The time includes waiting in the event queue, so it also grows
+    // when the GUI is busy with deferred painting of previous frames
+    const qint64 t = _displayTimer.elapsed() - _displayStart.load(std::memory_order_relaxed);
+    _avgDisplayTime = _avgDisplayTime*0.8 + t*0.2;
+    // Keep the GUI thread busy with showing frames no more than half of the time
+    const auto &s = AppSettings::instance();
+    _displayDelay.store(qMax(s.plotDelayMin, qMin(qRound(_avgDisplayTime*2), s.plotDelayMax)), std::memory_order_relaxed);
+    _displayPending.store(false, std::memory_order_release);
+}
+
+bool PlotIntf::takeGraph()
+{
+    if (!_beamData || !(_middle.load(std::memory_order_relaxed) & FRESH))
+        return false;
+    _front = _middle.exchange(_front, std::memory_order_acq_rel) & INDEX_MASK;
+    const auto &f = _frames[_front];
+    _results = f.results;
+    _min = f.min;
+    _max = f.max;
+    _beamData->showBuffer(_front);
+    return true;
+}
+
 void PlotIntf::cleanResult()
 {
     _results.clear();
@@ -58,6 +114,8 @@ template <class T> void trimList(QCustomPlot *plot, QList<T>& list, int n)
 
 void PlotIntf::showResult()
 {
+    takeGraph();
+
     const int resultCount = _results.size();
     for (int i = 0; i < resultCount; i++) {
         const CgnBeamResult& r = _results.at(i);
@@ -5,6 +5,10 @@
 
 #include "cameras/CameraTypes.h"
 
+#include <QElapsedTimer>
+
+#include <atomic>
+
 class BeamColorMapData;
 class BeamAxes;
 class BeamEllipse;
@@ -26,6 +30,7 @@ public:
 
     void setScale(const PixelScale& scale) { _scale = scale; }
     void setResult(const QList<CgnBeamResult>& r, double min, double max);
+    /// Shows the latest published frame if there is one
     void showResult();
     void cleanResult();
     void setRawView(bool on);
@@ -33,8 +38,24 @@ public:
     const QList<CgnBeamResult>& results() const { return _results; }
 
     void initGraph(int w, int h);
+    /// The shown graph data, camera threads should use backGraph instead
     double* rawGraph() const;
     void invalidateGraph() const;
+
+    /// The graph buffer a camera thread fills for the next frame, it's not shown until published
+    double* backGraph() const;
+    /// Makes the filled back buffer the latest frame and takes another free buffer for the next one.
+    /// The camera thread never waits for the GUI thread here, unshown frames are just overwritten.
+    void publishGraph(const QList<CgnBeamResult>& r, double min, double max);
+
+    /// Minimal interval between shown frames, it follows the time the GUI spends on showing a frame
+    int displayDelay() const { return _displayDelay.load(std::memory_order_relaxed); }
+    /// A frame has been announced to the GUI but not shown yet, newer frames are not announced until then
+    bool displayPending() const { return _displayPending.load(std::memory_order_acquire); }
+    /// Called by a camera thread before it signals that a frame is ready
+    void beginDisplay();
+    /// Called by the GUI thread when the frame has been shown
+    void endDisplay();
     int graphW() const { return _w; }
     int graphH() const { return _h; }
     double rangeMin() const { return _min; }
@@ -43,6 +64,12 @@ public:
     std::function<void()> onDataShown;
 
 private:
+    struct DisplayFrame
+    {
+        QList<CgnBeamResult> results;
+        double min = 0, max = 0;
+    };
+
     QObject *_eventsTarget;
     QCustomPlot *_plot;
     int _w = 0, _h = 0;
@@ -53,9 +80,25 @@ private:
     QCPColorMap *_colorMap;
     QCPColorScale *_colorScale;
     BeamColorMapData *_beamData = nullptr;
+    /// Results of frames in graph buffers with the same indices
+    DisplayFrame _frames[3];
+    /// The buffer being filled by the camera thread
+    int _back = 1;
+    /// The buffer being shown by the GUI thread
+    int _front = 0;
+    /// The buffer between them, with the FRESH flag when it has been published but not shown yet
+    std::atomic<int> _middle { 2 };
+    enum { FRESH = 4, INDEX_MASK = 3 };
+    QElapsedTimer _displayTimer;
+    std::atomic<qint64> _displayStart { 0 };
+    std::atomic<bool> _displayPending { false };
+    std::atomic<int> _displayDelay;
+    double _avgDisplayTime = 0;
     QList<BeamEllipse*> _beamShapes;
     QList<BeamAxes*> _beamAxes;
     RoiRectsGraph *_rois;
+
+    bool takeGraph();
 };
 
 #endif // PLOT_INTF_H
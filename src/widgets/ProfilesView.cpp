@@ -343,8 +343,15 @@ void ProfilesView::showResult()
     if (_mavgFrames > 0)
     {
         calcProfiles(arg, res, _lastX, _lastY);
-        _profiles.enqueue({ _lastX, _lastY });
-        int pointCount = totalPoints();
+        const int pointCount = totalPoints();
+        double *v = _profileVals.data();
+        for (int i = 0; i < pointCount; i++) {
+            v[4*i+0] = _lastX.at(i).key;
+            v[4*i+1] = _lastX.at(i).value;
+            v[4*i+2] = _lastY.at(i).key;
+            v[4*i+3] = _lastY.at(i).value;
+        }
+        _profileAvg.add(v);
 
         // auto& rawX = _rawX->data()->rawData();
         // auto& rawY = _rawY->data()->rawData();
@@ -358,53 +365,11 @@ void ProfilesView::showResult()
         auto& avgX = _profileX->data()->rawData();
         auto& avgY = _profileY->data()->rawData();
 
-        if (_profiles.size() > _mavgFrames) {
-            const auto first = _profiles.dequeue();
-            const double avgCount = _profiles.size();
-            for (int i = 0; i < pointCount; i++) {
-                {
-                    const double prev_k = avgX.at(i).key;
-                    const double prev_v = avgX.at(i).value;
-                    const double first_k = first.x.at(i).key;
-                    const double first_v = first.x.at(i).value;
-                    const double last_k = _lastX.at(i).key;
-                    const double last_v = _lastX.at(i).value;
-                    avgX[i].key = prev_k + (last_k - first_k) / avgCount;
-                    avgX[i].value = prev_v + (last_v - first_v) / avgCount;
-                }
-                {
-                    const double prev_k = avgY.at(i).key;
-                    const double prev_v = avgY.at(i).value;
-                    const double first_k = first.y.at(i).key;
-                    const double first_v = first.y.at(i).value;
-                    const double last_k = _lastY.at(i).key;
-                    const double last_v = _lastY.at(i).value;
-                    avgY[i].key = prev_k + (last_k - first_k) / avgCount;
-                    avgY[i].value = prev_v + (last_v - first_v) / avgCount;
-                }
-            }
-        } else {
-            for (int i = 0; i < pointCount; i++) {
-                avgX[i].key = 0;
-                avgX[i].value = 0;
-                avgY[i].key = 0;
-                avgY[i].value = 0;
-            }
-            for (const auto& profile : std::as_const(_profiles)) {
-                for (int i = 0; i < pointCount; i++) {
-                    avgX[i].key += profile.x.at(i).key;
-                    avgX[i].value += profile.x.at(i).value;
-                    avgY[i].key += profile.y.at(i).key;
-                    avgY[i].value += profile.y.at(i).value;
-                }
-            }
-            const double avgCount = _profiles.size();
-            for (int i = 0; i < pointCount; i++) {
-                avgX[i].key /= avgCount;
-                avgX[i].value /= avgCount;
-                avgY[i].key /= avgCount;
-                avgY[i].value /= avgCount;
-            }
+        for (int i = 0; i < pointCount; i++) {
+            avgX[i].key = _profileAvg.mean(4*i+0);
+            avgX[i].value = _profileAvg.mean(4*i+1);
+            avgY[i].key = _profileAvg.mean(4*i+2);
+            avgY[i].value = _profileAvg.mean(4*i+3);
         }
     }
     else
@@ -455,9 +420,8 @@ void ProfilesView::setConfig(const PixelScale& scale, const Averaging& mavg)
     _scale = scale;
     
     _mavgFrames = mavg.on ? mavg.frames : 0;
-    auto& avgX = _profileX->data()->rawData();
-    auto& avgY = _profileY->data()->rawData();
-    _profiles.clear();
+    _profileAvg.init(4*totalPoints(), _mavgFrames);
+    _profileVals = QVector<double>(4*totalPoints());
     
     updateVisibility();
 
@@ -1,10 +1,10 @@
 #ifndef PROFILES_VIEW_H
 #define PROFILES_VIEW_H
 
+#include "app/StreamStats.h"
 #include "cameras/CameraTypes.h"
 #include "widgets/PlotHelpers.h"
 
-#include <QQueue>
 #include <QWidget>
 
 class PlotIntf;
@@ -30,7 +30,6 @@ public:
 
     struct Point { double key, value ;};
     using Points = QVector<Point>;
-    struct Profile { Points x; Points y; };
 
 private:
     PlotIntf *_plotIntf;
@@ -38,7 +37,9 @@ private:
     //QCPGraph *_rawX, *_rawY;
     QCPGraph *_profileX, *_profileY, *_fitX, *_fitY;
     Points _lastX, _lastY;
-    QQueue<Profile> _profiles;
+    /// Averages of keys and values of X points, then of Y points, over the last frames
+    StreamStats _profileAvg;
+    QVector<double> _profileVals;
     QCPTextElement *_textMiX, *_textMiY;
     PixelScale _scale;
     QAction *_actnShowFit, *_actnCopyFitX, *_actnCopyFitY, *_actnSetMI, *_actnCenterFit, *_actnShowFullY;
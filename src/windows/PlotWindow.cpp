@@ -315,12 +315,13 @@ void PlotWindow::createMenuBar()
     _actionUseMultiRoi = A_(tr("Use Multi-ROI"), this, &PlotWindow::toggleMultiRoi, ":/toolbar/roi_multi");
     _actionUseMultiRoi->setCheckable(true);
     _actionSetupPowerMeter = A_(tr("Power Meter..."), this, &PlotWindow::setupPowerMeter);
+    _actionSetupCalib = A_(tr("Calibration..."), this, &PlotWindow::setupCalibration);
     _actionSetCamCustomName = A_(tr("Custom Name..."), this, &PlotWindow::setCamCustomName);
     _actionCamConfig = A_(tr("Settings..."), this, [this]{ PlotWindow::editCamConfig(-1); }, ":/toolbar/settings");
     menuBar()->addMenu(M_(tr("Camera"), {
         _actionMeasure, 0,
         _actionUseRoi, _actionUseMultiRoi, _actionEditRoi, 0,
-        _actionSetupPowerMeter, _actionSetCamCustomName, _actionCamConfig,
+        _actionSetupPowerMeter, _actionSetupCalib, _actionSetCamCustomName, _actionCamConfig,
     }));
 
     _actionCrosshairsShow = A_(tr("Show Crosshairs"), this, &PlotWindow::toggleCrosshairsVisbility, ":/toolbar/crosshair");
@@ -594,9 +595,9 @@ void PlotWindow::dropEvent(QDropEvent* e)
 bool PlotWindow::event(QEvent *event)
 {
     if (auto e = dynamic_cast<ImageEvent*>(event); e) {
-        QByteArray imgData = e->buf;
+        FrameBuf imgData = e->buf;
         QTimer::singleShot(0, this, [this, imgData]{
-            exportImageDlg(imgData, _camera->width(), _camera->height(), _camera->bpp());
+            exportImageDlg(imgData.bytes(), _camera->width(), _camera->height(), _camera->bpp());
         });
         return true;
     }
@@ -644,6 +645,7 @@ void PlotWindow::showCamConfig(bool replot, bool autozoom)
     _actionSaveRaw->setEnabled(_camera->canSaveRawImg() && _camera->isCapturing());
     _actionSetCamCustomName->setVisible(!_camera->customId().isEmpty());
     _actionSetupPowerMeter->setVisible(_camera->isPowerMeter());
+    _actionSetupCalib->setVisible(_camera->canCalibrate());
     _actionEditRoi->setVisible(_camera->config().roiMode == ROI_SINGLE);
     showSelectedCamera();
 
@@ -727,6 +729,7 @@ void PlotWindow::updateControls()
     _actionMeasure->setDisabled(!opened);
     _camConfigPanel->setReadOnly(started || !opened);
     _actionSetupPowerMeter->setDisabled(started || !opened);
+    _actionSetupCalib->setDisabled(started || !opened);
     _actionCrosshairsShow->setDisabled(started || !opened);
     _actionCrosshairsEdit->setDisabled(started || !opened);
     _actionClearCrosshairs->setDisabled(started || !opened);
@@ -849,6 +852,7 @@ void PlotWindow::dataReady()
         _profilesView->showResult();
     if (_stabilityDock->isVisible())
         _stabilityView->showResult();
+    _plotIntf->endDisplay();
 }
 
 void PlotWindow::openImageDlg()
@@ -938,6 +942,12 @@ void PlotWindow::setupPowerMeter()
         doCamConfigChanged();
 }
 
+void PlotWindow::setupCalibration()
+{
+    if (_camera->setupCalibration())
+        doCamConfigChanged();
+}
+
 void PlotWindow::doCamConfigChanged()
 {
     if (dynamic_cast<StillImageCamera*>(_camera.get())) {
@@ -62,7 +62,7 @@ private:
         *_actionCamWelcome, *_actionCamImage, *_actionCamDemoRender, *_actionCamDemoImage, *_actionRefreshCams,
         *_actionResultsPanel, *_actionHardConfig, *_actionSaveRaw, *_actionRawView,
         *_actionCrosshairsShow, *_actionCrosshairsEdit, *_actionSetCamCustomName,
-        *_actionSetupPowerMeter, *_actionUseMultiRoi, *_actionProfilesView, *_actionStabilityView,
+        *_actionSetupPowerMeter, *_actionSetupCalib, *_actionUseMultiRoi, *_actionProfilesView, *_actionStabilityView,
         *_actionClearCrosshairs, *_actionLoadCrosshairs, *_actionSaveCrosshairs;
     QAction *_buttonMeasure, *_buttonOpenImg;
     QActionGroup *_colorMapActions;
@@ -111,6 +111,7 @@ private:
     void selectColorMapFile();
     void setCamCustomName();
     void setupPowerMeter();
+    void setupCalibration();
     void toggleCrosshairsEditing();
     void toggleCrosshairsVisbility();
     void toggleHardConfig();